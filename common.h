@@ -22,6 +22,11 @@
 #define WARP_PER_BLOCK 2
 #endif
 
+// launch the whole block schedule as one CUDA graph instead of block by block
+#ifndef USE_CUDA_GRAPH
+#define USE_CUDA_GRAPH 1
+#endif
+
 #define SUBSTITUTION_FORWARD 0
 #define SUBSTITUTION_BACKWARD 1
 
@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "tranpose.h"
+#include "utils.h"
 
 int findlevel(const int *cscColPtr,
               const int *cscRowIdx,
@@ -82,6 +83,81 @@ int findlevel(const int *cscColPtr,
     return 0;
 }
 
+// sort the items of each level by the mean position of the items they depend on, so a level
+// gathers x roughly in the order the earlier levels wrote it; rows of one level never depend on
+// each other, so any order inside a level is still a valid schedule
+#ifndef LEVEL_LOCALITY_SORT
+#define LEVEL_LOCALITY_SORT 1
+#endif
+
+typedef struct LevelKey
+{
+    double key;
+    int order; // discovery order, breaks ties so equal keys keep it
+    int item;
+} LevelKey;
+
+int levelkey_compare(const void *a, const void *b)
+{
+    const LevelKey *x = (const LevelKey *)a;
+    const LevelKey *y = (const LevelKey *)b;
+    if (x->key != y->key)
+        return x->key < y->key ? -1 : 1;
+    return x->order - y->order;
+}
+
+void findlevel_locality_sort(const int *cscColPtr,
+                             const int *cscRowIdx,
+                             const int m,
+                             const int nnz,
+                             const int nlevel,
+                             const int *levelPtr,
+                             int *levelItem)
+{
+    // transpose to have the dependencies of each row
+    int *csrRowPtr = (int *)malloc((m + 1) * sizeof(int));
+    int *csrColIdx = (int *)malloc(nnz * sizeof(int));
+    matrix_transposition_lite(m, m, nnz, cscColPtr, cscRowIdx, csrColIdx, csrRowPtr);
+
+    int *pos = (int *)malloc(m * sizeof(int));
+    LevelKey *key = (LevelKey *)malloc(m * sizeof(LevelKey));
+    for (int i = levelPtr[0]; i < levelPtr[1]; i++)
+        pos[levelItem[i]] = i;
+
+    for (int lv = 1; lv < nlevel; lv++)
+    {
+        for (int i = levelPtr[lv]; i < levelPtr[lv + 1]; i++)
+        {
+            int node = levelItem[i];
+            double sum = 0;
+            int count = 0;
+            for (int j = csrRowPtr[node]; j < csrRowPtr[node + 1]; j++)
+            {
+                if (csrColIdx[j] != node)
+                {
+                    sum += pos[csrColIdx[j]];
+                    count++;
+                }
+            }
+            key[i].key = count ? sum / count : 0;
+            key[i].order = i;
+            key[i].item = node;
+        }
+        // rows sharing one parent all get the same key, so avoid the recursive quicksort here
+        qsort(&key[levelPtr[lv]], levelPtr[lv + 1] - levelPtr[lv], sizeof(LevelKey), levelkey_compare);
+        for (int i = levelPtr[lv]; i < levelPtr[lv + 1]; i++)
+        {
+            levelItem[i] = key[i].item;
+            pos[levelItem[i]] = i;
+        }
+    }
+
+    free(csrRowPtr);
+    free(csrColIdx);
+    free(pos);
+    free(key);
+}
+
 int findlevel_csc(const int *cscColPtr,
                   const int *cscRowIdx,
                   const VALUE_TYPE *cscVal,
@@ -6,8 +6,898 @@
 #include "mmio_highlevel.h"
 #include "recblocking_solver.h"
 #include "recblocking_solver_cuda.h"
+#include "recblocking_factor.h"
+#include "recblocking_krylov.h"
+#include "utils_sptrsv_sparse_cuda.h"
+#include "utils_sptrsv_batch_cuda.h"
+#include "utils_numa.h"
 
-// "Usage: ``./sptrsv-double -d 0 -rhs 1 -lv -1 -forward/-backward -mtx A.mtx'' for Ax=b on device 0"
+// validate x against the reference solution
+int check_x(VALUE_TYPE *x, VALUE_TYPE *x_ref, int len)
+{
+    int flag = 0;
+    double accuracy = 1e-4;
+    double ref = 0.0;
+    double res = 0.0;
+
+    for (int i = 0; i < len; i++)
+    {
+        ref += abs(x_ref[i]);
+        res += abs(x[i] - x_ref[i]);
+    }
+    printf("\n");
+
+    res = ref == 0 ? res : res / ref;
+    
+    if (res < accuracy && (res >= 0))
+    {
+        printf("x check passed! |x-xref|/|xref| = %8.2e\n", res);
+        flag = 1;
+    }
+    else
+        printf(" x check _NOT_ passed! |x-xref|/|xref| = %8.2e\n", res);
+    return flag;
+}
+
+// fill idx with k distinct random rows of [0, m)
+void pick_distinct_rows(int *idx, int k, int m)
+{
+    char *picked = (char *)malloc(m * sizeof(char));
+    memset(picked, 0, m * sizeof(char));
+    for (int t = 0; t < k; t++)
+    {
+        int i = rand() % m;
+        while (picked[i])
+            i = (i + 1) % m;
+        picked[i] = 1;
+        idx[t] = i;
+    }
+    free(picked);
+}
+
+// b = L * (U * x_ref), then time x = U \ (L \ b) through the plan and check x against x_ref
+void bench_lu_plan(RecBlockLUPlan *plan,
+                   int *csrRowPtrL, int *csrColIdxL, VALUE_TYPE *csrValL, int nnzL,
+                   int *csrRowPtrU, int *csrColIdxU, VALUE_TYPE *csrValU, int nnzU,
+                   int m, double preprocess_time)
+{
+    VALUE_TYPE *x_ref = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * m);
+    VALUE_TYPE *y = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * m);
+    VALUE_TYPE *b = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * m);
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * m);
+    for (int i = 0; i < m; i++)
+        x_ref[i] = rand() % 10 + 1;
+    for (int i = 0; i < m; i++)
+    {
+        y[i] = 0;
+        for (int j = csrRowPtrU[i]; j < csrRowPtrU[i + 1]; j++)
+            y[i] += csrValU[j] * x_ref[csrColIdxU[j]];
+    }
+    for (int i = 0; i < m; i++)
+    {
+        b[i] = 0;
+        for (int j = csrRowPtrL[i]; j < csrRowPtrL[i + 1]; j++)
+            b[i] += csrValL[j] * y[csrColIdxL[j]];
+    }
+
+    VALUE_TYPE *d_b;
+    VALUE_TYPE *d_x;
+    cudaMalloc((void **)&d_b, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x, m * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_b, b, m * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);
+    for (int re = 0; re < BENCH_REPEAT; re++)
+        recblocking_lu_plan_solve(plan, d_b, d_x);
+    gettimeofday(&t2, NULL);
+    double cal_time = ((t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0) / BENCH_REPEAT;
+    cudaMemcpy(x, d_x, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+
+    printf("preprocess usetime = %.3lf ms\n", preprocess_time);
+    printf("LU apply usetime = %.3lf ms\n", cal_time);
+    printf("Performance = %.3lf gflops\n", (2 * (double)(nnzL + nnzU)) / (cal_time * 1e6));
+    check_x(x, x_ref, m);
+
+    cudaFree(d_b);
+    cudaFree(d_x);
+    free(x_ref);
+    free(y);
+    free(b);
+    free(x);
+}
+
+// split A into L and U with unit diagonals and solve LUx=b with one fused plan
+void run_lu(int *csrRowPtrA, int *csrColIdxA, int m, int nnzA, int lv, int adaptive)
+{
+    int *csrRowPtrL = (int *)malloc((m + 1) * sizeof(int));
+    int *csrColIdxL = (int *)malloc((m + nnzA) * sizeof(int));
+    VALUE_TYPE *csrValL = (VALUE_TYPE *)malloc((m + nnzA) * sizeof(VALUE_TYPE));
+    int *csrRowPtrU = (int *)malloc((m + 1) * sizeof(int));
+    int *csrColIdxU = (int *)malloc((m + nnzA) * sizeof(int));
+    VALUE_TYPE *csrValU = (VALUE_TYPE *)malloc((m + nnzA) * sizeof(VALUE_TYPE));
+
+    int nnzL = 0;
+    int nnzU = 0;
+    csrRowPtrL[0] = 0;
+    csrRowPtrU[0] = 0;
+    for (int i = 0; i < m; i++)
+    {
+        csrColIdxU[nnzU] = i;
+        csrValU[nnzU] = 1.0;
+        nnzU++;
+        for (int j = csrRowPtrA[i]; j < csrRowPtrA[i+1]; j++)
+        {
+            if (csrColIdxA[j] < i)
+            {
+                csrColIdxL[nnzL] = csrColIdxA[j];
+                csrValL[nnzL] = rand() % 10 + 1;
+                nnzL++;
+            }
+            else if (csrColIdxA[j] > i)
+            {
+                csrColIdxU[nnzU] = csrColIdxA[j];
+                csrValU[nnzU] = rand() % 10 + 1;
+                nnzU++;
+            }
+        }
+        csrColIdxL[nnzL] = i;
+        csrValL[nnzL] = 1.0;
+        nnzL++;
+        csrRowPtrL[i+1] = nnzL;
+        csrRowPtrU[i+1] = nnzU;
+    }
+    printf("L nnz = %i, U nnz = %i\n", nnzL, nnzU);
+
+    // transpose CSR of L and U to CSC on the device
+    int *cscColPtrL = (int *)malloc(sizeof(int) * (m + 1));
+    int *cscRowIdxL = (int *)malloc(sizeof(int) * nnzL);
+    VALUE_TYPE *cscValL = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * nnzL);
+    int *cscColPtrU = (int *)malloc(sizeof(int) * (m + 1));
+    int *cscRowIdxU = (int *)malloc(sizeof(int) * nnzU);
+    VALUE_TYPE *cscValU = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * nnzU);
+    matrix_transposition(m, m, nnzL, csrRowPtrL, csrColIdxL, csrValL, cscRowIdxL, cscColPtrL, cscValL);
+    matrix_transposition(m, m, nnzU, csrRowPtrU, csrColIdxU, csrValU, cscRowIdxU, cscColPtrU, cscValU);
+
+    int *d_cscColPtrL;
+    int *d_cscRowIdxL;
+    VALUE_TYPE *d_cscValL;
+    int *d_cscColPtrU;
+    int *d_cscRowIdxU;
+    VALUE_TYPE *d_cscValU;
+    cudaMalloc((void **)&d_cscColPtrL, (m + 1) * sizeof(int));
+    cudaMalloc((void **)&d_cscRowIdxL, nnzL * sizeof(int));
+    cudaMalloc((void **)&d_cscValL, nnzL * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_cscColPtrU, (m + 1) * sizeof(int));
+    cudaMalloc((void **)&d_cscRowIdxU, nnzU * sizeof(int));
+    cudaMalloc((void **)&d_cscValU, nnzU * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_cscColPtrL, cscColPtrL, (m + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_cscRowIdxL, cscRowIdxL, nnzL * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_cscValL, cscValL, nnzL * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_cscColPtrU, cscColPtrU, (m + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_cscRowIdxU, cscRowIdxU, nnzU * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_cscValU, cscValU, nnzU * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);
+    RecBlockLUPlan plan;
+    recblocking_lu_plan_create(&plan, d_cscColPtrL, d_cscRowIdxL, d_cscValL, nnzL,
+                               d_cscColPtrU, d_cscRowIdxU, d_cscValU, nnzU, m, lv, adaptive);
+    gettimeofday(&t2, NULL);
+    double preprocess_time = (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+    bench_lu_plan(&plan, csrRowPtrL, csrColIdxL, csrValL, nnzL, csrRowPtrU, csrColIdxU, csrValU, nnzU, m, preprocess_time);
+
+    recblocking_lu_plan_destroy(&plan);
+    cudaFree(d_cscColPtrL);
+    cudaFree(d_cscRowIdxL);
+    cudaFree(d_cscValL);
+    cudaFree(d_cscColPtrU);
+    cudaFree(d_cscRowIdxU);
+    cudaFree(d_cscValU);
+    free(csrRowPtrL);
+    free(csrColIdxL);
+    free(csrValL);
+    free(csrRowPtrU);
+    free(csrColIdxU);
+    free(csrValU);
+    free(cscColPtrL);
+    free(cscRowIdxL);
+    free(cscValL);
+    free(cscColPtrU);
+    free(cscRowIdxU);
+    free(cscValU);
+}
+
+// solve Ax=b with a Krylov method preconditioned by the factors in plan
+void run_krylov(RecBlockLUPlan *plan, int *csrRowPtrA, int *csrColIdxA, VALUE_TYPE *csrValA, int m, int nnzA, int krylov)
+{
+    VALUE_TYPE *x_ref = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * m);
+    VALUE_TYPE *b = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * m);
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * m);
+    for (int i = 0; i < m; i++)
+        x_ref[i] = rand() % 10 + 1;
+    for (int i = 0; i < m; i++)
+    {
+        b[i] = 0;
+        for (int j = csrRowPtrA[i]; j < csrRowPtrA[i + 1]; j++)
+            b[i] += csrValA[j] * x_ref[csrColIdxA[j]];
+    }
+
+    int *d_csrRowPtrA;
+    int *d_csrColIdxA;
+    VALUE_TYPE *d_csrValA;
+    VALUE_TYPE *d_b;
+    VALUE_TYPE *d_x;
+    cudaMalloc((void **)&d_csrRowPtrA, (m + 1) * sizeof(int));
+    cudaMalloc((void **)&d_csrColIdxA, nnzA * sizeof(int));
+    cudaMalloc((void **)&d_csrValA, nnzA * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_b, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x, m * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_csrRowPtrA, csrRowPtrA, (m + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_csrColIdxA, csrColIdxA, nnzA * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_csrValA, csrValA, nnzA * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_b, b, m * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    cudaMemset(d_x, 0, m * sizeof(VALUE_TYPE));
+
+    KrylovSystem sys;
+    krylov_system_create(&sys, plan, d_csrRowPtrA, d_csrColIdxA, d_csrValA, m, nnzA);
+    KrylovStats stats;
+    double tol = sizeof(VALUE_TYPE) == 8 ? 1e-10 : 1e-5;
+    krylov_solve(krylov, plan, &sys, d_b, d_x, 1000, tol, &stats);
+    cudaMemcpy(x, d_x, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+
+    int it = stats.iter > 0 ? stats.iter : 1;
+    printf("%s: %d iterations, relative residual = %8.2e\n",
+           krylov == KRYLOV_PCG ? "PCG" : (krylov == KRYLOV_BICGSTAB ? "BiCGStab" : "GMRES"), stats.iter, stats.relres);
+    printf("per iteration: spmv = %.3lf ms, preconditioner = %.3lf ms, vector ops = %.3lf ms\n",
+           stats.spmv_time / it, stats.precond_time / it, stats.vector_time / it);
+    printf("total: %.3lf ms\n", stats.spmv_time + stats.precond_time + stats.vector_time);
+    check_x(x, x_ref, m);
+
+    krylov_system_destroy(&sys);
+    cudaFree(d_csrRowPtrA);
+    cudaFree(d_csrColIdxA);
+    cudaFree(d_csrValA);
+    cudaFree(d_b);
+    cudaFree(d_x);
+    free(x_ref);
+    free(b);
+    free(x);
+}
+
+// factor A (pattern of the input, off-diagonals -1 and a diagonal that makes it a
+// symmetric-dominant M-matrix) with ILU(0) or IC(0), then apply the factors
+// (on their own, or as the preconditioner of a Krylov solve of A)
+void run_factor(int *csrRowPtrA, int *csrColIdxA, int m, int nnzA, int lv, int adaptive, int factor, int krylov)
+{
+    // sorted rows with a diagonal entry in each; IC(0) needs a symmetric matrix, so for it
+    // the pattern is that of A + A^T
+    int *cscColPtrA = (int *)malloc((m + 1) * sizeof(int));
+    int *cscRowIdxA = (int *)malloc(nnzA * sizeof(int));
+    if (factor == FACTOR_IC0)
+        matrix_transposition_lite(m, m, nnzA, csrRowPtrA, csrColIdxA, cscRowIdxA, cscColPtrA);
+    int *seen = (int *)malloc(m * sizeof(int));
+    for (int i = 0; i < m; i++)
+        seen[i] = -1;
+    int *csrRowPtrF = (int *)malloc((m + 1) * sizeof(int));
+    int *csrColIdxF = (int *)malloc((m + 2 * nnzA) * sizeof(int));
+    VALUE_TYPE *csrValF = (VALUE_TYPE *)malloc((m + 2 * nnzA) * sizeof(VALUE_TYPE));
+    int *offdiag = (int *)malloc(m * sizeof(int));
+    memset(offdiag, 0, m * sizeof(int));
+    for (int i = 0; i < m; i++)
+        for (int j = csrRowPtrA[i]; j < csrRowPtrA[i+1]; j++)
+            if (csrColIdxA[j] != i)
+            {
+                offdiag[i]++;
+                offdiag[csrColIdxA[j]]++;
+            }
+    int nnzF = 0;
+    csrRowPtrF[0] = 0;
+    for (int i = 0; i < m; i++)
+    {
+        for (int j = csrRowPtrA[i]; j < csrRowPtrA[i+1]; j++)
+        {
+            if (csrColIdxA[j] != i && seen[csrColIdxA[j]] != i)
+            {
+                seen[csrColIdxA[j]] = i;
+                csrColIdxF[nnzF] = csrColIdxA[j];
+                csrValF[nnzF] = -1.0;
+                nnzF++;
+            }
+        }
+        if (factor == FACTOR_IC0)
+        {
+            for (int j = cscColPtrA[i]; j < cscColPtrA[i+1]; j++)
+            {
+                if (cscRowIdxA[j] != i && seen[cscRowIdxA[j]] != i)
+                {
+                    seen[cscRowIdxA[j]] = i;
+                    csrColIdxF[nnzF] = cscRowIdxA[j];
+                    csrValF[nnzF] = -1.0;
+                    nnzF++;
+                }
+            }
+        }
+        csrColIdxF[nnzF] = i;
+        csrValF[nnzF] = offdiag[i] + 1;
+        nnzF++;
+        csrRowPtrF[i+1] = nnzF;
+        quicksort_keyval<int, VALUE_TYPE>(csrColIdxF, csrValF, csrRowPtrF[i], nnzF - 1);
+    }
+    free(offdiag);
+    free(cscColPtrA);
+    free(cscRowIdxA);
+    free(seen);
+    VALUE_TYPE *csrValA = (VALUE_TYPE *)malloc(nnzF * sizeof(VALUE_TYPE));
+    memcpy(csrValA, csrValF, nnzF * sizeof(VALUE_TYPE));
+
+    int *d_csrRowPtrF;
+    int *d_csrColIdxF;
+    VALUE_TYPE *d_csrValF;
+    cudaMalloc((void **)&d_csrRowPtrF, (m + 1) * sizeof(int));
+    cudaMalloc((void **)&d_csrColIdxF, nnzF * sizeof(int));
+    cudaMalloc((void **)&d_csrValF, nnzF * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_csrRowPtrF, csrRowPtrF, (m + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_csrColIdxF, csrColIdxF, nnzF * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_csrValF, csrValF, nnzF * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);
+    RecBlockLUPlan plan;
+    recblocking_factor_plan_create(&plan, d_csrRowPtrF, d_csrColIdxF, d_csrValF, m, factor, lv, adaptive);
+    gettimeofday(&t2, NULL);
+    double preprocess_time = (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
+    cudaMemcpy(csrValF, d_csrValF, nnzF * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+
+    // the factors on the host, to build b and to check LU against A on A's pattern
+    int *csrRowPtrL = (int *)malloc((m + 1) * sizeof(int));
+    int *csrColIdxL = (int *)malloc((m + nnzF) * sizeof(int));
+    VALUE_TYPE *csrValL = (VALUE_TYPE *)malloc((m + nnzF) * sizeof(VALUE_TYPE));
+    int *csrRowPtrU = (int *)malloc((m + 1) * sizeof(int));
+    int *csrColIdxU = (int *)malloc(nnzF * sizeof(int));
+    VALUE_TYPE *csrValU = (VALUE_TYPE *)malloc(nnzF * sizeof(VALUE_TYPE));
+    int nnzL = 0;
+    int nnzU = 0;
+    csrRowPtrL[0] = 0;
+    csrRowPtrU[0] = 0;
+    for (int i = 0; i < m; i++)
+    {
+        for (int j = csrRowPtrF[i]; j < csrRowPtrF[i+1]; j++)
+        {
+            if (csrColIdxF[j] < i || (factor == FACTOR_IC0 && csrColIdxF[j] == i))
+            {
+                csrColIdxL[nnzL] = csrColIdxF[j];
+                csrValL[nnzL] = csrValF[j];
+                nnzL++;
+            }
+            else if (factor == FACTOR_ILU0)
+            {
+                csrColIdxU[nnzU] = csrColIdxF[j];
+                csrValU[nnzU] = csrValF[j];
+                nnzU++;
+            }
+        }
+        if (factor == FACTOR_ILU0)
+        {
+            csrColIdxL[nnzL] = i;
+            csrValL[nnzL] = 1.0;
+            nnzL++;
+        }
+        csrRowPtrL[i+1] = nnzL;
+        csrRowPtrU[i+1] = nnzU;
+    }
+    if (factor == FACTOR_IC0)
+    {
+        // U = L^T
+        nnzU = nnzL;
+        matrix_transposition(m, m, nnzL, csrRowPtrL, csrColIdxL, csrValL, csrColIdxU, csrRowPtrU, csrValU);
+    }
+
+    // (LU)(i,j) == a(i,j) on the pattern of A (the lower part of it for IC)
+    VALUE_TYPE *w = (VALUE_TYPE *)malloc(m * sizeof(VALUE_TYPE));
+    memset(w, 0, m * sizeof(VALUE_TYPE));
+    double res = 0.0;
+    for (int i = 0; i < m; i++)
+    {
+        for (int p = csrRowPtrL[i]; p < csrRowPtrL[i+1]; p++)
+        {
+            int k = csrColIdxL[p];
+            for (int q = csrRowPtrU[k]; q < csrRowPtrU[k+1]; q++)
+                w[csrColIdxU[q]] += csrValL[p] * csrValU[q];
+        }
+        for (int j = csrRowPtrF[i]; j < csrRowPtrF[i+1]; j++)
+            if (factor == FACTOR_ILU0 || csrColIdxF[j] <= i)
+                res = fmax(res, fabs(w[csrColIdxF[j]] - csrValA[j]) / fabs(csrValA[j]));
+        for (int p = csrRowPtrL[i]; p < csrRowPtrL[i+1]; p++)
+        {
+            int k = csrColIdxL[p];
+            for (int q = csrRowPtrU[k]; q < csrRowPtrU[k+1]; q++)
+                w[csrColIdxU[q]] = 0;
+        }
+    }
+    printf("%s: L nnz = %i, U nnz = %i, max |LU-A|/|A| on the pattern of A = %8.2e\n",
+           factor == FACTOR_IC0 ? "IC(0)" : "ILU(0)", nnzL, nnzU, res);
+
+    bench_lu_plan(&plan, csrRowPtrL, csrColIdxL, csrValL, nnzL, csrRowPtrU, csrColIdxU, csrValU, nnzU, m, preprocess_time);
+    if (krylov != KRYLOV_NONE)
+        run_krylov(&plan, csrRowPtrF, csrColIdxF, csrValA, m, nnzF, krylov);
+
+    recblocking_lu_plan_destroy(&plan);
+    cudaFree(d_csrRowPtrF);
+    cudaFree(d_csrColIdxF);
+    cudaFree(d_csrValF);
+    free(csrRowPtrF);
+    free(csrColIdxF);
+    free(csrValF);
+    free(csrValA);
+    free(csrRowPtrL);
+    free(csrColIdxL);
+    free(csrValL);
+    free(csrRowPtrU);
+    free(csrColIdxU);
+    free(csrValU);
+    free(w);
+}
+
+// solve with right-hand sides holding nnzb random nonzeros each, checked against a dense host substitution
+void run_sparse_rhs(int *cscColPtrTR, int *cscRowIdxTR, VALUE_TYPE *cscValTR,
+                    int *d_cscColPtrTR, int *d_cscRowIdxTR, VALUE_TYPE *d_cscValTR,
+                    int m, int substitution, int nnzb)
+{
+    SpTRSV_sparse_rhs s;
+    sptrsv_sparse_rhs_create(&s, cscColPtrTR, cscRowIdxTR, d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR, m, substitution);
+
+    int *b_idx = (int *)malloc(nnzb * sizeof(int));
+    VALUE_TYPE *b_val = (VALUE_TYPE *)malloc(nnzb * sizeof(VALUE_TYPE));
+    int *x_idx = (int *)malloc(m * sizeof(int));
+    VALUE_TYPE *x_val = (VALUE_TYPE *)malloc(m * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc(m * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x_ref = (VALUE_TYPE *)malloc(m * sizeof(VALUE_TYPE));
+
+    pick_distinct_rows(b_idx, nnzb, m);
+    for (int k = 0; k < nnzb; k++)
+        b_val[k] = rand() % 10 + 1;
+
+    int nlv = 0;
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);
+    int nnzx = 0;
+    for (int re = 0; re < BENCH_REPEAT; re++)
+        nnzx = sptrsv_sparse_rhs_solve(&s, nnzb, b_idx, b_val, x_idx, x_val, &nlv);
+    gettimeofday(&t2, NULL);
+    double sparse_time = ((t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0) / BENCH_REPEAT;
+
+    // reference: dense column substitution
+    memset(x_ref, 0, m * sizeof(VALUE_TYPE));
+    for (int k = 0; k < nnzb; k++)
+        x_ref[b_idx[k]] = b_val[k];
+    for (int kk = 0; kk < m; kk++)
+    {
+        int j = substitution == SUBSTITUTION_FORWARD ? kk : m - 1 - kk;
+        int dia = substitution == SUBSTITUTION_FORWARD ? cscColPtrTR[j] : cscColPtrTR[j + 1] - 1;
+        x_ref[j] /= cscValTR[dia];
+        for (int p = cscColPtrTR[j]; p < cscColPtrTR[j + 1]; p++)
+            if (p != dia)
+                x_ref[cscRowIdxTR[p]] -= cscValTR[p] * x_ref[j];
+    }
+    memset(x, 0, m * sizeof(VALUE_TYPE));
+    for (int k = 0; k < nnzx; k++)
+        x[x_idx[k]] = x_val[k];
+
+    printf("sparse rhs: nnz(b) = %i, reach = %i rows in %i levels, usetime = %.3lf ms\n", nnzb, nnzx, nlv, sparse_time);
+    check_x(x, x_ref, m);
+
+    sptrsv_sparse_rhs_destroy(&s);
+    free(b_idx);
+    free(b_val);
+    free(x_idx);
+    free(x_val);
+    free(x);
+    free(x_ref);
+}
+
+// change nnzd random entries of b after a solve and update x from the previous one,
+// checked against a full solve of the new b
+void run_update(int *cscColPtrTR, int *cscRowIdxTR,
+                int *d_cscColPtrTR, int *d_cscRowIdxTR, VALUE_TYPE *d_cscValTR,
+                int m, int n, int nnzTR, VALUE_TYPE *b, int substitution, int lv, int adaptive, int nnzd)
+{
+    RecBlockPlan plan;
+    recblocking_plan_create(&plan, d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR, m, n, nnzTR, substitution, lv, adaptive);
+    SpTRSV_sparse_rhs s;
+    sptrsv_sparse_rhs_create(&s, cscColPtrTR, cscRowIdxTR, d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR, m, substitution);
+
+    VALUE_TYPE *d_b;
+    VALUE_TYPE *d_x;
+    VALUE_TYPE *d_x_ref;
+    cudaMalloc((void **)&d_b, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x, n * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x_ref, n * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_b, b, m * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    recblocking_plan_solve(&plan, d_b, d_x);
+
+    int *idx = (int *)malloc(nnzd * sizeof(int));
+    VALUE_TYPE *delta = (VALUE_TYPE *)malloc(nnzd * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc(n * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x_ref = (VALUE_TYPE *)malloc(n * sizeof(VALUE_TYPE));
+
+    pick_distinct_rows(idx, nnzd, m);
+    for (int k = 0; k < nnzd; k++)
+        delta[k] = rand() % 10 + 1;
+
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);
+    int nreach = recblocking_plan_update(&plan, &s, nnzd, idx, delta, d_b, d_x);
+    gettimeofday(&t2, NULL);
+    double update_time = (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+    gettimeofday(&t1, NULL);
+    recblocking_plan_solve(&plan, d_b, d_x_ref);
+    gettimeofday(&t2, NULL);
+    double solve_time = (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+    if (nreach < 0)
+        printf("update: nnz(delta) = %i, reach over m/%i rows, full solve usetime = %.3lf ms\n", nnzd, INCREMENTAL_REACH_RATIO, update_time);
+    else
+        printf("update: nnz(delta) = %i, reach = %i rows, usetime = %.3lf ms (full solve %.3lf ms)\n", nnzd, nreach, update_time, solve_time);
+    cudaMemcpy(x, d_x, n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    cudaMemcpy(x_ref, d_x_ref, n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    check_x(x, x_ref, n);
+
+    sptrsv_sparse_rhs_destroy(&s);
+    recblocking_plan_destroy(&plan);
+    cudaFree(d_b);
+    cudaFree(d_x);
+    cudaFree(d_x_ref);
+    free(idx);
+    free(delta);
+    free(x);
+    free(x_ref);
+}
+
+// solve for ntarget random rows of x only, checked against the generated x_ref
+void run_partial(int *cscColPtrTR, int *cscRowIdxTR, VALUE_TYPE *cscValTR,
+                 int m, int n, int nnzTR, VALUE_TYPE *b, VALUE_TYPE *x_ref, int substitution, int ntarget)
+{
+    // the search pulls along rows, so transpose the CSC back to CSR
+    int *csrRowPtr = (int *)malloc((m + 1) * sizeof(int));
+    int *csrColIdx = (int *)malloc(nnzTR * sizeof(int));
+    VALUE_TYPE *csrVal = (VALUE_TYPE *)malloc(nnzTR * sizeof(VALUE_TYPE));
+    matrix_transposition(n, m, nnzTR,
+                         cscColPtrTR, cscRowIdxTR, cscValTR,
+                         csrColIdx, csrRowPtr, csrVal);
+
+    int *d_csrRowPtr;
+    int *d_csrColIdx;
+    VALUE_TYPE *d_csrVal;
+    VALUE_TYPE *d_b;
+    VALUE_TYPE *d_x;
+    cudaMalloc((void **)&d_csrRowPtr, (m + 1) * sizeof(int));
+    cudaMalloc((void **)&d_csrColIdx, nnzTR * sizeof(int));
+    cudaMalloc((void **)&d_csrVal, nnzTR * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_b, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x, n * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_csrRowPtr, csrRowPtr, (m + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_csrColIdx, csrColIdx, nnzTR * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_csrVal, csrVal, nnzTR * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_b, b, m * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    cudaMemset(d_x, 0, n * sizeof(VALUE_TYPE));
+
+    SpTRSV_partial p;
+    sptrsv_partial_create(&p, csrRowPtr, csrColIdx, d_csrRowPtr, d_csrColIdx, d_csrVal, m, substitution);
+
+    int *target = (int *)malloc(ntarget * sizeof(int));
+    pick_distinct_rows(target, ntarget, m);
+
+    int nlv = 0;
+    int nanc = 0;
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);
+    for (int re = 0; re < BENCH_REPEAT; re++)
+        nanc = sptrsv_partial_solve(&p, ntarget, target, d_b, d_x, &nlv);
+    gettimeofday(&t2, NULL);
+    double partial_time = ((t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0) / BENCH_REPEAT;
+
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc(n * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x_val = (VALUE_TYPE *)malloc(ntarget * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x_ref_val = (VALUE_TYPE *)malloc(ntarget * sizeof(VALUE_TYPE));
+    cudaMemcpy(x, d_x, n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    for (int k = 0; k < ntarget; k++)
+    {
+        x_val[k] = x[target[k]];
+        x_ref_val[k] = x_ref[target[k]];
+    }
+
+    printf("partial: %i target rows, %i ancestor rows in %i levels, usetime = %.3lf ms\n", ntarget, nanc, nlv, partial_time);
+    check_x(x_val, x_ref_val, ntarget);
+
+    sptrsv_partial_destroy(&p);
+    cudaFree(d_csrRowPtr);
+    cudaFree(d_csrColIdx);
+    cudaFree(d_csrVal);
+    cudaFree(d_b);
+    cudaFree(d_x);
+    free(csrRowPtr);
+    free(csrColIdx);
+    free(csrVal);
+    free(target);
+    free(x);
+    free(x_val);
+    free(x_ref_val);
+}
+
+// solve T^T x = b with the plan of T, b built from x_ref through the columns of T
+void run_transpose(int *cscColPtrTR, int *cscRowIdxTR, VALUE_TYPE *cscValTR,
+                   int *d_cscColPtrTR, int *d_cscRowIdxTR, VALUE_TYPE *d_cscValTR,
+                   int m, int n, int nnzTR, VALUE_TYPE *x_ref, int substitution, int lv, int adaptive)
+{
+    RecBlockPlan plan;
+    recblocking_plan_create(&plan, d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR, m, n, nnzTR, substitution, lv, adaptive);
+
+    VALUE_TYPE *b = (VALUE_TYPE *)malloc(n * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc(m * sizeof(VALUE_TYPE));
+    for (int j = 0; j < n; j++)
+    {
+        b[j] = 0;
+        for (int p = cscColPtrTR[j]; p < cscColPtrTR[j + 1]; p++)
+            b[j] += cscValTR[p] * x_ref[cscRowIdxTR[p]];
+    }
+
+    VALUE_TYPE *d_b;
+    VALUE_TYPE *d_x;
+    cudaMalloc((void **)&d_b, n * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x, m * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_b, b, n * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+
+    struct timeval t1, t2;
+    recblocking_plan_solve_transposed(&plan, d_b, d_x);
+    gettimeofday(&t1, NULL);
+    for (int re = 0; re < BENCH_REPEAT; re++)
+        recblocking_plan_solve_transposed(&plan, d_b, d_x);
+    gettimeofday(&t2, NULL);
+    double trans_time = ((t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0) / BENCH_REPEAT;
+
+    cudaMemcpy(x, d_x, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    printf("transposed solve usetime = %.3lf ms\n", trans_time);
+    check_x(x, x_ref, m);
+
+    recblocking_plan_destroy(&plan);
+    cudaFree(d_b);
+    cudaFree(d_x);
+    free(b);
+    free(x);
+}
+
+// solve through the permuted and in-place entry points of one plan, both checked
+// against recblocking_plan_solve of the same b
+void run_inplace(int *d_cscColPtrTR, int *d_cscRowIdxTR, VALUE_TYPE *d_cscValTR,
+                 int m, int n, int nnzTR, VALUE_TYPE *b, int substitution, int lv, int adaptive)
+{
+    RecBlockPlan plan;
+    recblocking_plan_create(&plan, d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR, m, n, nnzTR, substitution, lv, adaptive);
+
+    VALUE_TYPE *d_b;
+    VALUE_TYPE *d_x;
+    VALUE_TYPE *d_x_ref;
+    VALUE_TYPE *d_b_perm;
+    VALUE_TYPE *d_x_perm;
+    cudaMalloc((void **)&d_b, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x, n * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x_ref, n * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_b_perm, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x_perm, n * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_b, b, m * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    recblocking_plan_solve(&plan, d_b, d_x_ref);
+
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc(n * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x_ref = (VALUE_TYPE *)malloc(n * sizeof(VALUE_TYPE));
+    cudaMemcpy(x_ref, d_x_ref, n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+
+    recblocking_plan_permute(&plan, d_b, d_b_perm);
+    recblocking_plan_solve_permuted(&plan, d_b_perm, d_x_perm);
+    recblocking_plan_unpermute(&plan, d_x_perm, d_x);
+    cudaStreamSynchronize(plan.stream);
+    cudaMemcpy(x, d_x, n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    printf("permuted solve:\n");
+    check_x(x, x_ref, n);
+
+    struct timeval t1, t2;
+    double inplace_time = 0;
+    for (int re = 0; re < BENCH_REPEAT; re++)
+    {
+        recblocking_plan_permute(&plan, d_b, d_b_perm);
+        cudaStreamSynchronize(plan.stream);
+        gettimeofday(&t1, NULL);
+        recblocking_plan_solve_inplace(&plan, d_b_perm);
+        cudaStreamSynchronize(plan.stream);
+        gettimeofday(&t2, NULL);
+        inplace_time += (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
+    }
+    recblocking_plan_unpermute(&plan, d_b_perm, d_x);
+    cudaStreamSynchronize(plan.stream);
+    cudaMemcpy(x, d_x, n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    printf("in-place solve (x aliases b: %i) usetime = %.3lf ms\n", plan.inplace, inplace_time / BENCH_REPEAT);
+    check_x(x, x_ref, n);
+
+    recblocking_plan_destroy(&plan);
+    cudaFree(d_b);
+    cudaFree(d_x);
+    cudaFree(d_x_ref);
+    cudaFree(d_b_perm);
+    cudaFree(d_x_perm);
+    free(x);
+    free(x_ref);
+}
+
+// cut the triangle into nsys diagonal blocks and solve them as one batch of
+// independent systems, each checked against x_ref restricted to it
+void run_batch(int *cscColPtrTR, int *cscRowIdxTR, VALUE_TYPE *cscValTR,
+               int m, VALUE_TYPE *x_ref, int substitution, int nsys)
+{
+    int **colPtr = (int **)malloc(nsys * sizeof(int *));
+    int **rowIdx = (int **)malloc(nsys * sizeof(int *));
+    VALUE_TYPE **val = (VALUE_TYPE **)malloc(nsys * sizeof(VALUE_TYPE *));
+    int *ms = (int *)malloc(nsys * sizeof(int));
+    VALUE_TYPE *b = (VALUE_TYPE *)malloc(m * sizeof(VALUE_TYPE));
+    memset(b, 0, m * sizeof(VALUE_TYPE));
+
+    for (int s = 0; s < nsys; s++)
+    {
+        int r0 = (int)((long long)m * s / nsys);
+        int r1 = (int)((long long)m * (s + 1) / nsys);
+        ms[s] = r1 - r0;
+        int nnz = 0;
+        for (int j = r0; j < r1; j++)
+            for (int p = cscColPtrTR[j]; p < cscColPtrTR[j + 1]; p++)
+                if (cscRowIdxTR[p] >= r0 && cscRowIdxTR[p] < r1)
+                    nnz++;
+        colPtr[s] = (int *)malloc((ms[s] + 1) * sizeof(int));
+        rowIdx[s] = (int *)malloc(nnz * sizeof(int));
+        val[s] = (VALUE_TYPE *)malloc(nnz * sizeof(VALUE_TYPE));
+        nnz = 0;
+        colPtr[s][0] = 0;
+        for (int j = r0; j < r1; j++)
+        {
+            for (int p = cscColPtrTR[j]; p < cscColPtrTR[j + 1]; p++)
+            {
+                int i = cscRowIdxTR[p];
+                if (i >= r0 && i < r1)
+                {
+                    rowIdx[s][nnz] = i - r0;
+                    val[s][nnz] = cscValTR[p];
+                    b[i] += cscValTR[p] * x_ref[j];
+                    nnz++;
+                }
+            }
+            colPtr[s][j - r0 + 1] = nnz;
+        }
+    }
+
+    struct timeval t1, t2;
+    gettimeofday(&t1, NULL);
+    SpTRSV_batch batch;
+    sptrsv_batch_create(&batch, nsys, colPtr, rowIdx, val, ms, substitution);
+    gettimeofday(&t2, NULL);
+    double batch_preprocess_time = (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
+
+    VALUE_TYPE *d_b;
+    VALUE_TYPE *d_x;
+    cudaMalloc((void **)&d_b, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x, m * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_b, b, m * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+
+    sptrsv_batch_solve(&batch, d_b, d_x, 0);
+    cudaDeviceSynchronize();
+    gettimeofday(&t1, NULL);
+    for (int re = 0; re < BENCH_REPEAT; re++)
+        sptrsv_batch_solve(&batch, d_b, d_x, 0);
+    cudaDeviceSynchronize();
+    gettimeofday(&t2, NULL);
+    double batch_time = ((t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0) / BENCH_REPEAT;
+
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc(m * sizeof(VALUE_TYPE));
+    cudaMemcpy(x, d_x, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    printf("batch: %i systems, %i levels in all, preprocess = %.3lf ms, usetime = %.3lf ms\n",
+           nsys, batch.nlv_total, batch_preprocess_time, batch_time);
+    check_x(x, x_ref, m);
+
+    sptrsv_batch_destroy(&batch);
+    for (int s = 0; s < nsys; s++)
+    {
+        free(colPtr[s]);
+        free(rowIdx[s]);
+        free(val[s]);
+    }
+    free(colPtr);
+    free(rowIdx);
+    free(val);
+    free(ms);
+    free(b);
+    free(x);
+    cudaFree(d_b);
+    cudaFree(d_x);
+}
+
+// solve nbatch systems with the pattern of the triangle and their own values in
+// lockstep; system k scales the off-diagonals by a factor of its own and every b_k
+// is built from x_ref, so all of them have x_ref as the solution
+void run_lockstep(int *cscColPtrTR, int *cscRowIdxTR, VALUE_TYPE *cscValTR,
+                  int m, int nnzTR, VALUE_TYPE *x_ref, int substitution, int nbatch)
+{
+    VALUE_TYPE *val = (VALUE_TYPE *)malloc((size_t)nnzTR * nbatch * sizeof(VALUE_TYPE));
+    VALUE_TYPE *b = (VALUE_TYPE *)malloc((size_t)m * nbatch * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x = (VALUE_TYPE *)malloc((size_t)m * nbatch * sizeof(VALUE_TYPE));
+    VALUE_TYPE *x_ref_batch = (VALUE_TYPE *)malloc((size_t)m * nbatch * sizeof(VALUE_TYPE));
+    memset(b, 0, (size_t)m * nbatch * sizeof(VALUE_TYPE));
+    for (int k = 0; k < nbatch; k++)
+    {
+        VALUE_TYPE scale = (VALUE_TYPE)(k % 8 + 1) / 8;
+        for (int j = 0; j < m; j++)
+        {
+            for (int p = cscColPtrTR[j]; p < cscColPtrTR[j + 1]; p++)
+            {
+                int i = cscRowIdxTR[p];
+                VALUE_TYPE v = i == j ? cscValTR[p] : cscValTR[p] * scale;
+                val[(size_t)p * nbatch + k] = v;
+                b[(size_t)i * nbatch + k] += v * x_ref[j];
+            }
+        }
+        for (int i = 0; i < m; i++)
+            x_ref_batch[(size_t)i * nbatch + k] = x_ref[i];
+    }
+
+    SpTRSV_lockstep ls;
+    sptrsv_lockstep_create(&ls, cscColPtrTR, cscRowIdxTR, m, nbatch, substitution);
+
+    VALUE_TYPE *d_val;
+    VALUE_TYPE *d_b;
+    VALUE_TYPE *d_x;
+    cudaMalloc((void **)&d_val, (size_t)nnzTR * nbatch * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_b, (size_t)m * nbatch * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&d_x, (size_t)m * nbatch * sizeof(VALUE_TYPE));
+    cudaMemcpy(d_val, val, (size_t)nnzTR * nbatch * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    cudaMemcpy(d_b, b, (size_t)m * nbatch * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    sptrsv_lockstep_set_values(&ls, d_val);
+
+    struct timeval t1, t2;
+    sptrsv_lockstep_solve(&ls, d_b, d_x, 0);
+    cudaDeviceSynchronize();
+    gettimeofday(&t1, NULL);
+    for (int re = 0; re < BENCH_REPEAT; re++)
+        sptrsv_lockstep_solve(&ls, d_b, d_x, 0);
+    cudaDeviceSynchronize();
+    gettimeofday(&t2, NULL);
+    double lockstep_time = ((t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0) / BENCH_REPEAT;
+
+    cudaMemcpy(x, d_x, (size_t)m * nbatch * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    printf("lockstep: %i systems, %i levels, usetime = %.3lf ms (%.3lf ms per system)\n",
+           nbatch, ls.nlv, lockstep_time, lockstep_time / nbatch);
+    check_x(x, x_ref_batch, m * nbatch);
+
+    sptrsv_lockstep_destroy(&ls);
+    cudaFree(d_val);
+    cudaFree(d_b);
+    cudaFree(d_x);
+    free(val);
+    free(b);
+    free(x);
+    free(x_ref_batch);
+}
+
+// "Usage: ``./sptrsv-double -d 0 -rhs 1 -lv -1 -forward/-backward -mtx A.mtx [-adaptive] [-pin node/compact] [-lu] [-factor ilu0/ic0] [-krylov pcg/bicgstab/gmres] [-sparse_rhs k] [-update k] [-partial k] [-transpose] [-inplace] [-batch k] [-lockstep k]'' for Ax=b on device 0"
+// "-adaptive" treats lv as the maximum depth and only splits triangles with poor parallelism
+// "-lu" solves LUx=b with L and U both taken from A (the -forward/-backward choice is ignored)
+// "-factor ilu0/ic0" computes the incomplete factors of A on the device and applies them like -lu
+// "-sparse_rhs k" also solves with a b of k nonzeros, touching only the rows they reach
+// "-update k" also changes k entries of b and updates x instead of solving again
+// "-partial k" also solves for k rows of x only, touching just the rows they depend on
+// "-transpose" also solves with the transpose of the triangle, through the same plan
+// "-inplace" also solves in level-set order, once into a separate x and once overwriting b
+// "-batch k" also solves the k diagonal blocks of the triangle as one batch of independent systems
+// "-lockstep k" also solves k systems with the pattern of the triangle and values of their own in lockstep
+// "-krylov pcg/bicgstab/gmres" then also solves with A preconditioned by them (ic0 for pcg, ilu0 otherwise by default)
+// "-pin node/compact" binds the host thread to the NUMA node of the device (or to one cpu of it)
 int main(int argc,  char ** argv)
 {
     // report precision of floating-point
@@ -131,6 +1021,86 @@ int main(int argc,  char ** argv)
     }
     printf("-------------- %s --------------\n", filename);
 
+    // load optional flags
+    int adaptive = 0;
+    int pin = PIN_NONE;
+    int lu = 0;
+    int factor = FACTOR_NONE;
+    int krylov = KRYLOV_NONE;
+    int sparse_rhs = 0;
+    int update = 0;
+    int partial = 0;
+    int transpose = 0;
+    int inplace = 0;
+    int batch = 0;
+    int lockstep = 0;
+    while (argc > argi)
+    {
+        if (strcmp(argv[argi], "-adaptive") == 0)
+            adaptive = 1;
+        else if (strcmp(argv[argi], "-lu") == 0)
+            lu = 1;
+        else if (strcmp(argv[argi], "-transpose") == 0)
+            transpose = 1;
+        else if (strcmp(argv[argi], "-inplace") == 0)
+            inplace = 1;
+        else if (strcmp(argv[argi], "-sparse_rhs") == 0 && argc > argi + 1)
+            sparse_rhs = atoi(argv[++argi]);
+        else if (strcmp(argv[argi], "-update") == 0 && argc > argi + 1)
+            update = atoi(argv[++argi]);
+        else if (strcmp(argv[argi], "-partial") == 0 && argc > argi + 1)
+            partial = atoi(argv[++argi]);
+        else if (strcmp(argv[argi], "-batch") == 0 && argc > argi + 1)
+            batch = atoi(argv[++argi]);
+        else if (strcmp(argv[argi], "-lockstep") == 0 && argc > argi + 1)
+            lockstep = atoi(argv[++argi]);
+        else if (strcmp(argv[argi], "-krylov") == 0 && argc > argi + 1)
+        {
+            argi++;
+            if (strcmp(argv[argi], "pcg") == 0)
+                krylov = KRYLOV_PCG;
+            else if (strcmp(argv[argi], "bicgstab") == 0)
+                krylov = KRYLOV_BICGSTAB;
+            else if (strcmp(argv[argi], "gmres") == 0)
+                krylov = KRYLOV_GMRES;
+        }
+        else if (strcmp(argv[argi], "-factor") == 0 && argc > argi + 1)
+        {
+            argi++;
+            if (strcmp(argv[argi], "ilu0") == 0)
+                factor = FACTOR_ILU0;
+            else if (strcmp(argv[argi], "ic0") == 0)
+                factor = FACTOR_IC0;
+        }
+        else if (strcmp(argv[argi], "-pin") == 0 && argc > argi + 1)
+        {
+            argi++;
+            if (strcmp(argv[argi], "node") == 0)
+                pin = PIN_NODE;
+            else if (strcmp(argv[argi], "compact") == 0)
+                pin = PIN_COMPACT;
+        }
+        argi++;
+    }
+    printf("adaptive = %i\n", adaptive);
+    printf("pin = %i\n", pin);
+    printf("lu = %i\n", lu);
+    if (krylov != KRYLOV_NONE && factor == FACTOR_NONE)
+        factor = krylov == KRYLOV_PCG ? FACTOR_IC0 : FACTOR_ILU0;
+    printf("factor = %i\n", factor);
+    printf("krylov = %i\n", krylov);
+    printf("sparse_rhs = %i\n", sparse_rhs);
+    printf("update = %i\n", update);
+    printf("partial = %i\n", partial);
+    printf("transpose = %i\n", transpose);
+    printf("inplace = %i\n", inplace);
+    printf("batch = %i\n", batch);
+    printf("lockstep = %i\n", lockstep);
+
+    // place the host thread, and so the pages it first-touches, next to the device
+    cudaSetDevice(device_id);
+    pin_host_to_device(device_id, pin);
+
     srand(time(NULL));
 
     // load mtx data to the csr format
@@ -147,6 +1117,35 @@ int main(int argc,  char ** argv)
         return 0;
     }
 
+    if (lv == -1)
+    {
+        int li = 1;
+        for (li = 1; li <= 100; li++)
+        {
+            if (m / pow(2, (li+1)) < (device_id == 0 ? 92160 : 58880)) // 92160 (4608x20) is titan rtx, 58880 (2944x20) is rtx 2080
+                break;
+        }
+        lv = li;
+    }
+
+    if (factor != FACTOR_NONE)
+    {
+        run_factor(csrRowPtrA, csrColIdxA, m, nnzA, lv, adaptive, factor, krylov);
+        free(csrColIdxA);
+        free(csrValA);
+        free(csrRowPtrA);
+        return 0;
+    }
+
+    if (lu)
+    {
+        run_lu(csrRowPtrA, csrColIdxA, m, nnzA, lv, adaptive);
+        free(csrColIdxA);
+        free(csrValA);
+        free(csrRowPtrA);
+        return 0;
+    }
+
     // extract L and U with a unit diagonal of A
     csrRowPtrTR = (int *)malloc((m+1) * sizeof(int));
     csrColIdxTR = (int *)malloc((m+nnzA) * sizeof(int));
@@ -242,16 +1241,6 @@ int main(int argc,  char ** argv)
     free(csrColIdxTR);
     free(csrValTR);
         
-    if (lv == -1)
-    {
-        int li = 1;
-        for (li = 1; li <= 100; li++)
-        {
-            if (m / pow(2, (li+1)) < (device_id == 0 ? 92160 : 58880)) // 92160 (4608x20) is titan rtx, 58880 (2944x20) is rtx 2080
-                break;
-        }
-        lv = li;
-    }
     
     int *d_cscColPtrTR;
     int *d_cscRowIdxTR;
@@ -276,12 +1265,31 @@ int main(int argc,  char ** argv)
     double cal_time = 0;
     double preprocess_time = 0;
     recblocking_solver_cuda(d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR,
-                            m, n, nnzTR, d_x, d_b, substitution, lv, &cal_time, &preprocess_time);
+                            m, n, nnzTR, d_x, d_b, substitution, lv, adaptive, &cal_time, &preprocess_time);
     cudaMemcpy(x, d_x, sizeof(VALUE_TYPE) * m, cudaMemcpyDeviceToHost);
     
     printf("computation usetime = %.3lf ms\n", cal_time);
     printf("Performance = %.3lf gflops\n", (2 * nnzTR) / (cal_time * 1e6));
 
+    if (sparse_rhs > 0)
+        run_sparse_rhs(cscColPtrTR, cscRowIdxTR, cscValTR, d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR,
+                       m, substitution, sparse_rhs < m ? sparse_rhs : m);
+    if (update > 0)
+        run_update(cscColPtrTR, cscRowIdxTR, d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR,
+                   m, n, nnzTR, b, substitution, lv, adaptive, update < m ? update : m);
+    if (partial > 0)
+        run_partial(cscColPtrTR, cscRowIdxTR, cscValTR, m, n, nnzTR, b, x_ref,
+                    substitution, partial < m ? partial : m);
+    if (transpose)
+        run_transpose(cscColPtrTR, cscRowIdxTR, cscValTR, d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR,
+                      m, n, nnzTR, x_ref, substitution, lv, adaptive);
+    if (inplace)
+        run_inplace(d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR, m, n, nnzTR, b, substitution, lv, adaptive);
+    if (batch > 0)
+        run_batch(cscColPtrTR, cscRowIdxTR, cscValTR, m, x_ref, substitution, batch < m ? batch : m);
+    if (lockstep > 0)
+        run_lockstep(cscColPtrTR, cscRowIdxTR, cscValTR, m, nnzTR, x_ref, substitution, lockstep);
+
     cudaFree(d_cscColPtrTR);
     cudaFree(d_cscRowIdxTR);
     cudaFree(d_cscValTR);
@@ -294,27 +1302,7 @@ int main(int argc,  char ** argv)
     
     
     // validate x
-    int flag = 0;
-    double accuracy = 1e-4;
-    double ref = 0.0;
-    double res = 0.0;
-
-    for (int i = 0; i < n * rhs ; i++)
-    {
-        ref += abs(x_ref[i]);
-        res += abs(x[i] - x_ref[i]);
-    }
-    printf("\n");
-
-    res = ref == 0 ? res : res / ref;
-    
-    if (res < accuracy && (res >= 0))
-    {
-        printf("x check passed! |x-xref|/|xref| = %8.2e\n", res);
-        flag = 1;
-    }
-    else
-        printf(" x check _NOT_ passed! |x-xref|/|xref| = %8.2e\n", res);
+    check_x(x, x_ref, n * rhs);
 
     free(x);
     free(x_ref);
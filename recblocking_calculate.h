@@ -12,6 +12,162 @@
 #include "utils_reordering.h"
 #include <cuda_runtime.h>
 
+// enqueue the whole block schedule on one stream; blocks are ordered by the stream,
+// so no host synchronisation is needed between them. Block i starts at index_offset[i]
+// in d_recblock_Index and at val_offset[i] in d_recblock_Val
+void L_schedule(SpMV_block *mv_blk,
+                SpTRSV_block *trsv_blk,
+                int sum_block,
+                int *blk_m,
+                int *blk_n,
+                int *loc_off,
+                int *tmp_off,
+                int m,
+                VALUE_TYPE *x_t,
+                VALUE_TYPE *b_t,
+                const int *d_recblock_Ptr,
+                const int *d_recblock_Index,
+                const int *d_recblock_dcsr_rowidx,
+                const double *d_recblock_Val,
+                int *ptr_offset,
+                int *index_offset,
+                int *val_offset,
+                int *dcsrindex_offset,
+                cudaStream_t stream)
+{
+    int b_offset = 0;
+    int x_offset = 0;
+    int tri_index = 0;
+    int squ_index = 0;
+    for (int i = 0; i < sum_block; i++)
+    {
+        if (i % 2 == 0)
+        {
+            if (trsv_blk[tri_index].d_inv_ptr != NULL)
+            {
+                const VALUE_TYPE *b_inv = &b_t[b_offset];
+                if (b_inv == &x_t[x_offset])
+                {
+                    cudaMemcpyAsync(trsv_blk[tri_index].d_inv_b, b_inv, trsv_blk[tri_index].m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice, stream);
+                    b_inv = trsv_blk[tri_index].d_inv_b;
+                }
+                int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                int num_blocks = ceil((double)trsv_blk[tri_index].m / (double)WARP_PER_BLOCK);
+                spmv_warpvec_csr_cuda_executor<<<num_blocks, num_threads, 0, stream>>>(trsv_blk[tri_index].d_inv_ptr, trsv_blk[tri_index].d_inv_idx, trsv_blk[tri_index].d_inv_val,
+                                                                                       trsv_blk[tri_index].m, b_inv, &x_t[x_offset]);
+            }
+            else if (trsv_blk[tri_index].d_dense != NULL)
+            {
+                sptrsv_dense_cuda_executor<<<1, DENSE_TRSV_THREADS, 0, stream>>>(trsv_blk[tri_index].d_dense, trsv_blk[tri_index].m, trsv_blk[tri_index].substitution,
+                                                                                 &b_t[b_offset], &x_t[x_offset]);
+            }
+            else if (trsv_blk[tri_index].super != NULL)
+            {
+                sptrsv_supernodal_solve(trsv_blk[tri_index].super, &b_t[b_offset], &x_t[x_offset], stream);
+            }
+            else if (trsv_blk[tri_index].method == 0)
+            {
+                sptrsv_syncfree_csc_cuda_executor_fasttrack<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                            trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+            }
+            else if (trsv_blk[tri_index].method == 1)
+            {
+                cusparseSetStream(trsv_blk[tri_index].handle, stream);
+                if (sizeof(VALUE_TYPE) == 8)
+                    cusparseDcsrsv2_solve(trsv_blk[tri_index].handle, trsv_blk[tri_index].trans, trsv_blk[tri_index].m, trsv_blk[tri_index].nnzTR, &(trsv_blk[tri_index].alpha_double), trsv_blk[tri_index].descr,
+                                          (double *)(&d_recblock_Val[val_offset[i]]), &d_recblock_Ptr[ptr_offset[i]], &d_recblock_Index[index_offset[i]], trsv_blk[tri_index].info,
+                                          (double *)&(b_t[b_offset]), (double *)&(x_t[x_offset]), trsv_blk[tri_index].policy, trsv_blk[tri_index].pBuffer);
+                else if (sizeof(VALUE_TYPE) == 4)
+                    cusparseScsrsv2_solve(trsv_blk[tri_index].handle, trsv_blk[tri_index].trans, trsv_blk[tri_index].m, trsv_blk[tri_index].nnzTR, &(trsv_blk[tri_index].alpha_float), trsv_blk[tri_index].descr,
+                                          (float *)(&d_recblock_Val[val_offset[i]]), &d_recblock_Ptr[ptr_offset[i]], &d_recblock_Index[index_offset[i]], trsv_blk[tri_index].info,
+                                          (float *)&(b_t[b_offset]), (float *)&(x_t[x_offset]), trsv_blk[tri_index].policy, trsv_blk[tri_index].pBuffer);
+            }
+            else if (trsv_blk[tri_index].method == 2)
+            {
+                for (int li = 0; li < trsv_blk[tri_index].nlv; li++)
+                {
+                    if (trsv_blk[tri_index].serial_lv_array[li] == LEVEL_TASK_CHAIN)
+                    {
+                        sptrsv_levelset_chain_csr_cuda_executor<<<1, 1, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                     trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                    }
+                    else if (trsv_blk[tri_index].serial_lv_array[li] == LEVEL_TASK_SERIAL)
+                    {
+                        sptrsv_levelset_serial_csr_cuda_executor<<<1, WARP_SIZE, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                              trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                    }
+                    else if (li == 0)
+                    {
+                        trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                        trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)(trsv_blk[tri_index].num_threads));
+                        sptrsv_levelset_threadsca_csr_cuda_executor_fasttrack<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                                              trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                    }
+                    else
+                    {
+                        if ((trsv_blk[tri_index].nnz_lv_array[li] / trsv_blk[tri_index].m_lv_array[li]) <= 15)
+                        {
+                            trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                            trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)(trsv_blk[tri_index].num_threads));
+                            sptrsv_levelset_threadsca_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                                        trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                        }
+                        else
+                        {
+                            trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                            trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)((trsv_blk[tri_index].num_threads) / WARP_SIZE));
+                            sptrsv_levelset_warpvec_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                                      trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                        }
+                    }
+                }
+            }
+            else if (trsv_blk[tri_index].method == 4)
+            {
+                sptrsv_p2p_threadsca_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                       trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset],
+                                                                                                                                       trsv_blk[tri_index].nchunks, trsv_blk[tri_index].d_chunk_ptr, trsv_blk[tri_index].d_dep_ptr, trsv_blk[tri_index].d_dep_idx,
+                                                                                                                                       trsv_blk[tri_index].d_chunk_done, trsv_blk[tri_index].d_ticket);
+            }
+            else if (trsv_blk[tri_index].method == 3)
+            {
+                // the sync-free counters are consumed by every solve, so rebuild them in the schedule
+                cudaMemsetAsync(trsv_blk[tri_index].d_graphInDegree, 0, trsv_blk[tri_index].m * sizeof(int), stream);
+                sptrsv_syncfree_csc_cuda_analyser<<<ceil((double)trsv_blk[tri_index].nnzTR / 128.0), 128, 0, stream>>>(&d_recblock_Index[index_offset[i]], trsv_blk[tri_index].m,
+                                                                                                                  trsv_blk[tri_index].nnzTR, trsv_blk[tri_index].d_graphInDegree);
+                cudaMemsetAsync(trsv_blk[tri_index].d_left_sum, 0, trsv_blk[tri_index].m * sizeof(VALUE_TYPE), stream);
+                cudaMemsetAsync(trsv_blk[tri_index].d_id_extractor, 0, sizeof(int), stream);
+                sptrsv_syncfree_warpvec_csc_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                          trsv_blk[tri_index].d_graphInDegree, trsv_blk[tri_index].d_left_sum,
+                                                                                                                                          trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset], trsv_blk[tri_index].d_while_profiler,
+                                                                                                                                          trsv_blk[tri_index].d_id_extractor, trsv_blk[tri_index].d_levelItem);
+            }
+            tri_index++;
+            b_offset += blk_m[i];
+            x_offset += blk_n[i];
+        }
+        else
+        {
+            SpMV_block *blk = &(mv_blk[squ_index]);
+            if (blk->method != -1)
+            {
+                const int *ptr = &d_recblock_Ptr[ptr_offset[i] - 1];
+                const VALUE_TYPE *val = &d_recblock_Val[val_offset[i]];
+                const int *row_perm = &d_recblock_dcsr_rowidx[dcsrindex_offset[i]];
+                spmv_block_cuda_executor_compact(blk, ptr, &d_recblock_Index[index_offset[i]], val, &x_t[loc_off[i]], row_perm, stream);
+                if (blk->longrow != 0)
+                    spmv_longrow_csr_cuda_executor<<<blk->num_blocks_l, blk->num_threads_l, 0, stream>>>(blk->d_csrRowPtr_l, blk->d_csrColIdx_l, blk->d_csrVal_l,
+                                                                                                         &x_t[loc_off[i]], blk->d_y, blk->longrow, blk->d_longrow_idx);
+
+                int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
+                subKernel<<<num_blocks, num_threads, 0, stream>>>(&(b_t[tmp_off[i]]), blk->d_y, blk_m[i]);
+            }
+            squ_index++;
+        }
+    }
+}
+
 void L_calculate(SpMV_block *mv_blk,
                  SpTRSV_block *trsv_blk,
                  int sum_block,
@@ -30,141 +186,198 @@ void L_calculate(SpMV_block *mv_blk,
                  const double *d_recblock_Val,
                  int *ptr_offset,
                  int *index_offset,
+                 int *val_offset,
                  int *dcsrindex_offset,
                  double *cal_time)
 {
     struct timeval t1, t2;
+    cudaStream_t stream;
+    cudaStreamCreate(&stream);
+#if USE_CUDA_GRAPH
+    // capture the schedule once, then each solve is a single graph launch
+    cudaGraph_t graph;
+    cudaGraphExec_t graph_exec;
+    cudaStreamBeginCapture(stream, cudaStreamCaptureModeGlobal);
+    L_schedule(mv_blk, trsv_blk, sum_block, blk_m, blk_n, loc_off, tmp_off, m, x_t, b_t,
+               d_recblock_Ptr, d_recblock_Index, d_recblock_dcsr_rowidx, d_recblock_Val, ptr_offset, index_offset, val_offset, dcsrindex_offset, stream);
+    cudaStreamEndCapture(stream, &graph);
+    cudaGraphInstantiate(&graph_exec, graph, NULL, NULL, 0);
+#endif
     for (int re = 0; re < BENCH_REPEAT; re++)
     {
         cudaMemcpy(b_t, b_perm, rhs * m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
 
-        int b_offset = 0;
-        int x_offset = 0;
-        int tri_index = 0;
-        int squ_index = 0;
         gettimeofday(&t1, NULL);
-        for (int i = 0; i < sum_block; i++)
+#if USE_CUDA_GRAPH
+        cudaGraphLaunch(graph_exec, stream);
+#else
+        L_schedule(mv_blk, trsv_blk, sum_block, blk_m, blk_n, loc_off, tmp_off, m, x_t, b_t,
+                   d_recblock_Ptr, d_recblock_Index, d_recblock_dcsr_rowidx, d_recblock_Val, ptr_offset, index_offset, val_offset, dcsrindex_offset, stream);
+#endif
+        cudaStreamSynchronize(stream);
+        gettimeofday(&t2, NULL);
+        *cal_time += (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
+    }
+    *cal_time /= BENCH_REPEAT;
+#if USE_CUDA_GRAPH
+    cudaGraphExecDestroy(graph_exec);
+    cudaGraphDestroy(graph);
+#endif
+    cudaStreamDestroy(stream);
+}
+
+void U_schedule(SpMV_block *mv_blk,
+                SpTRSV_block *trsv_blk,
+                int sum_block,
+                int *blk_m,
+                int *blk_n,
+                int *loc_off,
+                int *tmp_off,
+                int m,
+                VALUE_TYPE *x_t,
+                VALUE_TYPE *b_t,
+                const int *d_recblock_Ptr,
+                const int *d_recblock_Index,
+                const int *d_recblock_dcsr_rowidx,
+                const double *d_recblock_Val,
+                int *ptr_offset,
+                int *index_offset,
+                int *val_offset,
+                int *dcsrindex_offset,
+                cudaStream_t stream)
+{
+    int b_offset = m;
+    int x_offset = m;
+    int tri_index = 0;
+    int squ_index = 0;
+    for (int i = 0; i < sum_block; i++)
+    {
+        if (i % 2 == 0)
         {
-            if (i % 2 == 0)
+            b_offset -= blk_m[i];
+            x_offset -= blk_n[i];
+            if (trsv_blk[tri_index].d_inv_ptr != NULL)
             {
-                if (trsv_blk[tri_index].method == 0)
-                {
-                    sptrsv_syncfree_csc_cuda_executor_fasttrack<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                     trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
-                }
-                else if (trsv_blk[tri_index].method == 1)
+                const VALUE_TYPE *b_inv = &b_t[b_offset];
+                if (b_inv == &x_t[x_offset])
                 {
-                    if (sizeof(VALUE_TYPE) == 8)
-                        cusparseDcsrsv2_solve(trsv_blk[tri_index].handle, trsv_blk[tri_index].trans, trsv_blk[tri_index].m, trsv_blk[tri_index].nnzTR, &(trsv_blk[tri_index].alpha_double), trsv_blk[tri_index].descr,
-                                              (double *)(&d_recblock_Val[index_offset[i]]), &d_recblock_Ptr[ptr_offset[i]], &d_recblock_Index[index_offset[i]], trsv_blk[tri_index].info,
-                                              (double *)&(b_t[b_offset]), (double *)&(x_t[x_offset]), trsv_blk[tri_index].policy, trsv_blk[tri_index].pBuffer);
-                    else if (sizeof(VALUE_TYPE) == 4)
-                        cusparseScsrsv2_solve(trsv_blk[tri_index].handle, trsv_blk[tri_index].trans, trsv_blk[tri_index].m, trsv_blk[tri_index].nnzTR, &(trsv_blk[tri_index].alpha_float), trsv_blk[tri_index].descr,
-                                              (float *)(&d_recblock_Val[index_offset[i]]), &d_recblock_Ptr[ptr_offset[i]], &d_recblock_Index[index_offset[i]], trsv_blk[tri_index].info,
-                                              (float *)&(b_t[b_offset]), (float *)&(x_t[x_offset]), trsv_blk[tri_index].policy, trsv_blk[tri_index].pBuffer);
+                    cudaMemcpyAsync(trsv_blk[tri_index].d_inv_b, b_inv, trsv_blk[tri_index].m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice, stream);
+                    b_inv = trsv_blk[tri_index].d_inv_b;
                 }
-                else if (trsv_blk[tri_index].method == 2)
+                int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                int num_blocks = ceil((double)trsv_blk[tri_index].m / (double)WARP_PER_BLOCK);
+                spmv_warpvec_csr_cuda_executor<<<num_blocks, num_threads, 0, stream>>>(trsv_blk[tri_index].d_inv_ptr, trsv_blk[tri_index].d_inv_idx, trsv_blk[tri_index].d_inv_val,
+                                                                                       trsv_blk[tri_index].m, b_inv, &x_t[x_offset]);
+            }
+            else if (trsv_blk[tri_index].d_dense != NULL)
+            {
+                sptrsv_dense_cuda_executor<<<1, DENSE_TRSV_THREADS, 0, stream>>>(trsv_blk[tri_index].d_dense, trsv_blk[tri_index].m, trsv_blk[tri_index].substitution,
+                                                                                 &b_t[b_offset], &x_t[x_offset]);
+            }
+            else if (trsv_blk[tri_index].super != NULL)
+            {
+                sptrsv_supernodal_solve(trsv_blk[tri_index].super, &b_t[b_offset], &x_t[x_offset], stream);
+            }
+            else if (trsv_blk[tri_index].method == 0)
+            {
+                sptrsv_syncfree_csc_cuda_executor_fasttrack<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                            trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+            }
+            else if (trsv_blk[tri_index].method == 1)
+            {
+                cusparseSetStream(trsv_blk[tri_index].handle, stream);
+                if (sizeof(VALUE_TYPE) == 8)
+                    cusparseDcsrsv2_solve(trsv_blk[tri_index].handle, trsv_blk[tri_index].trans, trsv_blk[tri_index].m, trsv_blk[tri_index].nnzTR, &(trsv_blk[tri_index].alpha_double), trsv_blk[tri_index].descr,
+                                          (double *)(&d_recblock_Val[val_offset[i]]), &d_recblock_Ptr[ptr_offset[i]], &d_recblock_Index[index_offset[i]], trsv_blk[tri_index].info,
+                                          (double *)&(b_t[b_offset]), (double *)&(x_t[x_offset]), trsv_blk[tri_index].policy, trsv_blk[tri_index].pBuffer);
+                else if (sizeof(VALUE_TYPE) == 4)
+                    cusparseScsrsv2_solve(trsv_blk[tri_index].handle, trsv_blk[tri_index].trans, trsv_blk[tri_index].m, trsv_blk[tri_index].nnzTR, &(trsv_blk[tri_index].alpha_float), trsv_blk[tri_index].descr,
+                                          (float *)(&d_recblock_Val[val_offset[i]]), &d_recblock_Ptr[ptr_offset[i]], &d_recblock_Index[index_offset[i]], trsv_blk[tri_index].info,
+                                          (float *)&(b_t[b_offset]), (float *)&(x_t[x_offset]), trsv_blk[tri_index].policy, trsv_blk[tri_index].pBuffer);
+            }
+            else if (trsv_blk[tri_index].method == 2)
+            {
+                for (int li = 0; li < trsv_blk[tri_index].nlv; li++)
                 {
-                    for (int li = 0; li < trsv_blk[tri_index].nlv; li++)
+                    if (trsv_blk[tri_index].serial_lv_array[li] == LEVEL_TASK_CHAIN)
+                    {
+                        sptrsv_levelset_chain_csr_cuda_executor<<<1, 1, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                     trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                    }
+                    else if (trsv_blk[tri_index].serial_lv_array[li] == LEVEL_TASK_SERIAL)
+                    {
+                        sptrsv_levelset_serial_csr_cuda_executor<<<1, WARP_SIZE, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                              trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                    }
+                    else if (li == 0)
                     {
-                        if (li == 0)
+                        trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                        trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)(trsv_blk[tri_index].num_threads));
+                        sptrsv_levelset_threadsca_csr_cuda_executor_fasttrack<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                                              trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                    }
+                    else
+                    {
+                        if ((trsv_blk[tri_index].nnz_lv_array[li] / trsv_blk[tri_index].m_lv_array[li]) <= 15)
                         {
                             trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
                             trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)(trsv_blk[tri_index].num_threads));
-                            sptrsv_levelset_threadsca_csr_cuda_executor_fasttrack<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                                       trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
+                            sptrsv_levelset_threadsca_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                                        trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
                         }
                         else
                         {
-                            if ((trsv_blk[tri_index].nnz_lv_array[li] / trsv_blk[tri_index].m_lv_array[li]) <= 15)
-                            {
-                                trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                                trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)(trsv_blk[tri_index].num_threads));
-                                sptrsv_levelset_threadsca_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                                 trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
-                            }
-                            else
-                            {
-                                trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                                trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)((trsv_blk[tri_index].num_threads) / WARP_SIZE));
-                                sptrsv_levelset_warpvec_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                               trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
-                            }
+                            trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                            trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)((trsv_blk[tri_index].num_threads) / WARP_SIZE));
+                            sptrsv_levelset_warpvec_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                                      trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
                         }
                     }
                 }
-                else if (trsv_blk[tri_index].method == 3)
-                {
-                    sptrsv_syncfree_warpvec_csc_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                   trsv_blk[tri_index].d_graphInDegree, trsv_blk[tri_index].d_left_sum,
-                                                                                                                                   trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset], trsv_blk[tri_index].d_while_profiler,
-                                                                                                                                   trsv_blk[tri_index].d_id_extractor, trsv_blk[tri_index].d_levelItem);
-                }
-                tri_index++;
-                b_offset += blk_m[i];
-                x_offset += blk_n[i];
-                cudaDeviceSynchronize();
             }
-            else
+            else if (trsv_blk[tri_index].method == 4)
             {
-                if (mv_blk[squ_index].method == 0)
-                {
-                    spmv_threadsca_csr_cuda_executor<<<mv_blk[squ_index].num_blocks, mv_blk[squ_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                      mv_blk[squ_index].m, &x_t[loc_off[i]], mv_blk[squ_index].d_y);
-                    if (mv_blk[squ_index].longrow != 0)
-                        spmv_longrow_csr_cuda_executor<<<mv_blk[squ_index].num_blocks_l, mv_blk[squ_index].num_threads_l>>>(mv_blk[squ_index].d_csrRowPtr_l, mv_blk[squ_index].d_csrColIdx_l, mv_blk[squ_index].d_csrVal_l,
-                                                                                                                            &x_t[loc_off[i]], mv_blk[squ_index].d_y, mv_blk[squ_index].longrow, mv_blk[squ_index].d_longrow_idx);
-
-                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                    int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
-                    subKernel<<<num_blocks, num_threads>>>(&(b_t[tmp_off[i]]), mv_blk[squ_index].d_y, blk_m[i]);
-                }
-                else if (mv_blk[squ_index].method == 1)
-                {
-                    spmv_threadsca_dcsr_cuda_executor<<<mv_blk[squ_index].num_blocks, mv_blk[squ_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                       mv_blk[squ_index].m_new, &x_t[loc_off[i]], mv_blk[squ_index].d_y, &d_recblock_dcsr_rowidx[dcsrindex_offset[i]]);
-
-                    if (mv_blk[squ_index].longrow != 0)
-                        spmv_longrow_csr_cuda_executor<<<mv_blk[squ_index].num_blocks_l, mv_blk[squ_index].num_threads_l>>>(mv_blk[squ_index].d_csrRowPtr_l, mv_blk[squ_index].d_csrColIdx_l, mv_blk[squ_index].d_csrVal_l,
-                                                                                                                            &x_t[loc_off[i]], mv_blk[squ_index].d_y, mv_blk[squ_index].longrow, mv_blk[squ_index].d_longrow_idx);
-
-                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                    int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
-                    subKernel<<<num_blocks, num_threads>>>(&(b_t[tmp_off[i]]), mv_blk[squ_index].d_y, blk_m[i]);
-                }
-                else if (mv_blk[squ_index].method == 2)
-                {
-                    spmv_warpvec_csr_cuda_executor<<<mv_blk[squ_index].num_blocks, mv_blk[squ_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                    mv_blk[squ_index].m, &x_t[loc_off[i]], mv_blk[squ_index].d_y);
-                    if (mv_blk[squ_index].longrow != 0)
-                        spmv_longrow_csr_cuda_executor<<<mv_blk[squ_index].num_blocks_l, mv_blk[squ_index].num_threads_l>>>(mv_blk[squ_index].d_csrRowPtr_l, mv_blk[squ_index].d_csrColIdx_l, mv_blk[squ_index].d_csrVal_l,
-                                                                                                                            &x_t[loc_off[i]], mv_blk[squ_index].d_y, mv_blk[squ_index].longrow, mv_blk[squ_index].d_longrow_idx);
+                sptrsv_p2p_threadsca_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                       trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset],
+                                                                                                                                       trsv_blk[tri_index].nchunks, trsv_blk[tri_index].d_chunk_ptr, trsv_blk[tri_index].d_dep_ptr, trsv_blk[tri_index].d_dep_idx,
+                                                                                                                                       trsv_blk[tri_index].d_chunk_done, trsv_blk[tri_index].d_ticket);
+            }
+            else if (trsv_blk[tri_index].method == 3)
+            {
+                // the sync-free counters are consumed by every solve, so rebuild them in the schedule
+                cudaMemsetAsync(trsv_blk[tri_index].d_graphInDegree, 0, trsv_blk[tri_index].m * sizeof(int), stream);
+                sptrsv_syncfree_csc_cuda_analyser<<<ceil((double)trsv_blk[tri_index].nnzTR / 128.0), 128, 0, stream>>>(&d_recblock_Index[index_offset[i]], trsv_blk[tri_index].m,
+                                                                                                                  trsv_blk[tri_index].nnzTR, trsv_blk[tri_index].d_graphInDegree);
+                cudaMemsetAsync(trsv_blk[tri_index].d_left_sum, 0, trsv_blk[tri_index].m * sizeof(VALUE_TYPE), stream);
+                cudaMemsetAsync(trsv_blk[tri_index].d_id_extractor, 0, sizeof(int), stream);
+                sptrsv_syncfree_warpvec_csc_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[val_offset[i]],
+                                                                                                                                          trsv_blk[tri_index].d_graphInDegree, trsv_blk[tri_index].d_left_sum,
+                                                                                                                                          trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset], trsv_blk[tri_index].d_while_profiler,
+                                                                                                                                          trsv_blk[tri_index].d_id_extractor, trsv_blk[tri_index].d_levelItem);
+            }
+            tri_index++;
 
-                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                    int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
-                    subKernel<<<num_blocks, num_threads>>>(&(b_t[tmp_off[i]]), mv_blk[squ_index].d_y, blk_m[i]);
-                }
-                else if (mv_blk[squ_index].method == 3)
-                {
-                    spmv_warpvec_dcsr_cuda_executor<<<mv_blk[squ_index].num_blocks, mv_blk[squ_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                     mv_blk[squ_index].m_new, &x_t[loc_off[i]], mv_blk[squ_index].d_y, &d_recblock_dcsr_rowidx[dcsrindex_offset[i]]);
-                    if (mv_blk[squ_index].longrow != 0)
-                        spmv_longrow_csr_cuda_executor<<<mv_blk[squ_index].num_blocks_l, mv_blk[squ_index].num_threads_l>>>(mv_blk[squ_index].d_csrRowPtr_l, mv_blk[squ_index].d_csrColIdx_l, mv_blk[squ_index].d_csrVal_l,
-                                                                                                                            &x_t[loc_off[i]], mv_blk[squ_index].d_y, mv_blk[squ_index].longrow, mv_blk[squ_index].d_longrow_idx);
+        }
+        else
+        {
+            SpMV_block *blk = &(mv_blk[squ_index]);
+            if (blk->method != -1)
+            {
+                const int *ptr = &d_recblock_Ptr[ptr_offset[i] - 1];
+                const VALUE_TYPE *val = &d_recblock_Val[val_offset[i]];
+                const int *row_perm = &d_recblock_dcsr_rowidx[dcsrindex_offset[i]];
+                spmv_block_cuda_executor_compact(blk, ptr, &d_recblock_Index[index_offset[i]], val, &x_t[loc_off[i]], row_perm, stream);
+                if (blk->longrow != 0)
+                    spmv_longrow_csr_cuda_executor<<<blk->num_blocks_l, blk->num_threads_l, 0, stream>>>(blk->d_csrRowPtr_l, blk->d_csrColIdx_l, blk->d_csrVal_l,
+                                                                                                         &x_t[loc_off[i]], blk->d_y, blk->longrow, blk->d_longrow_idx);
 
-                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                    int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
-                    subKernel<<<num_blocks, num_threads>>>(&(b_t[tmp_off[i]]), mv_blk[squ_index].d_y, blk_m[i]);
-                }
-                squ_index++;
-                cudaDeviceSynchronize();
+                int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
+                subKernel<<<num_blocks, num_threads, 0, stream>>>(&(b_t[tmp_off[i]]), blk->d_y, blk_m[i]);
             }
+            squ_index++;
         }
-        cudaDeviceSynchronize();
-        gettimeofday(&t2, NULL);
-        *cal_time += (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
     }
-    *cal_time /= BENCH_REPEAT;
 }
 
 void U_calculate(SpMV_block *mv_blk,
@@ -186,142 +399,154 @@ void U_calculate(SpMV_block *mv_blk,
                  const double *d_recblock_Val,
                  int *ptr_offset,
                  int *index_offset,
+                 int *val_offset,
                  int *dcsrindex_offset,
                  double *cal_time)
 {
     struct timeval t1, t2;
-    double total_cal_time = 0;
+    cudaStream_t stream;
+    cudaStreamCreate(&stream);
+#if USE_CUDA_GRAPH
+    // capture the schedule once, then each solve is a single graph launch
+    cudaGraph_t graph;
+    cudaGraphExec_t graph_exec;
+    cudaStreamBeginCapture(stream, cudaStreamCaptureModeGlobal);
+    U_schedule(mv_blk, trsv_blk, sum_block, blk_m, blk_n, loc_off, tmp_off, m, x_t, b_t,
+               d_recblock_Ptr, d_recblock_Index, d_recblock_dcsr_rowidx, d_recblock_Val, ptr_offset, index_offset, val_offset, dcsrindex_offset, stream);
+    cudaStreamEndCapture(stream, &graph);
+    cudaGraphInstantiate(&graph_exec, graph, NULL, NULL, 0);
+#endif
     for (int re = 0; re < BENCH_REPEAT; re++)
     {
         cudaMemcpy(b_t, b_perm, rhs * m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
-        int b_offset = m;
-        int x_offset = m;
-        int tri_index = 0;
-        int squ_index = 0;
 
         gettimeofday(&t1, NULL);
-        for (int i = 0; i < sum_block; i++)
+#if USE_CUDA_GRAPH
+        cudaGraphLaunch(graph_exec, stream);
+#else
+        U_schedule(mv_blk, trsv_blk, sum_block, blk_m, blk_n, loc_off, tmp_off, m, x_t, b_t,
+                   d_recblock_Ptr, d_recblock_Index, d_recblock_dcsr_rowidx, d_recblock_Val, ptr_offset, index_offset, val_offset, dcsrindex_offset, stream);
+#endif
+        cudaStreamSynchronize(stream);
+        gettimeofday(&t2, NULL);
+        *cal_time += (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
+    }
+    *cal_time /= BENCH_REPEAT;
+#if USE_CUDA_GRAPH
+    cudaGraphExecDestroy(graph_exec);
+    cudaGraphDestroy(graph);
+#endif
+    cudaStreamDestroy(stream);
+}
+
+// enqueue the schedule of T^T x = b for the blocks of T: the blocks run in reverse
+// order, every triangle through the sync-free executor of the other storage (CSR
+// pushed as the CSC of its transpose and CSC pulled as the CSR of it), and every
+// square as b -= A^T x. Triangles other than fasttrack need the counters that
+// recblocking_plan_prepare_transposed() allocates.
+void transposed_schedule(SpMV_block *mv_blk,
+                         SpTRSV_block *trsv_blk,
+                         int sum_block,
+                         int *blk_m,
+                         int *blk_n,
+                         int *loc_off,
+                         int *tmp_off,
+                         int m,
+                         int substitution,
+                         VALUE_TYPE *x_t,
+                         VALUE_TYPE *b_t,
+                         const int *d_recblock_Ptr,
+                         const int *d_recblock_Index,
+                         const int *d_recblock_dcsr_rowidx,
+                         const double *d_recblock_Val,
+                         int *ptr_offset,
+                         int *index_offset,
+                         int *dcsrindex_offset,
+                         cudaStream_t stream)
+{
+    // the transpose of a lower triangle is upper and the other way round
+    const int substitution_t = substitution == SUBSTITUTION_FORWARD ? SUBSTITUTION_BACKWARD : SUBSTITUTION_FORWARD;
+
+    // offsets of every block in the vectors, as walked by L_schedule / U_schedule
+    int *vec_off = (int *)malloc(sum_block * sizeof(int));
+    int offset = substitution == SUBSTITUTION_FORWARD ? 0 : m;
+    for (int i = 0; i < sum_block; i += 2)
+    {
+        if (substitution == SUBSTITUTION_FORWARD)
         {
-            if (i % 2 == 0)
-            {
-                b_offset -= blk_m[i];
-                x_offset -= blk_n[i];
-                if (trsv_blk[tri_index].method == 0)
-                {
-                    sptrsv_syncfree_csc_cuda_executor_fasttrack<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                     trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
-                }
-                else if (trsv_blk[tri_index].method == 1)
-                {
-                    if (sizeof(VALUE_TYPE) == 8)
-                        cusparseDcsrsv2_solve(trsv_blk[tri_index].handle, trsv_blk[tri_index].trans, trsv_blk[tri_index].m, trsv_blk[tri_index].nnzTR, &(trsv_blk[tri_index].alpha_double), trsv_blk[tri_index].descr,
-                                              (double *)(&d_recblock_Val[index_offset[i]]), &d_recblock_Ptr[ptr_offset[i]], &d_recblock_Index[index_offset[i]], trsv_blk[tri_index].info,
-                                              (double *)&(b_t[b_offset]), (double *)&(x_t[x_offset]), trsv_blk[tri_index].policy, trsv_blk[tri_index].pBuffer);
-                    else if (sizeof(VALUE_TYPE) == 4)
-                        cusparseScsrsv2_solve(trsv_blk[tri_index].handle, trsv_blk[tri_index].trans, trsv_blk[tri_index].m, trsv_blk[tri_index].nnzTR, &(trsv_blk[tri_index].alpha_float), trsv_blk[tri_index].descr,
-                                              (float *)(&d_recblock_Val[index_offset[i]]), &d_recblock_Ptr[ptr_offset[i]], &d_recblock_Index[index_offset[i]], trsv_blk[tri_index].info,
-                                              (float *)&(b_t[b_offset]), (float *)&(x_t[x_offset]), trsv_blk[tri_index].policy, trsv_blk[tri_index].pBuffer);
-                }
-                else if (trsv_blk[tri_index].method == 2)
-                {
-                    for (int li = 0; li < trsv_blk[tri_index].nlv; li++)
-                    {
-                        if (li == 0)
-                        {
-                            trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                            trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)(trsv_blk[tri_index].num_threads));
-                            sptrsv_levelset_threadsca_csr_cuda_executor_fasttrack<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                                       trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
-                        }
-                        else
-                        {
-                            if ((trsv_blk[tri_index].nnz_lv_array[li] / trsv_blk[tri_index].m_lv_array[li]) <= 15)
-                            {
-                                trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                                trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)(trsv_blk[tri_index].num_threads));
-                                sptrsv_levelset_threadsca_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                                 trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
-                            }
-                            else
-                            {
-                                trsv_blk[tri_index].num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                                trsv_blk[tri_index].num_blocks = ceil((double)(trsv_blk[tri_index].m_lv_array[li]) / (double)((trsv_blk[tri_index].num_threads) / WARP_SIZE));
-                                sptrsv_levelset_warpvec_csr_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                               trsv_blk[tri_index].m_lv_array[li], trsv_blk[tri_index].m, trsv_blk[tri_index].offset_array[li], trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset]);
-                            }
-                        }
-                    }
-                }
-                else if (trsv_blk[tri_index].method == 3)
-                {
-                    sptrsv_syncfree_warpvec_csc_cuda_executor<<<trsv_blk[tri_index].num_blocks, trsv_blk[tri_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                                   trsv_blk[tri_index].d_graphInDegree, trsv_blk[tri_index].d_left_sum,
-                                                                                                                                   trsv_blk[tri_index].m, trsv_blk[tri_index].substitution, &b_t[b_offset], &x_t[x_offset], trsv_blk[tri_index].d_while_profiler,
-                                                                                                                                   trsv_blk[tri_index].d_id_extractor, trsv_blk[tri_index].d_levelItem);
-                }
-                tri_index++;
+            vec_off[i] = offset;
+            offset += blk_m[i];
+        }
+        else
+        {
+            offset -= blk_m[i];
+            vec_off[i] = offset;
+        }
+    }
 
-                cudaDeviceSynchronize();
+    int tri_index = (sum_block + 1) / 2 - 1;
+    int squ_index = sum_block / 2 - 1;
+    for (int i = sum_block - 1; i >= 0; i--)
+    {
+        if (i % 2 == 0)
+        {
+            SpTRSV_block *blk = &(trsv_blk[tri_index]);
+            const int nnz = index_offset[i + 1] - index_offset[i];
+            // cuSPARSE blocks keep a full row pointer of their own
+            const int *ptr = blk->method == 1 ? &d_recblock_Ptr[ptr_offset[i]] : &d_recblock_Ptr[ptr_offset[i] - 1];
+            if (blk->method == 0)
+            {
+                sptrsv_syncfree_csc_cuda_executor_fasttrack<<<blk->num_blocks, blk->num_threads, 0, stream>>>(ptr, &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
+                                                                                                              blk->m, blk->substitution, &b_t[vec_off[i]], &x_t[vec_off[i]]);
+            }
+            else if (blk->method == 3)
+            {
+                cudaMemsetAsync(blk->d_graphInDegree, 0, blk->m * sizeof(int), stream);
+                cudaMemsetAsync(blk->d_id_extractor, 0, sizeof(int), stream);
+                int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                int num_blocks = ceil((double)blk->m / (double)WARP_PER_BLOCK);
+                sptrsv_syncfree_warpvec_csr_cuda_executor<<<num_blocks, num_threads, 0, stream>>>(ptr, &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
+                                                                                                  blk->d_graphInDegree, blk->m, substitution_t,
+                                                                                                  &b_t[vec_off[i]], &x_t[vec_off[i]], blk->d_id_extractor);
             }
             else
             {
-                if (mv_blk[squ_index].method == 0)
-                {
-                    spmv_threadsca_csr_cuda_executor<<<mv_blk[squ_index].num_blocks, mv_blk[squ_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                      mv_blk[squ_index].m, &x_t[loc_off[i]], mv_blk[squ_index].d_y);
-                    if (mv_blk[squ_index].longrow != 0)
-                        spmv_longrow_csr_cuda_executor<<<mv_blk[squ_index].num_blocks_l, mv_blk[squ_index].num_threads_l>>>(mv_blk[squ_index].d_csrRowPtr_l, mv_blk[squ_index].d_csrColIdx_l, mv_blk[squ_index].d_csrVal_l,
-                                                                                                                            &x_t[loc_off[i]], mv_blk[squ_index].d_y, mv_blk[squ_index].longrow, mv_blk[squ_index].d_longrow_idx);
-
-                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                    int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
-                    subKernel<<<num_blocks, num_threads>>>(&(b_t[tmp_off[i]]), mv_blk[squ_index].d_y, blk_m[i]);
-                }
-                else if (mv_blk[squ_index].method == 1)
-                {
-                    spmv_threadsca_dcsr_cuda_executor<<<mv_blk[squ_index].num_blocks, mv_blk[squ_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                       mv_blk[squ_index].m_new, &x_t[loc_off[i]], mv_blk[squ_index].d_y, &d_recblock_dcsr_rowidx[dcsrindex_offset[i]]);
-                    if (mv_blk[squ_index].longrow != 0)
-                        spmv_longrow_csr_cuda_executor<<<mv_blk[squ_index].num_blocks_l, mv_blk[squ_index].num_threads_l>>>(mv_blk[squ_index].d_csrRowPtr_l, mv_blk[squ_index].d_csrColIdx_l, mv_blk[squ_index].d_csrVal_l,
-                                                                                                                            &x_t[loc_off[i]], mv_blk[squ_index].d_y, mv_blk[squ_index].longrow, mv_blk[squ_index].d_longrow_idx);
-
-                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                    int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
-                    subKernel<<<num_blocks, num_threads>>>(&(b_t[tmp_off[i]]), mv_blk[squ_index].d_y, blk_m[i]);
-                }
-                else if (mv_blk[squ_index].method == 2)
-                {
-                    spmv_warpvec_csr_cuda_executor<<<mv_blk[squ_index].num_blocks, mv_blk[squ_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                    mv_blk[squ_index].m, &x_t[loc_off[i]], mv_blk[squ_index].d_y);
-                    if (mv_blk[squ_index].longrow != 0)
-                        spmv_longrow_csr_cuda_executor<<<mv_blk[squ_index].num_blocks_l, mv_blk[squ_index].num_threads_l>>>(mv_blk[squ_index].d_csrRowPtr_l, mv_blk[squ_index].d_csrColIdx_l, mv_blk[squ_index].d_csrVal_l,
-                                                                                                                            &x_t[loc_off[i]], mv_blk[squ_index].d_y, mv_blk[squ_index].longrow, mv_blk[squ_index].d_longrow_idx);
-
-                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                    int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
-                    subKernel<<<num_blocks, num_threads>>>(&(b_t[tmp_off[i]]), mv_blk[squ_index].d_y, blk_m[i]);
-                }
-                else if (mv_blk[squ_index].method == 3)
-                {
-                    spmv_warpvec_dcsr_cuda_executor<<<mv_blk[squ_index].num_blocks, mv_blk[squ_index].num_threads>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
-                                                                                                                     mv_blk[squ_index].m_new, &x_t[loc_off[i]], mv_blk[squ_index].d_y, &d_recblock_dcsr_rowidx[dcsrindex_offset[i]]);
-                    if (mv_blk[squ_index].longrow != 0)
-                        spmv_longrow_csr_cuda_executor<<<mv_blk[squ_index].num_blocks_l, mv_blk[squ_index].num_threads_l>>>(mv_blk[squ_index].d_csrRowPtr_l, mv_blk[squ_index].d_csrColIdx_l, mv_blk[squ_index].d_csrVal_l,
-                                                                                                                            &x_t[loc_off[i]], mv_blk[squ_index].d_y, mv_blk[squ_index].longrow, mv_blk[squ_index].d_longrow_idx);
-
-                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
-                    int num_blocks = ceil((double)(blk_m[i]) / (double)num_threads);
-                    subKernel<<<num_blocks, num_threads>>>(&(b_t[tmp_off[i]]), mv_blk[squ_index].d_y, blk_m[i]);
-                }
-                squ_index++;
-                cudaDeviceSynchronize();
+                cudaMemsetAsync(blk->d_graphInDegree, 0, blk->m * sizeof(int), stream);
+                sptrsv_syncfree_csc_cuda_analyser<<<ceil((double)nnz / 128.0), 128, 0, stream>>>(&d_recblock_Index[index_offset[i]], blk->m, nnz, blk->d_graphInDegree);
+                cudaMemsetAsync(blk->d_left_sum, 0, blk->m * sizeof(VALUE_TYPE), stream);
+                cudaMemsetAsync(blk->d_id_extractor, 0, sizeof(int), stream);
+                int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                int num_blocks = ceil((double)blk->m / (double)WARP_PER_BLOCK);
+                sptrsv_syncfree_warpvec_csc_cuda_executor<<<num_blocks, num_threads, 0, stream>>>(ptr, &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]],
+                                                                                                  blk->d_graphInDegree, blk->d_left_sum, blk->m, substitution_t,
+                                                                                                  &b_t[vec_off[i]], &x_t[vec_off[i]], NULL, blk->d_id_extractor, NULL);
             }
+            tri_index--;
+        }
+        else
+        {
+            SpMV_block *blk = &(mv_blk[squ_index]);
+            int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+            if (blk->method == 0 || blk->method == 1)
+            {
+                int rows = blk->method == 0 ? blk->m : blk->m_new;
+                int num_blocks = ceil((double)rows / (double)num_threads);
+                spmv_transpose_threadsca_csr_cuda_executor<<<num_blocks, num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]], rows,
+                                                                                                   &x_t[tmp_off[i]], &b_t[loc_off[i]],
+                                                                                                   blk->method == 0 ? NULL : &d_recblock_dcsr_rowidx[dcsrindex_offset[i]]);
+            }
+            else if (blk->method == 2 || blk->method == 3)
+            {
+                int rows = blk->method == 2 ? blk->m : blk->m_new;
+                int num_blocks = ceil((double)rows / (double)WARP_PER_BLOCK);
+                spmv_transpose_warpvec_csr_cuda_executor<<<num_blocks, num_threads, 0, stream>>>(&d_recblock_Ptr[ptr_offset[i] - 1], &d_recblock_Index[index_offset[i]], &d_recblock_Val[index_offset[i]], rows,
+                                                                                                 &x_t[tmp_off[i]], &b_t[loc_off[i]],
+                                                                                                 blk->method == 2 ? NULL : &d_recblock_dcsr_rowidx[dcsrindex_offset[i]]);
+            }
+            squ_index--;
         }
-        cudaDeviceSynchronize();
-        gettimeofday(&t2, NULL);
-        *cal_time += (t2.tv_sec - t1.tv_sec) * 1000.0 + (t2.tv_usec - t1.tv_usec) / 1000.0;
     }
-    *cal_time /= BENCH_REPEAT;
+    free(vec_off);
 }
 
 void device_memfree(SpMV_block *mv_blk,
@@ -343,6 +568,7 @@ void device_memfree(SpMV_block *mv_blk,
             free(trsv_blk[i].nnz_lv_array);
             free(trsv_blk[i].m_lv_array);
             free(trsv_blk[i].offset_array);
+            free(trsv_blk[i].serial_lv_array);
         }
         else if (trsv_blk[i].method == 3)
         {
@@ -351,6 +577,25 @@ void device_memfree(SpMV_block *mv_blk,
             cudaFree(trsv_blk[i].d_id_extractor);
             cudaFree(trsv_blk[i].d_levelItem);
         }
+        else if (trsv_blk[i].method == 4)
+        {
+            cudaFree(trsv_blk[i].d_chunk_ptr);
+            cudaFree(trsv_blk[i].d_dep_ptr);
+            cudaFree(trsv_blk[i].d_dep_idx);
+            cudaFree(trsv_blk[i].d_chunk_done);
+            cudaFree(trsv_blk[i].d_ticket);
+        }
+        if (trsv_blk[i].d_dense != NULL)
+            cudaFree(trsv_blk[i].d_dense);
+        if (trsv_blk[i].super != NULL)
+            sptrsv_supernodal_destroy(trsv_blk[i].super);
+        if (trsv_blk[i].d_inv_ptr != NULL)
+        {
+            cudaFree(trsv_blk[i].d_inv_ptr);
+            cudaFree(trsv_blk[i].d_inv_idx);
+            cudaFree(trsv_blk[i].d_inv_val);
+            cudaFree(trsv_blk[i].d_inv_b);
+        }
     }
     for (int i = 0; i < squ_block; i++)
     {
@@ -398,6 +643,19 @@ void device_memfree(SpMV_block *mv_blk,
                 cudaFree(mv_blk[i].d_longrow_idx);
             }
         }
+        if (mv_blk[i].d_sell_ptr != NULL)
+        {
+            cudaFree(mv_blk[i].d_sell_ptr);
+            cudaFree(mv_blk[i].d_sell_col);
+            cudaFree(mv_blk[i].d_sell_val);
+            cudaFree(mv_blk[i].d_sell_row);
+        }
+        if (mv_blk[i].bsr_dim)
+        {
+            cudaFree(mv_blk[i].d_bsr_ptr);
+            cudaFree(mv_blk[i].d_bsr_col);
+            cudaFree(mv_blk[i].d_bsr_val);
+        }
     }
     free(mv_blk);
     free(trsv_blk);
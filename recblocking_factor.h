@@ -0,0 +1,399 @@
+#ifndef __RECBLOCKING_FACTOR__
+#define __RECBLOCKING_FACTOR__
+#include <stdio.h>
+#include <stdlib.h>
+#include "common.h"
+#include "recblocking_plan.h"
+#include <cuda_runtime.h>
+#include <thrust/scan.h>
+#include <thrust/execution_policy.h>
+
+#define FACTOR_NONE 0
+#define FACTOR_ILU0 1
+#define FACTOR_IC0 2
+
+// The factorizations below work in place on a CSR matrix whose rows are sorted by
+// column and all hold a diagonal entry. Row i only depends on the rows k < i with
+// a(i,k) != 0, i.e. on the lower triangle of A, so the level sets of that triangle
+// (the same ones the solve uses) give the parallel schedule of the factorization.
+
+__global__ void factor_diag_ptr_cuda(const int *d_csrRowPtr,
+                                     const int *d_csrColIdx,
+                                     int *d_diag,
+                                     int m,
+                                     int *d_breakdown)
+{
+    const int global_x_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id < m)
+    {
+        int pos = -1;
+        for (int j = d_csrRowPtr[global_x_id]; j < d_csrRowPtr[global_x_id + 1]; j++)
+            if (d_csrColIdx[j] == global_x_id)
+                pos = j;
+        d_diag[global_x_id] = pos;
+        if (pos == -1)
+            atomicAdd(d_breakdown, 1);
+    }
+}
+
+// row sizes of L and U; with unit_lower L = strict lower + unit diagonal and
+// U = upper including the diagonal, otherwise L = lower including the diagonal
+__global__ void factor_split_count_cuda(const int *d_csrRowPtr,
+                                        const int *d_csrColIdx,
+                                        int m,
+                                        int unit_lower,
+                                        int *d_csrRowPtrL,
+                                        int *d_csrRowPtrU)
+{
+    const int global_x_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id < m)
+    {
+        int nnzl = unit_lower ? 1 : 0;
+        int nnzu = 0;
+        for (int j = d_csrRowPtr[global_x_id]; j < d_csrRowPtr[global_x_id + 1]; j++)
+        {
+            if (d_csrColIdx[j] < global_x_id || (!unit_lower && d_csrColIdx[j] == global_x_id))
+                nnzl++;
+            else
+                nnzu++;
+        }
+        d_csrRowPtrL[global_x_id] = nnzl;
+        if (d_csrRowPtrU != NULL)
+            d_csrRowPtrU[global_x_id] = nnzu;
+    }
+}
+
+__global__ void factor_split_fill_cuda(const int *d_csrRowPtr,
+                                       const int *d_csrColIdx,
+                                       const VALUE_TYPE *d_csrVal,
+                                       int m,
+                                       int unit_lower,
+                                       const int *d_csrRowPtrL,
+                                       int *d_csrColIdxL,
+                                       VALUE_TYPE *d_csrValL,
+                                       const int *d_csrRowPtrU,
+                                       int *d_csrColIdxU,
+                                       VALUE_TYPE *d_csrValU)
+{
+    const int global_x_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id < m)
+    {
+        int pl = d_csrRowPtrL[global_x_id];
+        int pu = d_csrRowPtrU == NULL ? 0 : d_csrRowPtrU[global_x_id];
+        for (int j = d_csrRowPtr[global_x_id]; j < d_csrRowPtr[global_x_id + 1]; j++)
+        {
+            int col = d_csrColIdx[j];
+            if (col < global_x_id || (!unit_lower && col == global_x_id))
+            {
+                d_csrColIdxL[pl] = col;
+                d_csrValL[pl] = d_csrVal[j];
+                pl++;
+            }
+            else if (d_csrRowPtrU != NULL)
+            {
+                d_csrColIdxU[pu] = col;
+                d_csrValU[pu] = d_csrVal[j];
+                pu++;
+            }
+        }
+        if (unit_lower)
+        {
+            d_csrColIdxL[pl] = global_x_id;
+            d_csrValL[pl] = 1.0;
+        }
+    }
+}
+
+// one thread per row of a level: a(i,k) /= a(k,k), then a(i,j) -= a(i,k) * a(k,j)
+// for the j > k present in both rows (sorted merge)
+__global__ void ilu0_level_csr_cuda(const int *d_csrRowPtr,
+                                    const int *d_csrColIdx,
+                                    VALUE_TYPE *d_csrVal,
+                                    const int *d_diag,
+                                    const int *d_levelItem,
+                                    int lv_begin,
+                                    int lv_end,
+                                    int *d_breakdown)
+{
+    const int global_x_id = lv_begin + blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id >= lv_end)
+        return;
+    const int row = d_levelItem[global_x_id];
+    const int row_end = d_csrRowPtr[row + 1];
+
+    for (int p = d_csrRowPtr[row]; p < d_diag[row]; p++)
+    {
+        const int k = d_csrColIdx[p];
+        const VALUE_TYPE lik = d_csrVal[p] / d_csrVal[d_diag[k]];
+        d_csrVal[p] = lik;
+
+        int q = p + 1;
+        int r = d_diag[k] + 1;
+        const int k_end = d_csrRowPtr[k + 1];
+        while (q < row_end && r < k_end)
+        {
+            int cq = d_csrColIdx[q];
+            int cr = d_csrColIdx[r];
+            if (cq == cr)
+            {
+                d_csrVal[q] -= lik * d_csrVal[r];
+                q++;
+                r++;
+            }
+            else if (cq < cr)
+                q++;
+            else
+                r++;
+        }
+    }
+    if (d_csrVal[d_diag[row]] == 0)
+        atomicAdd(d_breakdown, 1);
+}
+
+// one thread per row of a level, on the lower triangle of A:
+// l(i,j) = (a(i,j) - sum_{k<j} l(i,k) l(j,k)) / l(j,j), l(i,i) = sqrt(a(i,i) - sum_{k<i} l(i,k)^2)
+__global__ void ic0_level_csr_cuda(const int *d_csrRowPtr,
+                                   const int *d_csrColIdx,
+                                   VALUE_TYPE *d_csrVal,
+                                   const int *d_diag,
+                                   const int *d_levelItem,
+                                   int lv_begin,
+                                   int lv_end,
+                                   int *d_breakdown)
+{
+    const int global_x_id = lv_begin + blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id >= lv_end)
+        return;
+    const int row = d_levelItem[global_x_id];
+    const int row_begin = d_csrRowPtr[row];
+
+    VALUE_TYPE sqsum = 0;
+    for (int p = row_begin; p < d_diag[row]; p++)
+    {
+        const int j = d_csrColIdx[p];
+        VALUE_TYPE sum = 0;
+        int q = row_begin;
+        int r = d_csrRowPtr[j];
+        while (q < p && r < d_diag[j])
+        {
+            int cq = d_csrColIdx[q];
+            int cr = d_csrColIdx[r];
+            if (cq == cr)
+            {
+                sum += d_csrVal[q] * d_csrVal[r];
+                q++;
+                r++;
+            }
+            else if (cq < cr)
+                q++;
+            else
+                r++;
+        }
+        VALUE_TYPE lij = (d_csrVal[p] - sum) / d_csrVal[d_diag[j]];
+        d_csrVal[p] = lij;
+        sqsum += lij * lij;
+    }
+    VALUE_TYPE dia = d_csrVal[d_diag[row]] - sqsum;
+    if (dia <= 0)
+        atomicAdd(d_breakdown, 1);
+    d_csrVal[d_diag[row]] = sqrt(dia);
+}
+
+// split A into L (and U) on the device, allocating the outputs
+void factor_split_cuda(int *d_csrRowPtr,
+                       int *d_csrColIdx,
+                       VALUE_TYPE *d_csrVal,
+                       int m,
+                       int unit_lower,
+                       int **d_csrRowPtrL,
+                       int **d_csrColIdxL,
+                       VALUE_TYPE **d_csrValL,
+                       int *nnzL,
+                       int **d_csrRowPtrU,
+                       int **d_csrColIdxU,
+                       VALUE_TYPE **d_csrValU,
+                       int *nnzU)
+{
+    int with_u = d_csrRowPtrU != NULL;
+    cudaMalloc((void **)d_csrRowPtrL, (m + 1) * sizeof(int));
+    cudaMemset(*d_csrRowPtrL, 0, (m + 1) * sizeof(int));
+    if (with_u)
+    {
+        cudaMalloc((void **)d_csrRowPtrU, (m + 1) * sizeof(int));
+        cudaMemset(*d_csrRowPtrU, 0, (m + 1) * sizeof(int));
+    }
+
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)m / (double)num_threads);
+    factor_split_count_cuda<<<num_blocks, num_threads>>>(d_csrRowPtr, d_csrColIdx, m, unit_lower,
+                                                         *d_csrRowPtrL, with_u ? *d_csrRowPtrU : NULL);
+    thrust::exclusive_scan(thrust::device, *d_csrRowPtrL, *d_csrRowPtrL + m + 1, *d_csrRowPtrL, 0);
+    cudaMemcpy(nnzL, &((*d_csrRowPtrL)[m]), sizeof(int), cudaMemcpyDeviceToHost);
+    cudaMalloc((void **)d_csrColIdxL, *nnzL * sizeof(int));
+    cudaMalloc((void **)d_csrValL, *nnzL * sizeof(VALUE_TYPE));
+    if (with_u)
+    {
+        thrust::exclusive_scan(thrust::device, *d_csrRowPtrU, *d_csrRowPtrU + m + 1, *d_csrRowPtrU, 0);
+        cudaMemcpy(nnzU, &((*d_csrRowPtrU)[m]), sizeof(int), cudaMemcpyDeviceToHost);
+        cudaMalloc((void **)d_csrColIdxU, *nnzU * sizeof(int));
+        cudaMalloc((void **)d_csrValU, *nnzU * sizeof(VALUE_TYPE));
+    }
+
+    factor_split_fill_cuda<<<num_blocks, num_threads>>>(d_csrRowPtr, d_csrColIdx, d_csrVal, m, unit_lower,
+                                                        *d_csrRowPtrL, *d_csrColIdxL, *d_csrValL,
+                                                        with_u ? *d_csrRowPtrU : NULL, with_u ? *d_csrColIdxU : NULL, with_u ? *d_csrValU : NULL);
+    cudaDeviceSynchronize();
+}
+
+// factor A in place level by level, returns the number of zero (or, for IC, non-positive) pivots
+int factor_levelset_cuda(int *d_csrRowPtr,
+                         int *d_csrColIdx,
+                         VALUE_TYPE *d_csrVal,
+                         int m,
+                         int factor)
+{
+    int *d_breakdown;
+    cudaMalloc((void **)&d_breakdown, sizeof(int));
+    cudaMemset(d_breakdown, 0, sizeof(int));
+    int *d_diag;
+    cudaMalloc((void **)&d_diag, m * sizeof(int));
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)m / (double)num_threads);
+    factor_diag_ptr_cuda<<<num_blocks, num_threads>>>(d_csrRowPtr, d_csrColIdx, d_diag, m, d_breakdown);
+    int breakdown = 0;
+    cudaMemcpy(&breakdown, d_breakdown, sizeof(int), cudaMemcpyDeviceToHost);
+    if (breakdown)
+    {
+        printf("factor: %d rows without a diagonal entry, not factored\n", breakdown);
+        cudaFree(d_breakdown);
+        cudaFree(d_diag);
+        return breakdown;
+    }
+
+    // level sets of the lower triangle, from its pattern only
+    int *d_csrRowPtrL;
+    int *d_csrColIdxL;
+    VALUE_TYPE *d_csrValL;
+    int nnzL;
+    factor_split_cuda(d_csrRowPtr, d_csrColIdx, d_csrVal, m, 0, &d_csrRowPtrL, &d_csrColIdxL, &d_csrValL, &nnzL,
+                      NULL, NULL, NULL, NULL);
+    int *d_cscColPtrL;
+    int *d_cscRowIdxL;
+    VALUE_TYPE *d_cscValL;
+    cudaMalloc((void **)&d_cscColPtrL, (m + 1) * sizeof(int));
+    cudaMalloc((void **)&d_cscRowIdxL, nnzL * sizeof(int));
+    cudaMalloc((void **)&d_cscValL, nnzL * sizeof(VALUE_TYPE));
+    matrix_transposition_cuda(m, m, nnzL, d_csrRowPtrL, d_csrColIdxL, d_csrValL, d_cscRowIdxL, d_cscColPtrL, d_cscValL);
+
+    int *d_nlv;
+    int *d_levelPtr;
+    int *d_levelItem;
+    cudaMalloc((void **)&d_nlv, sizeof(int));
+    cudaMalloc((void **)&d_levelPtr, (m + 1) * sizeof(int));
+    cudaMalloc((void **)&d_levelItem, m * sizeof(int));
+    findlevel_cuda(d_cscColPtrL, d_cscRowIdxL, d_csrRowPtrL, m, d_nlv, d_levelPtr, d_levelItem);
+    int nlv;
+    cudaMemcpy(&nlv, d_nlv, sizeof(int), cudaMemcpyDeviceToHost);
+    int *levelPtr = (int *)malloc((nlv + 1) * sizeof(int));
+    cudaMemcpy(levelPtr, d_levelPtr, (nlv + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+
+    for (int li = 0; li < nlv; li++)
+    {
+        num_blocks = ceil((double)(levelPtr[li + 1] - levelPtr[li]) / (double)num_threads);
+        if (factor == FACTOR_IC0)
+            ic0_level_csr_cuda<<<num_blocks, num_threads>>>(d_csrRowPtr, d_csrColIdx, d_csrVal, d_diag, d_levelItem,
+                                                            levelPtr[li], levelPtr[li + 1], d_breakdown);
+        else
+            ilu0_level_csr_cuda<<<num_blocks, num_threads>>>(d_csrRowPtr, d_csrColIdx, d_csrVal, d_diag, d_levelItem,
+                                                             levelPtr[li], levelPtr[li + 1], d_breakdown);
+    }
+    cudaMemcpy(&breakdown, d_breakdown, sizeof(int), cudaMemcpyDeviceToHost);
+    printf("factor: %d levels, %d pivot breakdowns\n", nlv, breakdown);
+
+    free(levelPtr);
+    cudaFree(d_nlv);
+    cudaFree(d_levelPtr);
+    cudaFree(d_levelItem);
+    cudaFree(d_csrRowPtrL);
+    cudaFree(d_csrColIdxL);
+    cudaFree(d_csrValL);
+    cudaFree(d_cscColPtrL);
+    cudaFree(d_cscRowIdxL);
+    cudaFree(d_cscValL);
+    cudaFree(d_diag);
+    cudaFree(d_breakdown);
+    return breakdown;
+}
+
+// ILU(0) or IC(0) of A straight into a fused L+U plan. A's values are overwritten by
+// the factors: ILU(0) keeps the strict lower part of L (unit diagonal implied) and U
+// in A's pattern, IC(0) keeps L in the lower triangle and leaves the upper one alone.
+// Returns the number of pivot breakdowns.
+int recblocking_factor_plan_create(RecBlockLUPlan *lu,
+                                   int *d_csrRowPtrA,
+                                   int *d_csrColIdxA,
+                                   VALUE_TYPE *d_csrValA,
+                                   int m,
+                                   int factor,
+                                   int lv,
+                                   int adaptive)
+{
+    int breakdown = factor_levelset_cuda(d_csrRowPtrA, d_csrColIdxA, d_csrValA, m, factor);
+
+    int *d_csrRowPtrL;
+    int *d_csrColIdxL;
+    VALUE_TYPE *d_csrValL;
+    int nnzL;
+    int *d_csrRowPtrU = NULL;
+    int *d_csrColIdxU = NULL;
+    VALUE_TYPE *d_csrValU = NULL;
+    int nnzU = 0;
+    if (factor == FACTOR_IC0)
+        factor_split_cuda(d_csrRowPtrA, d_csrColIdxA, d_csrValA, m, 0, &d_csrRowPtrL, &d_csrColIdxL, &d_csrValL, &nnzL,
+                          NULL, NULL, NULL, NULL);
+    else
+        factor_split_cuda(d_csrRowPtrA, d_csrColIdxA, d_csrValA, m, 1, &d_csrRowPtrL, &d_csrColIdxL, &d_csrValL, &nnzL,
+                          &d_csrRowPtrU, &d_csrColIdxU, &d_csrValU, &nnzU);
+
+    int *d_cscColPtrL;
+    int *d_cscRowIdxL;
+    VALUE_TYPE *d_cscValL;
+    cudaMalloc((void **)&d_cscColPtrL, (m + 1) * sizeof(int));
+    cudaMalloc((void **)&d_cscRowIdxL, nnzL * sizeof(int));
+    cudaMalloc((void **)&d_cscValL, nnzL * sizeof(VALUE_TYPE));
+    matrix_transposition_cuda(m, m, nnzL, d_csrRowPtrL, d_csrColIdxL, d_csrValL, d_cscRowIdxL, d_cscColPtrL, d_cscValL);
+
+    if (factor == FACTOR_IC0)
+    {
+        // U = L^T, solved by the transposed schedule of the L plan
+        recblocking_lu_plan_create_symmetric(lu, d_cscColPtrL, d_cscRowIdxL, d_cscValL, nnzL, m, lv, adaptive);
+    }
+    else
+    {
+        int *d_cscColPtrU;
+        int *d_cscRowIdxU;
+        VALUE_TYPE *d_cscValU;
+        cudaMalloc((void **)&d_cscColPtrU, (m + 1) * sizeof(int));
+        cudaMalloc((void **)&d_cscRowIdxU, nnzU * sizeof(int));
+        cudaMalloc((void **)&d_cscValU, nnzU * sizeof(VALUE_TYPE));
+        matrix_transposition_cuda(m, m, nnzU, d_csrRowPtrU, d_csrColIdxU, d_csrValU, d_cscRowIdxU, d_cscColPtrU, d_cscValU);
+        recblocking_lu_plan_create(lu, d_cscColPtrL, d_cscRowIdxL, d_cscValL, nnzL,
+                                   d_cscColPtrU, d_cscRowIdxU, d_cscValU, nnzU, m, lv, adaptive);
+        cudaFree(d_cscColPtrU);
+        cudaFree(d_cscRowIdxU);
+        cudaFree(d_cscValU);
+        cudaFree(d_csrRowPtrU);
+        cudaFree(d_csrColIdxU);
+        cudaFree(d_csrValU);
+    }
+
+    cudaFree(d_cscColPtrL);
+    cudaFree(d_cscRowIdxL);
+    cudaFree(d_cscValL);
+    cudaFree(d_csrRowPtrL);
+    cudaFree(d_csrColIdxL);
+    cudaFree(d_csrValL);
+    return breakdown;
+}
+
+#endif
@@ -0,0 +1,488 @@
+#ifndef __RECBLOCKING_KRYLOV__
+#define __RECBLOCKING_KRYLOV__
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/time.h>
+#include "common.h"
+#include "recblocking_plan.h"
+#include "utils_spmv_cuda.h"
+#include <cuda_runtime.h>
+#include <thrust/scan.h>
+#include <thrust/inner_product.h>
+#include <thrust/execution_policy.h>
+
+#define KRYLOV_NONE 0
+#define KRYLOV_PCG 1
+#define KRYLOV_BICGSTAB 2
+#define KRYLOV_GMRES 3
+
+#ifndef GMRES_RESTART
+#define GMRES_RESTART 30
+#endif
+
+// A permuted into the level order of the preconditioner's L plan, so that the
+// iteration never leaves that order; mv is one SpMV executor over the whole matrix
+typedef struct KrylovSystem
+{
+    int m;
+    int nnz;
+    int *d_csrRowPtr;
+    int *d_csrColIdx;
+    VALUE_TYPE *d_csrVal;
+    SpMV_block mv;
+} KrylovSystem;
+
+typedef struct KrylovStats
+{
+    int iter;
+    double relres;
+    double spmv_time; // ms over the whole solve
+    double precond_time;
+    double vector_time;
+} KrylovStats;
+
+__global__ void krylov_perm_rowlen_cuda(const int *d_csrRowPtr,
+                                        const int *d_levelItem,
+                                        int m,
+                                        int *d_csrRowPtr_perm)
+{
+    const int global_x_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id < m)
+    {
+        int row = d_levelItem[global_x_id];
+        d_csrRowPtr_perm[global_x_id] = d_csrRowPtr[row + 1] - d_csrRowPtr[row];
+    }
+}
+
+__global__ void krylov_perm_fill_cuda(const int *d_csrRowPtr,
+                                      const int *d_csrColIdx,
+                                      const VALUE_TYPE *d_csrVal,
+                                      const int *d_levelItem,
+                                      const int *d_levelItemInv,
+                                      int m,
+                                      const int *d_csrRowPtr_perm,
+                                      int *d_csrColIdx_perm,
+                                      VALUE_TYPE *d_csrVal_perm)
+{
+    const int global_x_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id < m)
+    {
+        int row = d_levelItem[global_x_id];
+        int pos = d_csrRowPtr_perm[global_x_id];
+        for (int j = d_csrRowPtr[row]; j < d_csrRowPtr[row + 1]; j++)
+        {
+            d_csrColIdx_perm[pos] = d_levelItemInv[d_csrColIdx[j]];
+            d_csrVal_perm[pos] = d_csrVal[j];
+            pos++;
+        }
+    }
+}
+
+// y = a * x + b * y
+__global__ void krylov_axpby_cuda(int n,
+                                  VALUE_TYPE a,
+                                  const VALUE_TYPE *x,
+                                  VALUE_TYPE b,
+                                  VALUE_TYPE *y)
+{
+    const int global_x_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id < n)
+        y[global_x_id] = a * x[global_x_id] + b * y[global_x_id];
+}
+
+void krylov_axpby(int n, VALUE_TYPE a, const VALUE_TYPE *x, VALUE_TYPE b, VALUE_TYPE *y)
+{
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)n / (double)num_threads);
+    krylov_axpby_cuda<<<num_blocks, num_threads>>>(n, a, x, b, y);
+}
+
+double krylov_dot(int n, const VALUE_TYPE *x, const VALUE_TYPE *y)
+{
+    return thrust::inner_product(thrust::device, x, x + n, y, 0.0);
+}
+
+// add the time since *t to *acc (after the device is idle) and restart *t
+void krylov_lap(struct timeval *t, double *acc)
+{
+    struct timeval now;
+    cudaDeviceSynchronize();
+    gettimeofday(&now, NULL);
+    *acc += (now.tv_sec - t->tv_sec) * 1000.0 + (now.tv_usec - t->tv_usec) / 1000.0;
+    *t = now;
+}
+
+void krylov_system_create(KrylovSystem *sys,
+                          RecBlockLUPlan *lu,
+                          int *d_csrRowPtrA,
+                          int *d_csrColIdxA,
+                          VALUE_TYPE *d_csrValA,
+                          int m,
+                          int nnzA)
+{
+    sys->m = m;
+    sys->nnz = nnzA;
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)m / (double)num_threads);
+
+    int *d_levelItemInv;
+    cudaMalloc((void **)&d_levelItemInv, m * sizeof(int));
+    levelset_inverse_perm_cuda<<<num_blocks, num_threads>>>(lu->L.d_levelItem, d_levelItemInv, m);
+
+    cudaMalloc((void **)&(sys->d_csrRowPtr), (m + 1) * sizeof(int));
+    cudaMalloc((void **)&(sys->d_csrColIdx), nnzA * sizeof(int));
+    cudaMalloc((void **)&(sys->d_csrVal), nnzA * sizeof(VALUE_TYPE));
+    cudaMemset(sys->d_csrRowPtr, 0, (m + 1) * sizeof(int));
+    krylov_perm_rowlen_cuda<<<num_blocks, num_threads>>>(d_csrRowPtrA, lu->L.d_levelItem, m, sys->d_csrRowPtr);
+    thrust::exclusive_scan(thrust::device, sys->d_csrRowPtr, sys->d_csrRowPtr + m + 1, sys->d_csrRowPtr, 0);
+    krylov_perm_fill_cuda<<<num_blocks, num_threads>>>(d_csrRowPtrA, d_csrColIdxA, d_csrValA, lu->L.d_levelItem, d_levelItemInv, m,
+                                                       sys->d_csrRowPtr, sys->d_csrColIdx, sys->d_csrVal);
+    cudaFree(d_levelItemInv);
+
+    // same executor choice as for the square blocks: long rows go to a separate warp pass
+    int *csrRowPtr = (int *)malloc((m + 1) * sizeof(int));
+    cudaMemcpy(csrRowPtr, sys->d_csrRowPtr, (m + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+    int *longrow_idx = (int *)malloc(m * sizeof(int));
+    int longrow = 0;
+    int lenmax = 0;
+    for (int i = 0; i < m; i++)
+    {
+        int len = csrRowPtr[i + 1] - csrRowPtr[i];
+        if (len > LONGROW_THRESHOLD)
+            longrow_idx[longrow++] = i;
+        if (len > lenmax)
+            lenmax = len;
+    }
+
+    SpMV_block *mv = &(sys->mv);
+    mv->m = m;
+    mv->num_threads = num_threads;
+    if (nnzA / m <= 12)
+    {
+        mv->method = 0;
+        mv->num_blocks = ceil((double)m / (double)num_threads);
+    }
+    else
+    {
+        mv->method = 2;
+        mv->num_blocks = ceil((double)m / (double)(num_threads / WARP_SIZE));
+    }
+    mv->longrow = longrow;
+    if (longrow != 0)
+    {
+        mv->num_threads_l = num_threads;
+        mv->num_blocks_l = ceil((double)lenmax / (double)num_threads);
+        mv->d_csrRowPtr_l = sys->d_csrRowPtr;
+        mv->d_csrColIdx_l = sys->d_csrColIdx;
+        mv->d_csrVal_l = sys->d_csrVal;
+        cudaMalloc((void **)&(mv->d_longrow_idx), longrow * sizeof(int));
+        cudaMemcpy(mv->d_longrow_idx, longrow_idx, longrow * sizeof(int), cudaMemcpyHostToDevice);
+    }
+    free(csrRowPtr);
+    free(longrow_idx);
+}
+
+// y = A x in the permuted order
+void krylov_spmv(KrylovSystem *sys,
+                 const VALUE_TYPE *d_x,
+                 VALUE_TYPE *d_y)
+{
+    SpMV_block *mv = &(sys->mv);
+    if (mv->method == 0)
+        spmv_threadsca_csr_cuda_executor<<<mv->num_blocks, mv->num_threads>>>(sys->d_csrRowPtr, sys->d_csrColIdx, sys->d_csrVal, sys->m, d_x, d_y);
+    else
+        spmv_warpvec_csr_cuda_executor<<<mv->num_blocks, mv->num_threads>>>(sys->d_csrRowPtr, sys->d_csrColIdx, sys->d_csrVal, sys->m, d_x, d_y);
+    if (mv->longrow != 0)
+        spmv_longrow_csr_cuda_executor<<<mv->num_blocks_l, mv->num_threads_l>>>(mv->d_csrRowPtr_l, mv->d_csrColIdx_l, mv->d_csrVal_l,
+                                                                                d_x, d_y, mv->longrow, mv->d_longrow_idx);
+}
+
+void krylov_system_destroy(KrylovSystem *sys)
+{
+    if (sys->mv.longrow != 0)
+        cudaFree(sys->mv.d_longrow_idx);
+    cudaFree(sys->d_csrRowPtr);
+    cudaFree(sys->d_csrColIdx);
+    cudaFree(sys->d_csrVal);
+}
+
+int krylov_pcg(RecBlockLUPlan *lu, KrylovSystem *sys, VALUE_TYPE *b, VALUE_TYPE *x,
+               double bnorm, int maxiter, double tol, KrylovStats *stats, struct timeval *t)
+{
+    int m = sys->m;
+    VALUE_TYPE *r, *z, *p, *q;
+    cudaMalloc((void **)&r, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&z, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&p, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&q, m * sizeof(VALUE_TYPE));
+
+    krylov_spmv(sys, x, r);
+    krylov_lap(t, &stats->spmv_time);
+    krylov_axpby(m, 1, b, -1, r);
+    double rnorm = sqrt(krylov_dot(m, r, r));
+    krylov_lap(t, &stats->vector_time);
+    recblocking_lu_plan_apply_permuted(lu, r, z);
+    krylov_lap(t, &stats->precond_time);
+    cudaMemcpy(p, z, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+    double rz = krylov_dot(m, r, z);
+    krylov_lap(t, &stats->vector_time);
+
+    int it = 0;
+    while (it < maxiter && rnorm / bnorm > tol)
+    {
+        krylov_spmv(sys, p, q);
+        krylov_lap(t, &stats->spmv_time);
+        double alpha = rz / krylov_dot(m, p, q);
+        krylov_axpby(m, alpha, p, 1, x);
+        krylov_axpby(m, -alpha, q, 1, r);
+        rnorm = sqrt(krylov_dot(m, r, r));
+        krylov_lap(t, &stats->vector_time);
+        it++;
+        if (rnorm / bnorm <= tol)
+            break;
+        recblocking_lu_plan_apply_permuted(lu, r, z);
+        krylov_lap(t, &stats->precond_time);
+        double rz_new = krylov_dot(m, r, z);
+        krylov_axpby(m, 1, z, rz_new / rz, p);
+        rz = rz_new;
+        krylov_lap(t, &stats->vector_time);
+    }
+    stats->relres = rnorm / bnorm;
+
+    cudaFree(r);
+    cudaFree(z);
+    cudaFree(p);
+    cudaFree(q);
+    return it;
+}
+
+int krylov_bicgstab(RecBlockLUPlan *lu, KrylovSystem *sys, VALUE_TYPE *b, VALUE_TYPE *x,
+                    double bnorm, int maxiter, double tol, KrylovStats *stats, struct timeval *t)
+{
+    int m = sys->m;
+    VALUE_TYPE *r, *rhat, *p, *v, *phat, *s, *shat, *tt;
+    cudaMalloc((void **)&r, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&rhat, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&p, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&v, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&phat, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&s, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&shat, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&tt, m * sizeof(VALUE_TYPE));
+
+    krylov_spmv(sys, x, r);
+    krylov_lap(t, &stats->spmv_time);
+    krylov_axpby(m, 1, b, -1, r);
+    cudaMemcpy(rhat, r, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+    cudaMemset(p, 0, m * sizeof(VALUE_TYPE));
+    cudaMemset(v, 0, m * sizeof(VALUE_TYPE));
+    double rnorm = sqrt(krylov_dot(m, r, r));
+    double rho = 1, alpha = 1, omega = 1;
+    krylov_lap(t, &stats->vector_time);
+
+    int it = 0;
+    while (it < maxiter && rnorm / bnorm > tol)
+    {
+        double rho_new = krylov_dot(m, rhat, r);
+        double beta = (rho_new / rho) * (alpha / omega);
+        rho = rho_new;
+        krylov_axpby(m, -omega, v, 1, p);
+        krylov_axpby(m, 1, r, beta, p);
+        krylov_lap(t, &stats->vector_time);
+        recblocking_lu_plan_apply_permuted(lu, p, phat);
+        krylov_lap(t, &stats->precond_time);
+        krylov_spmv(sys, phat, v);
+        krylov_lap(t, &stats->spmv_time);
+        alpha = rho / krylov_dot(m, rhat, v);
+        cudaMemcpy(s, r, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+        krylov_axpby(m, -alpha, v, 1, s);
+        double snorm = sqrt(krylov_dot(m, s, s));
+        krylov_lap(t, &stats->vector_time);
+        it++;
+        if (snorm / bnorm <= tol)
+        {
+            krylov_axpby(m, alpha, phat, 1, x);
+            rnorm = snorm;
+            krylov_lap(t, &stats->vector_time);
+            break;
+        }
+        recblocking_lu_plan_apply_permuted(lu, s, shat);
+        krylov_lap(t, &stats->precond_time);
+        krylov_spmv(sys, shat, tt);
+        krylov_lap(t, &stats->spmv_time);
+        omega = krylov_dot(m, tt, s) / krylov_dot(m, tt, tt);
+        krylov_axpby(m, alpha, phat, 1, x);
+        krylov_axpby(m, omega, shat, 1, x);
+        cudaMemcpy(r, s, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+        krylov_axpby(m, -omega, tt, 1, r);
+        rnorm = sqrt(krylov_dot(m, r, r));
+        krylov_lap(t, &stats->vector_time);
+    }
+    stats->relres = rnorm / bnorm;
+
+    cudaFree(r);
+    cudaFree(rhat);
+    cudaFree(p);
+    cudaFree(v);
+    cudaFree(phat);
+    cudaFree(s);
+    cudaFree(shat);
+    cudaFree(tt);
+    return it;
+}
+
+// right-preconditioned GMRES(GMRES_RESTART), modified Gram-Schmidt, Givens rotations on the host
+int krylov_gmres(RecBlockLUPlan *lu, KrylovSystem *sys, VALUE_TYPE *b, VALUE_TYPE *x,
+                 double bnorm, int maxiter, double tol, KrylovStats *stats, struct timeval *t)
+{
+    int m = sys->m;
+    int rs = GMRES_RESTART;
+    VALUE_TYPE *V, *w, *z;
+    cudaMalloc((void **)&V, (size_t)(rs + 1) * m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&w, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&z, m * sizeof(VALUE_TYPE));
+    double *H = (double *)malloc((rs + 1) * rs * sizeof(double));
+    double *cs = (double *)malloc(rs * sizeof(double));
+    double *sn = (double *)malloc(rs * sizeof(double));
+    double *g = (double *)malloc((rs + 1) * sizeof(double));
+    double *y = (double *)malloc(rs * sizeof(double));
+
+    double rnorm = bnorm;
+    int it = 0;
+    while (it < maxiter)
+    {
+        krylov_spmv(sys, x, V);
+        krylov_lap(t, &stats->spmv_time);
+        krylov_axpby(m, 1, b, -1, V);
+        rnorm = sqrt(krylov_dot(m, V, V));
+        krylov_lap(t, &stats->vector_time);
+        if (rnorm / bnorm <= tol)
+            break;
+        krylov_axpby(m, 0, V, 1.0 / rnorm, V);
+        for (int i = 0; i <= rs; i++)
+            g[i] = 0;
+        g[0] = rnorm;
+
+        int k = 0;
+        while (k < rs && it < maxiter)
+        {
+            VALUE_TYPE *vk = V + (size_t)k * m;
+            VALUE_TYPE *vk1 = V + (size_t)(k + 1) * m;
+            recblocking_lu_plan_apply_permuted(lu, vk, z);
+            krylov_lap(t, &stats->precond_time);
+            krylov_spmv(sys, z, w);
+            krylov_lap(t, &stats->spmv_time);
+            for (int i = 0; i <= k; i++)
+            {
+                H[i * rs + k] = krylov_dot(m, w, V + (size_t)i * m);
+                krylov_axpby(m, -H[i * rs + k], V + (size_t)i * m, 1, w);
+            }
+            double h = sqrt(krylov_dot(m, w, w));
+            H[(k + 1) * rs + k] = h;
+            cudaMemcpy(vk1, w, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+            if (h != 0)
+                krylov_axpby(m, 0, w, 1.0 / h, vk1);
+
+            for (int i = 0; i < k; i++)
+            {
+                double a = H[i * rs + k];
+                double c = H[(i + 1) * rs + k];
+                H[i * rs + k] = cs[i] * a + sn[i] * c;
+                H[(i + 1) * rs + k] = -sn[i] * a + cs[i] * c;
+            }
+            double a = H[k * rs + k];
+            double c = H[(k + 1) * rs + k];
+            double d = sqrt(a * a + c * c);
+            cs[k] = a / d;
+            sn[k] = c / d;
+            H[k * rs + k] = d;
+            H[(k + 1) * rs + k] = 0;
+            g[k + 1] = -sn[k] * g[k];
+            g[k] = cs[k] * g[k];
+            rnorm = fabs(g[k + 1]);
+            krylov_lap(t, &stats->vector_time);
+            k++;
+            it++;
+            if (rnorm / bnorm <= tol)
+                break;
+        }
+
+        // x += M^-1 (V y), with H y = g
+        for (int i = k - 1; i >= 0; i--)
+        {
+            y[i] = g[i];
+            for (int j = i + 1; j < k; j++)
+                y[i] -= H[i * rs + j] * y[j];
+            y[i] /= H[i * rs + i];
+        }
+        cudaMemset(w, 0, m * sizeof(VALUE_TYPE));
+        for (int i = 0; i < k; i++)
+            krylov_axpby(m, y[i], V + (size_t)i * m, 1, w);
+        krylov_lap(t, &stats->vector_time);
+        recblocking_lu_plan_apply_permuted(lu, w, z);
+        krylov_lap(t, &stats->precond_time);
+        krylov_axpby(m, 1, z, 1, x);
+        krylov_lap(t, &stats->vector_time);
+        if (rnorm / bnorm <= tol)
+            break;
+    }
+    stats->relres = rnorm / bnorm;
+
+    cudaFree(V);
+    cudaFree(w);
+    cudaFree(z);
+    free(H);
+    free(cs);
+    free(sn);
+    free(g);
+    free(y);
+    return it;
+}
+
+// solve A x = b preconditioned by the factors in lu; b and x are in the original
+// order, x holds the initial guess on entry. Vectors are permuted into the level
+// order of the L plan once and stay there for the whole iteration.
+int krylov_solve(int method,
+                 RecBlockLUPlan *lu,
+                 KrylovSystem *sys,
+                 VALUE_TYPE *d_b,
+                 VALUE_TYPE *d_x,
+                 int maxiter,
+                 double tol,
+                 KrylovStats *stats)
+{
+    int m = sys->m;
+    stats->spmv_time = 0;
+    stats->precond_time = 0;
+    stats->vector_time = 0;
+
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    VALUE_TYPE *b_perm, *x_perm;
+    cudaMalloc((void **)&b_perm, m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&x_perm, m * sizeof(VALUE_TYPE));
+    recblocking_plan_permute(&(lu->L), d_b, b_perm);
+    recblocking_plan_permute(&(lu->L), d_x, x_perm);
+    double bnorm = sqrt(krylov_dot(m, b_perm, b_perm));
+    if (bnorm == 0)
+        bnorm = 1;
+    krylov_lap(&t, &stats->vector_time);
+
+    int it;
+    if (method == KRYLOV_PCG)
+        it = krylov_pcg(lu, sys, b_perm, x_perm, bnorm, maxiter, tol, stats, &t);
+    else if (method == KRYLOV_BICGSTAB)
+        it = krylov_bicgstab(lu, sys, b_perm, x_perm, bnorm, maxiter, tol, stats, &t);
+    else
+        it = krylov_gmres(lu, sys, b_perm, x_perm, bnorm, maxiter, tol, stats, &t);
+
+    recblocking_plan_unpermute(&(lu->L), x_perm, d_x);
+    krylov_lap(&t, &stats->vector_time);
+    cudaFree(b_perm);
+    cudaFree(x_perm);
+    stats->iter = it;
+    return it;
+}
+
+#endif
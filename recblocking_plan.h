@@ -0,0 +1,1417 @@
+#ifndef __RECBLOCKING_PLAN__
+#define __RECBLOCKING_PLAN__
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "common.h"
+#include "recblocking_preprocess.h"
+#include "recblocking_calculate.h"
+#include "utils_spmv_cuda.h"
+#include "utils_sptrsv_cuda.h"
+#include "tranpose.h"
+#include "utils_reordering.h"
+#include "findlevel.h"
+#include "utils.h"
+#include <cuda_runtime.h>
+#include <thrust/sort.h>
+#include <thrust/scan.h>
+#include <thrust/unique.h>
+#include <thrust/binary_search.h>
+#include <thrust/execution_policy.h>
+#include "utils_cuda.h"
+#include "utils_sptrsv_sparse_cuda.h"
+
+// an update of b touching more than m / INCREMENTAL_REACH_RATIO rows of x is
+// cheaper to redo as a full solve of the plan
+#ifndef INCREMENTAL_REACH_RATIO
+#define INCREMENTAL_REACH_RATIO 8
+#endif
+
+// everything a triangular solve needs after preprocessing: the recursive blocks,
+// their executors and the level-set permutation; vectors are kept in permuted
+// order inside the plan and only gathered/scattered at its boundary
+typedef struct RecBlockPlan
+{
+    int m;
+    int n;
+    int substitution;
+    int sum_block;
+    int tri_block;
+    int squ_block;
+    SpTRSV_block *trsv_blk;
+    SpMV_block *mv_blk;
+    int *blk_m;
+    int *blk_n;
+    int *blk_nnz;
+    int *loc_off;
+    int *tmp_off;
+    int *d_recblock_Ptr;
+    int *d_recblock_Index;
+    unsigned short *d_recblock_Index16; // narrow square blocks, whose 32-bit range is dropped from d_recblock_Index
+    unsigned char *d_recblock_Code;     // value codes and tables of the square blocks with few values
+    VALUE_TYPE *d_recblock_Dict;
+    int *d_recblock_dcsr_rowidx;
+    double *d_recblock_Val;
+    int *ptr_offset;
+    int *index_offset;       // block ranges of the full arenas, as the transposed schedule reads them
+    int *sched_index_offset; // block ranges of d_recblock_Index and d_recblock_Val as the schedule
+    int *sched_val_offset;   // reads them, empty where a block has other storage
+    int *recblock_Index_h;   // the full arenas, kept on the host while the device ones are compacted
+    double *recblock_Val_h;
+    int *dcsrindex_offset;
+    int *d_levelItem; // row i of the permuted system is row d_levelItem[i] of the input
+    VALUE_TYPE *d_b_perm;
+    VALUE_TYPE *d_x_perm;
+    VALUE_TYPE *bound_b; // permuted vectors the schedule (and graph) currently work on
+    VALUE_TYPE *bound_x;
+    int inplace;         // the schedule may run with x aliasing b
+    int trans_ready;     // the counters of the transposed schedule are allocated
+    VALUE_TYPE *bound_b_trans; // and the vectors it currently works on
+    VALUE_TYPE *bound_x_trans;
+    cudaStream_t stream;
+#if USE_CUDA_GRAPH
+    cudaGraph_t graph;
+    cudaGraphExec_t graph_exec;
+    cudaGraph_t graph_trans;
+    cudaGraphExec_t graph_exec_trans;
+#endif
+} RecBlockPlan;
+
+// U \ (L \ b) with the intermediate vector passed from one plan to the other
+// in permuted order through a single composed gather
+typedef struct RecBlockLUPlan
+{
+    RecBlockPlan L;
+    RecBlockPlan U;
+    int *d_perm_LU; // row i of the permuted U system is row d_perm_LU[i] of the permuted L system
+    int *d_perm_UL; // row i of the permuted L system is row d_perm_UL[i] of the permuted U system
+    int symmetric;  // U = L^T: U is not built and the transposed schedule of L is run instead
+} RecBlockLUPlan;
+
+// enqueue the block schedule of a plan on permuted vectors b_t (consumed) and x_t
+void recblocking_plan_schedule(RecBlockPlan *plan,
+                               VALUE_TYPE *b_t,
+                               VALUE_TYPE *x_t,
+                               cudaStream_t stream)
+{
+    if (plan->substitution == SUBSTITUTION_FORWARD)
+        L_schedule(plan->mv_blk, plan->trsv_blk, plan->sum_block, plan->blk_m, plan->blk_n, plan->loc_off, plan->tmp_off, plan->m, x_t, b_t,
+                   plan->d_recblock_Ptr, plan->d_recblock_Index, plan->d_recblock_dcsr_rowidx, plan->d_recblock_Val, plan->ptr_offset, plan->sched_index_offset, plan->sched_val_offset, plan->dcsrindex_offset, stream);
+    else
+        U_schedule(plan->mv_blk, plan->trsv_blk, plan->sum_block, plan->blk_m, plan->blk_n, plan->loc_off, plan->tmp_off, plan->m, x_t, b_t,
+                   plan->d_recblock_Ptr, plan->d_recblock_Index, plan->d_recblock_dcsr_rowidx, plan->d_recblock_Val, plan->ptr_offset, plan->sched_index_offset, plan->sched_val_offset, plan->dcsrindex_offset, stream);
+}
+
+// point the schedule at another pair of permuted vectors; with graphs this
+// re-captures, so callers should keep reusing the same vectors across solves
+void recblocking_plan_bind(RecBlockPlan *plan,
+                           VALUE_TYPE *b_t,
+                           VALUE_TYPE *x_t)
+{
+    if (plan->bound_b == b_t && plan->bound_x == x_t)
+        return;
+    plan->bound_b = b_t;
+    plan->bound_x = x_t;
+#if USE_CUDA_GRAPH
+    if (plan->graph_exec != NULL)
+    {
+        cudaGraphExecDestroy(plan->graph_exec);
+        cudaGraphDestroy(plan->graph);
+    }
+    cudaStreamBeginCapture(plan->stream, cudaStreamCaptureModeGlobal);
+    recblocking_plan_schedule(plan, b_t, x_t, plan->stream);
+    cudaStreamEndCapture(plan->stream, &(plan->graph));
+    cudaGraphInstantiate(&(plan->graph_exec), plan->graph, NULL, NULL, 0);
+#endif
+}
+
+// enqueue the block schedule of a plan on the vectors it is bound to
+void recblocking_plan_execute(RecBlockPlan *plan,
+                              cudaStream_t stream)
+{
+#if USE_CUDA_GRAPH
+    cudaGraphLaunch(plan->graph_exec, stream);
+#else
+    recblocking_plan_schedule(plan, plan->bound_b, plan->bound_x, stream);
+#endif
+}
+
+// how many entries of block i the schedule reads from d_recblock_Index and d_recblock_Val
+void recblocking_block_arena_use(const RecBlockPlan *plan,
+                                 const int i,
+                                 int *use_index,
+                                 int *use_val)
+{
+    int nnz_i = plan->index_offset[i + 1] - plan->index_offset[i];
+    *use_index = nnz_i;
+    *use_val = nnz_i;
+    if (i % 2 == 0 && plan->trsv_blk[i / 2].method == 5)
+    {
+        *use_index = 0;
+        *use_val = 0;
+    }
+    if (i % 2)
+    {
+        const SpMV_block *blk = &(plan->mv_blk[i / 2]);
+        if (blk->d_csrColIdx16 != NULL)
+            *use_index = 0;
+        if (blk->d_csrCode != NULL || blk->constant)
+            *use_val = 0;
+        if (blk->bsr_dim || blk->d_sell_ptr != NULL)
+        {
+            *use_index = 0;
+            *use_val = 0;
+        }
+    }
+}
+
+// shrink the device arenas to what the schedule reads; the full ones wait on the host
+// until recblocking_plan_prepare_transposed needs them
+void recblocking_plan_compact(RecBlockPlan *plan)
+{
+    int sum_block = plan->sum_block;
+    int nnz = plan->index_offset[sum_block];
+    plan->sched_index_offset = (int *)malloc(sizeof(int) * (sum_block + 1));
+    plan->sched_val_offset = (int *)malloc(sizeof(int) * (sum_block + 1));
+    plan->recblock_Index_h = NULL;
+    plan->recblock_Val_h = NULL;
+    plan->sched_index_offset[0] = 0;
+    plan->sched_val_offset[0] = 0;
+    for (int i = 0; i < sum_block; i++)
+    {
+        int use_index, use_val;
+        recblocking_block_arena_use(plan, i, &use_index, &use_val);
+        plan->sched_index_offset[i + 1] = plan->sched_index_offset[i] + use_index;
+        plan->sched_val_offset[i + 1] = plan->sched_val_offset[i] + use_val;
+    }
+    int index_size = plan->sched_index_offset[sum_block];
+    int val_size = plan->sched_val_offset[sum_block];
+    if (index_size == nnz && val_size == nnz)
+        return;
+
+    plan->recblock_Index_h = (int *)malloc(sizeof(int) * nnz);
+    plan->recblock_Val_h = (double *)malloc(sizeof(double) * nnz);
+    cudaMemcpy(plan->recblock_Index_h, plan->d_recblock_Index, sizeof(int) * nnz, cudaMemcpyDeviceToHost);
+    cudaMemcpy(plan->recblock_Val_h, plan->d_recblock_Val, sizeof(double) * nnz, cudaMemcpyDeviceToHost);
+    int *d_index = NULL;
+    double *d_val = NULL;
+    if (index_size)
+        cudaMalloc((void **)&d_index, sizeof(int) * index_size);
+    if (val_size)
+        cudaMalloc((void **)&d_val, sizeof(double) * val_size);
+    for (int i = 0; i < sum_block; i++)
+    {
+        int len = plan->sched_index_offset[i + 1] - plan->sched_index_offset[i];
+        if (len)
+            cudaMemcpy(d_index + plan->sched_index_offset[i], plan->d_recblock_Index + plan->index_offset[i], sizeof(int) * len, cudaMemcpyDeviceToDevice);
+        len = plan->sched_val_offset[i + 1] - plan->sched_val_offset[i];
+        if (len)
+            cudaMemcpy(d_val + plan->sched_val_offset[i], plan->d_recblock_Val + plan->index_offset[i], sizeof(double) * len, cudaMemcpyDeviceToDevice);
+    }
+    cudaFree(plan->d_recblock_Index);
+    cudaFree(plan->d_recblock_Val);
+    plan->d_recblock_Index = d_index;
+    plan->d_recblock_Val = d_val;
+}
+
+void recblocking_plan_create(RecBlockPlan *plan,
+                             int *d_cscColPtrTR,
+                             int *d_cscRowIdxTR,
+                             VALUE_TYPE *d_cscValTR,
+                             int m,
+                             int n,
+                             int nnzTR,
+                             int substitution,
+                             int lv,
+                             int adaptive)
+{
+    int tri_block = pow(2, lv);
+    int squ_block = tri_block - 1;
+    int sum_block = tri_block + squ_block;
+
+    SpTRSV_block *trsv_blk = (SpTRSV_block *)malloc(sizeof(SpTRSV_block) * tri_block);
+    SpMV_block *mv_blk = (SpMV_block *)malloc(sizeof(SpMV_block) * squ_block);
+    for (int i = 0; i < tri_block; i++)
+    {
+        trsv_blk[i].method = -1;
+        trsv_blk[i].d_dense = NULL;
+        trsv_blk[i].super = NULL;
+        trsv_blk[i].d_inv_ptr = NULL;
+    }
+    for (int i = 0; i < squ_block; i++)
+    {
+        mv_blk[i].method = -1;
+        mv_blk[i].d_csrColIdx16 = NULL;
+        mv_blk[i].d_csrCode = NULL;
+        mv_blk[i].d_dict = NULL;
+        mv_blk[i].constant = 0;
+        mv_blk[i].d_sell_ptr = NULL;
+        mv_blk[i].bsr_dim = 0;
+        mv_blk[i].merge_nnz = 0;
+    }
+
+    int *blk_m = (int *)malloc(sizeof(int) * (squ_block + tri_block));
+    int *blk_n = (int *)malloc(sizeof(int) * (squ_block + tri_block));
+
+    int *blk_nnz = (int *)malloc(sizeof(int) * (squ_block + tri_block));
+    int *d_blk_nnz;
+    cudaMalloc((void **)&d_blk_nnz, sizeof(int) * (squ_block + tri_block));
+    cudaMemset(d_blk_nnz, 0, sizeof(int) * (squ_block + tri_block));
+
+    int *loc_off = (int *)malloc(sizeof(int) * (squ_block + tri_block));
+    memset(loc_off, 0, sizeof(int) * (squ_block + tri_block));
+    int *tmp_off = (int *)malloc(sizeof(int) * (squ_block + tri_block));
+    memset(tmp_off, 0, sizeof(int) * (squ_block + tri_block));
+    int *subtri_upbound = (int *)malloc(sizeof(int) * sum_block);
+    int *subtri_downbound = (int *)malloc(sizeof(int) * sum_block);
+    int *subrec_upbound = (int *)malloc(sizeof(int) * sum_block);
+    int *subrec_downbound = (int *)malloc(sizeof(int) * sum_block);
+    int *subrec_rightbound = (int *)malloc(sizeof(int) * sum_block);
+    int *subrec_leftbound = (int *)malloc(sizeof(int) * sum_block);
+
+    int *d_recblock_Ptr;
+    int *d_recblock_Index;
+    int *d_recblock_dcsr_rowidx;
+    double *d_recblock_Val;
+    int *ptr_offset;
+    int *index_offset;
+    int *dcsrindex_offset;
+    int ptr_size = 1;
+    int idx_size = 0;
+    int dcsr_size = 0;
+
+    int *d_cscColPtrTR_new;
+    int *d_cscRowIdxTR_new;
+    VALUE_TYPE *d_cscValTR_new;
+    cudaMalloc((void **)&d_cscColPtrTR_new, (n + 1) * sizeof(int));
+    cudaMalloc((void **)&d_cscRowIdxTR_new, nnzTR * sizeof(int));
+    cudaMalloc((void **)&d_cscValTR_new, nnzTR * sizeof(VALUE_TYPE));
+
+    // ----------------levelset_reordering_colrow_csc-----------------
+    int *d_levelItem;
+    cudaMalloc((void **)&d_levelItem, m * sizeof(int));
+    levelset_reordering_colrow_csc_cuda(d_cscColPtrTR, d_cscRowIdxTR, d_cscValTR,
+                                        d_cscColPtrTR_new, d_cscRowIdxTR_new, d_cscValTR_new,
+                                        d_levelItem, m, n, nnzTR, substitution);
+
+    // ---------------------reorder end----------------------
+    if (adaptive)
+    {
+        // the split decisions need findlevel of every candidate triangle, run them on the host
+        int *cscColPtrTR_new = (int *)malloc((n + 1) * sizeof(int));
+        int *cscRowIdxTR_new = (int *)malloc(nnzTR * sizeof(int));
+        cudaMemcpy(cscColPtrTR_new, d_cscColPtrTR_new, (n + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+        cudaMemcpy(cscRowIdxTR_new, d_cscRowIdxTR_new, nnzTR * sizeof(int), cudaMemcpyDeviceToHost);
+        sum_block = mat_preprocessing_adaptive(cscColPtrTR_new, cscRowIdxTR_new, m, lv, loc_off, tmp_off,
+                                               blk_m, blk_n, blk_nnz, subtri_upbound, subtri_downbound, subrec_upbound,
+                                               subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
+        free(cscColPtrTR_new);
+        free(cscRowIdxTR_new);
+    }
+    else
+    {
+        mat_preprocessing_cuda(d_cscColPtrTR_new, d_cscRowIdxTR_new, d_cscValTR_new, m, n,
+                               lv, loc_off, tmp_off, blk_m, blk_n, d_blk_nnz, subtri_upbound,
+                               subtri_downbound, subrec_upbound, subrec_downbound, subrec_rightbound,
+                               subrec_leftbound, substitution);
+        cudaMemcpy(blk_nnz, d_blk_nnz, sizeof(int) * (squ_block + tri_block), cudaMemcpyDeviceToHost);
+    }
+
+    for (int i = 0; i < sum_block; i++)
+    {
+        if (i % 2 == 0)
+        {
+            ptr_size += blk_n[i];
+            idx_size += blk_nnz[i];
+            ptr_size += 1;
+        }
+        else
+        {
+            ptr_size += blk_m[i];
+            idx_size += blk_nnz[i];
+            dcsr_size += blk_m[i];
+        }
+    }
+    // ---------------------get_recblock_size end--------------------------
+
+    cudaMalloc((void **)&d_recblock_Ptr, ptr_size * sizeof(int));
+    cudaMemset(d_recblock_Ptr, 0, sizeof(int));
+    cudaMalloc((void **)&d_recblock_Index, idx_size * sizeof(int));
+    cudaMalloc((void **)&d_recblock_dcsr_rowidx, dcsr_size * sizeof(int));
+    cudaMalloc((void **)&d_recblock_Val, idx_size * sizeof(double));
+    ptr_offset = (int *)malloc(sizeof(int) * (sum_block + 1));
+    index_offset = (int *)malloc(sizeof(int) * (sum_block + 1));
+    dcsrindex_offset = (int *)malloc(sizeof(int) * (sum_block + 1));
+    dcsrindex_offset[0] = 0;
+    ptr_offset[0] = 1;
+    index_offset[0] = 0;
+
+    int blk_count = 0;
+    // store sub-matrix into device
+    int trsv_count = 0;
+    int mv_count = 0;
+    int recblock_nnz_ptr = 0;
+    for (blk_count = 0; blk_count < sum_block; blk_count++)
+    {
+        if (blk_count % 2 == 0)
+        {
+            int cu_flag = 0;
+            int *d_cscColPtrTR_sub;
+            int *d_cscRowIdxTR_sub;
+            VALUE_TYPE *d_cscValTR_sub;
+            cudaMalloc((void **)&d_cscColPtrTR_sub, sizeof(int) * (blk_n[blk_count] + 1));
+            cudaMalloc((void **)&d_cscRowIdxTR_sub, sizeof(int) * blk_nnz[blk_count]);
+            cudaMalloc((void **)&d_cscValTR_sub, sizeof(VALUE_TYPE) * blk_nnz[blk_count]);
+
+            int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+            int num_blocks = ceil((double)(blk_m[blk_count]) / (double)num_threads);
+            int upbound = subtri_upbound[blk_count];
+            int downbound = subtri_downbound[blk_count];
+            store_into_subtrimat_ptr<<<num_blocks, num_threads>>>(upbound, downbound, d_cscColPtrTR_new,
+                                                                  d_cscRowIdxTR_new, d_cscColPtrTR_sub, substitution);
+            thrust::exclusive_scan(thrust::device, d_cscColPtrTR_sub,
+                                   d_cscColPtrTR_sub + blk_n[blk_count] + 1, d_cscColPtrTR_sub, 0);
+            store_into_subtrimat_idxval<<<num_blocks, num_threads>>>(upbound, downbound, d_cscColPtrTR_new, d_cscRowIdxTR_new,
+                                                                     d_cscValTR_new, d_cscColPtrTR_sub, d_cscRowIdxTR_sub,
+                                                                     d_cscValTR_sub, substitution);
+
+            int *d_csrRowPtrTR_sub;
+            int *d_csrColIdxTR_sub;
+            VALUE_TYPE *d_csrValTR_sub;
+            cudaMalloc((void **)&d_csrRowPtrTR_sub, sizeof(int) * (blk_m[blk_count] + 1));
+            cudaMalloc((void **)&d_csrColIdxTR_sub, sizeof(int) * blk_nnz[blk_count]);
+            cudaMalloc((void **)&d_csrValTR_sub, sizeof(VALUE_TYPE) * blk_nnz[blk_count]);
+
+            // -------------------matrix_transposition-------------------
+            matrix_transposition_cuda(blk_n[blk_count], blk_m[blk_count], blk_nnz[blk_count],
+                                      d_cscColPtrTR_sub, d_cscRowIdxTR_sub, d_cscValTR_sub,
+                                      d_csrColIdxTR_sub, d_csrRowPtrTR_sub, d_csrValTR_sub);
+            // ----------------------------------------------------------
+            int fasttrack = blk_m[blk_count] == blk_nnz[blk_count] ? 1 : 0;
+            int nlv = 1;
+            int fastpath = 0;
+            int *levelPtr_local = NULL;
+            int *levelItem_local = NULL;
+            int *d_levelPtr_local = NULL;
+            int *d_levelItem_local = NULL;
+            if (!fasttrack)
+            {
+                // the levels are found on the host copy that the inverse, dense and supernodal
+                // paths need anyway, so a triangle they take skips the sparse analysis
+                int *cscColPtrTR_sub = (int *)malloc((blk_n[blk_count] + 1) * sizeof(int));
+                int *cscRowIdxTR_sub = (int *)malloc(blk_nnz[blk_count] * sizeof(int));
+                int *csrRowPtrTR_sub = (int *)malloc((blk_m[blk_count] + 1) * sizeof(int));
+                cudaMemcpy(cscColPtrTR_sub, d_cscColPtrTR_sub, (blk_n[blk_count] + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+                cudaMemcpy(cscRowIdxTR_sub, d_cscRowIdxTR_sub, blk_nnz[blk_count] * sizeof(int), cudaMemcpyDeviceToHost);
+                cudaMemcpy(csrRowPtrTR_sub, d_csrRowPtrTR_sub, (blk_m[blk_count] + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+                levelPtr_local = (int *)malloc((blk_m[blk_count] + 1) * sizeof(int));
+                levelItem_local = (int *)malloc(blk_m[blk_count] * sizeof(int));
+                findlevel(cscColPtrTR_sub, cscRowIdxTR_sub, csrRowPtrTR_sub, blk_m[blk_count],
+                          &nlv, levelPtr_local, levelItem_local);
+
+                // a long chain in a small triangle may become one SpMV with its inverse; otherwise
+                // dense enough triangles are packed, and the rest may still have supernodes
+                if (nlv <= 20000)
+                {
+                    VALUE_TYPE *cscValTR_sub = (VALUE_TYPE *)malloc(blk_nnz[blk_count] * sizeof(VALUE_TYPE));
+                    cudaMemcpy(cscValTR_sub, d_cscValTR_sub, blk_nnz[blk_count] * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+                    fastpath = (nlv >= INVERSE_MIN_LEVELS && sptrsv_inverse_create(&(trsv_blk[trsv_count]), cscColPtrTR_sub, cscRowIdxTR_sub, cscValTR_sub, blk_m[blk_count], substitution)) ||
+                               sptrsv_dense_create(&(trsv_blk[trsv_count]), d_csrRowPtrTR_sub, d_csrColIdxTR_sub, d_csrValTR_sub, blk_m[blk_count], blk_nnz[blk_count], substitution);
+                    if (!fastpath)
+                    {
+                        trsv_blk[trsv_count].super = sptrsv_supernodal_create(cscColPtrTR_sub, cscRowIdxTR_sub, cscValTR_sub, blk_m[blk_count], substitution);
+                        fastpath = trsv_blk[trsv_count].super != NULL;
+                    }
+                    free(cscValTR_sub);
+                }
+                free(cscColPtrTR_sub);
+                free(cscRowIdxTR_sub);
+                free(csrRowPtrTR_sub);
+
+                if (!fastpath)
+                {
+                    cudaMalloc((void **)&d_levelItem_local, blk_m[blk_count] * sizeof(int));
+                    cudaMalloc((void **)&d_levelPtr_local, (nlv + 1) * sizeof(int));
+                    cudaMemcpy(d_levelItem_local, levelItem_local, blk_m[blk_count] * sizeof(int), cudaMemcpyHostToDevice);
+                    cudaMemcpy(d_levelPtr_local, levelPtr_local, (nlv + 1) * sizeof(int), cudaMemcpyHostToDevice);
+                }
+            }
+
+            if (fasttrack)
+            {
+                int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                int num_blocks = ceil((double)blk_m[blk_count] / (double)num_threads);
+                ((trsv_blk[trsv_count])).method = 0;
+                (trsv_blk[trsv_count]).num_threads = num_threads;
+                (trsv_blk[trsv_count]).num_blocks = num_blocks;
+                (trsv_blk[trsv_count]).m = blk_m[blk_count];
+                (trsv_blk[trsv_count]).substitution = substitution;
+
+                num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                num_blocks = ceil((double)blk_n[blk_count] / (double)num_threads);
+                pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_cscColPtrTR_sub, d_recblock_Ptr + ptr_offset[blk_count] - 1);
+
+                thrust::exclusive_scan(thrust::device, d_recblock_Ptr + ptr_offset[blk_count] - 1,
+                                       d_recblock_Ptr + ptr_offset[blk_count] + blk_n[blk_count], d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+
+                store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_cscColPtrTR_sub, d_cscRowIdxTR_sub,
+                                                                   d_cscValTR_sub, d_recblock_Index, d_recblock_Val, d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+            }
+            else if (fastpath)
+            {
+                // no executor of its own: the CSR copy in the arena is read only by the
+                // transposed schedule, which gets its counters from recblocking_plan_prepare_transposed
+                (trsv_blk[trsv_count]).method = 5;
+                (trsv_blk[trsv_count]).m = blk_m[blk_count];
+                (trsv_blk[trsv_count]).substitution = substitution;
+
+                int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                int num_blocks = ceil((double)blk_m[blk_count] / (double)num_threads);
+                pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_csrRowPtrTR_sub, d_recblock_Ptr + ptr_offset[blk_count] - 1);
+
+                thrust::exclusive_scan(thrust::device, d_recblock_Ptr + ptr_offset[blk_count] - 1,
+                                       d_recblock_Ptr + ptr_offset[blk_count] + blk_n[blk_count], d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+
+                store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_csrRowPtrTR_sub, d_csrColIdxTR_sub,
+                                                                   d_csrValTR_sub, d_recblock_Index, d_recblock_Val, d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+            }
+            else
+            {
+                int nnzr = blk_nnz[blk_count] / blk_m[blk_count];
+                // coalescing runs of thin levels can bring a deep triangle under the launch limits
+                int ntask = nlv;
+                if (nlv > 20 && nlv <= 20000)
+                    ntask = levelset_coalesced_nlv(levelPtr_local, nlv);
+
+                if (nlv > 20000)
+                {
+                    cusparseStatus_t status;
+                    (trsv_blk[trsv_count]).handle = 0;
+                    status = cusparseCreate(&(trsv_blk[trsv_count].handle));
+                    // http://docs.nvidia.com/cuda/cusparse/#cusparse-lt-t-gt-csrsv2_solve
+                    // Suppose that L is m x m sparse matrix represented by CSR format,
+                    // L is lower triangular with unit diagonal.
+                    // Assumption:
+                    // - dimension of matrix L is m,
+                    // - matrix L has nnz number zero elements,
+                    // - handle is already created by cusparseCreate(),
+                    // - (d_csrRowPtr, d_csrColInd, d_csrVal) is CSR of L on device memory,
+                    // - d_b is right hand side vector on device memory,
+                    // - d_x is solution vector on device memory.
+                    (trsv_blk[trsv_count]).descr = 0;
+                    (trsv_blk[trsv_count]).info = 0;
+                    int pBufferSize;
+                    (trsv_blk[trsv_count]).pBuffer = 0;
+                    int structural_zero;
+                    int numerical_zero;
+                    (trsv_blk[trsv_count]).alpha_double = 1.;
+                    (trsv_blk[trsv_count]).alpha_float = 1.;
+                    (trsv_blk[trsv_count]).policy = CUSPARSE_SOLVE_POLICY_USE_LEVEL;
+                    (trsv_blk[trsv_count]).trans = CUSPARSE_OPERATION_NON_TRANSPOSE;
+
+                    // step 1: create a descriptor which contains
+                    // - matrix L is base-0
+                    // - matrix L is lower triangular
+                    // - matrix L has unit diagonal, specified by parameter CUSPARSE_DIAG_TYPE_UNIT
+                    //   (L may not have all diagonal elements.)
+                    cusparseCreateMatDescr(&(trsv_blk[trsv_count].descr));
+                    cusparseSetMatIndexBase((trsv_blk[trsv_count]).descr, CUSPARSE_INDEX_BASE_ZERO);
+
+                    if (substitution == SUBSTITUTION_FORWARD)
+                        cusparseSetMatFillMode((trsv_blk[trsv_count]).descr, CUSPARSE_FILL_MODE_LOWER);
+                    else if (substitution == SUBSTITUTION_BACKWARD)
+                        cusparseSetMatFillMode((trsv_blk[trsv_count]).descr, CUSPARSE_FILL_MODE_UPPER);
+
+                    cusparseSetMatDiagType((trsv_blk[trsv_count]).descr, CUSPARSE_DIAG_TYPE_UNIT);
+                    // step 2: create a empty info structure
+                    cusparseCreateCsrsv2Info(&(trsv_blk[trsv_count].info));
+
+                    // step 3: query how much memory used in csrsv2, and allocate the buffer
+                    if (sizeof(VALUE_TYPE) == 8)
+                        cusparseDcsrsv2_bufferSize((trsv_blk[trsv_count]).handle, (trsv_blk[trsv_count]).trans, blk_m[blk_count], blk_nnz[blk_count], (trsv_blk[trsv_count]).descr,
+                                                   (double *)d_csrValTR_sub, d_csrRowPtrTR_sub, d_csrColIdxTR_sub, (trsv_blk[trsv_count]).info, &pBufferSize);
+                    else if (sizeof(VALUE_TYPE) == 4)
+                        cusparseScsrsv2_bufferSize((trsv_blk[trsv_count]).handle, (trsv_blk[trsv_count]).trans, blk_m[blk_count], blk_nnz[blk_count], (trsv_blk[trsv_count]).descr,
+                                                   (float *)d_csrValTR_sub, d_csrRowPtrTR_sub, d_csrColIdxTR_sub, (trsv_blk[trsv_count]).info, &pBufferSize);
+                    // pBuffer returned by cudaMalloc is automatically aligned to 128 bytes.
+                    cudaMalloc((void **)&(trsv_blk[trsv_count].pBuffer), pBufferSize);
+                    if (sizeof(VALUE_TYPE) == 8)
+                        cusparseDcsrsv2_analysis((trsv_blk[trsv_count]).handle, (trsv_blk[trsv_count]).trans, blk_m[blk_count], blk_nnz[blk_count], (trsv_blk[trsv_count]).descr,
+                                                 (double *)d_csrValTR_sub, d_csrRowPtrTR_sub, d_csrColIdxTR_sub,
+                                                 (trsv_blk[trsv_count]).info, (trsv_blk[trsv_count]).policy, (trsv_blk[trsv_count]).pBuffer);
+                    else if (sizeof(VALUE_TYPE) == 4)
+                        cusparseScsrsv2_analysis((trsv_blk[trsv_count]).handle, (trsv_blk[trsv_count]).trans, blk_m[blk_count], blk_nnz[blk_count], (trsv_blk[trsv_count]).descr,
+                                                 (float *)d_csrValTR_sub, d_csrRowPtrTR_sub, d_csrColIdxTR_sub,
+                                                 (trsv_blk[trsv_count]).info, (trsv_blk[trsv_count]).policy, (trsv_blk[trsv_count]).pBuffer);
+
+                    // L has unit diagonal, so no structural zero is reported.
+                    status = cusparseXcsrsv2_zeroPivot((trsv_blk[trsv_count]).handle, (trsv_blk[trsv_count]).info, &structural_zero);
+                    if (CUSPARSE_STATUS_ZERO_PIVOT == status)
+                    {
+                        printf("L(%d,%d) is missing\n", structural_zero, structural_zero);
+                    }
+
+                    (trsv_blk[trsv_count]).method = 1;
+                    (trsv_blk[trsv_count]).m = blk_m[blk_count];
+                    (trsv_blk[trsv_count]).nnzTR = blk_nnz[blk_count];
+
+                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    int num_blocks = ceil((double)blk_m[blk_count] / (double)num_threads);
+                    pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_m[blk_count], d_csrRowPtrTR_sub, d_recblock_Ptr + ptr_offset[blk_count]);
+
+                    thrust::exclusive_scan(thrust::device, d_recblock_Ptr + ptr_offset[blk_count],
+                                           d_recblock_Ptr + ptr_offset[blk_count] + blk_m[blk_count] + 1, d_recblock_Ptr + ptr_offset[blk_count], 0);
+
+                    store_to_recblockdata<<<num_blocks, num_threads>>>(blk_m[blk_count], d_csrRowPtrTR_sub, d_csrColIdxTR_sub,
+                                                                       d_csrValTR_sub, d_recblock_Index, d_recblock_Val, d_recblock_Ptr + ptr_offset[blk_count], recblock_nnz_ptr);
+                    cu_flag = 1;
+                }
+                else if ((nnzr <= 15 && ntask <= 20) || (nnzr == 1 && ntask <= 100))
+                {
+                    (trsv_blk[trsv_count]).method = 2;
+                    (trsv_blk[trsv_count]).m = blk_m[blk_count];
+                    (trsv_blk[trsv_count]).substitution = substitution;
+                    (trsv_blk[trsv_count]).nlv = nlv;
+                    (trsv_blk[trsv_count]).nnz_lv_array = (int *)malloc(sizeof(int) * nlv);
+                    (trsv_blk[trsv_count]).m_lv_array = (int *)malloc(sizeof(int) * nlv);
+                    (trsv_blk[trsv_count]).offset_array = (int *)malloc(sizeof(int) * nlv);
+                    for (int li = 0; li < nlv; li++)
+                    {
+                        (trsv_blk[trsv_count]).m_lv_array[li] = levelPtr_local[li + 1] - levelPtr_local[li];
+                        (trsv_blk[trsv_count]).offset_array[li] = levelPtr_local[li];
+                    }
+
+                    int *d_nnz_lv_array;
+                    cudaMalloc((void **)&d_nnz_lv_array, (nlv + 1) * sizeof(int));
+                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    int num_blocks = ceil((double)nlv / (double)num_threads);
+                    find_level_nnz<<<num_blocks, num_threads>>>(d_csrRowPtrTR_sub, d_levelPtr_local, d_nnz_lv_array, nlv);
+
+                    cudaMemcpy((trsv_blk[trsv_count]).nnz_lv_array, d_nnz_lv_array, sizeof(int) * nlv, cudaMemcpyDeviceToHost);
+
+                    cudaFree(d_nnz_lv_array);
+                    levelset_coalesce(&(trsv_blk[trsv_count]));
+
+                    num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    num_blocks = ceil((double)blk_m[blk_count] / (double)num_threads);
+                    pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_csrRowPtrTR_sub, d_recblock_Ptr + ptr_offset[blk_count] - 1);
+
+                    thrust::exclusive_scan(thrust::device, d_recblock_Ptr + ptr_offset[blk_count] - 1,
+                                           d_recblock_Ptr + ptr_offset[blk_count] + blk_n[blk_count], d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+
+                    store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_csrRowPtrTR_sub, d_csrColIdxTR_sub,
+                                                                       d_csrValTR_sub, d_recblock_Index, d_recblock_Val, d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+                }
+                else if (nnzr <= 15 && nlv <= P2P_LEVEL_THRESHOLD)
+                {
+                    (trsv_blk[trsv_count]).method = 4;
+                    (trsv_blk[trsv_count]).m = blk_m[blk_count];
+                    (trsv_blk[trsv_count]).substitution = substitution;
+
+                    // the chunk dependency analysis runs on the host
+                    int *csrRowPtrTR_sub = (int *)malloc((blk_m[blk_count] + 1) * sizeof(int));
+                    int *csrColIdxTR_sub = (int *)malloc(blk_nnz[blk_count] * sizeof(int));
+                    cudaMemcpy(csrRowPtrTR_sub, d_csrRowPtrTR_sub, (blk_m[blk_count] + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+                    cudaMemcpy(csrColIdxTR_sub, d_csrColIdxTR_sub, blk_nnz[blk_count] * sizeof(int), cudaMemcpyDeviceToHost);
+                    sptrsv_p2p_analyser(csrRowPtrTR_sub, csrColIdxTR_sub, blk_m[blk_count], substitution, &(trsv_blk[trsv_count]));
+                    free(csrRowPtrTR_sub);
+                    free(csrColIdxTR_sub);
+
+                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    int num_blocks = ceil((double)blk_m[blk_count] / (double)num_threads);
+                    pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_csrRowPtrTR_sub, d_recblock_Ptr + ptr_offset[blk_count] - 1);
+
+                    thrust::exclusive_scan(thrust::device, d_recblock_Ptr + ptr_offset[blk_count] - 1,
+                                           d_recblock_Ptr + ptr_offset[blk_count] + blk_n[blk_count], d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+
+                    store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_csrRowPtrTR_sub, d_csrColIdxTR_sub,
+                                                                       d_csrValTR_sub, d_recblock_Index, d_recblock_Val, d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+                }
+                else
+                {
+                    cudaMalloc((void **)&(trsv_blk[trsv_count]).d_levelItem, blk_m[blk_count] * sizeof(int));
+                    cudaMemcpy((trsv_blk[trsv_count]).d_levelItem, d_levelItem_local, blk_m[blk_count] * sizeof(int), cudaMemcpyDeviceToDevice);
+
+                    cudaMalloc((void **)&(trsv_blk[trsv_count]).d_graphInDegree, blk_m[blk_count] * sizeof(int));
+                    cudaMemset((trsv_blk[trsv_count]).d_graphInDegree, 0, blk_m[blk_count] * sizeof(int));
+
+                    cudaMalloc((void **)&(trsv_blk[trsv_count]).d_id_extractor, sizeof(int));
+                    cudaMemset((trsv_blk[trsv_count]).d_id_extractor, 0, sizeof(int));
+
+                    int num_threads = 128;
+                    int num_blocks = ceil((double)blk_nnz[blk_count] / (double)num_threads);
+                    sptrsv_syncfree_csc_cuda_analyser<<<num_blocks, num_threads>>>(d_cscRowIdxTR_sub, blk_m[blk_count], blk_nnz[blk_count], (trsv_blk[trsv_count]).d_graphInDegree);
+                    cudaDeviceSynchronize();
+                    cudaMalloc((void **)&(trsv_blk[trsv_count]).d_left_sum, sizeof(VALUE_TYPE) * blk_m[blk_count]);
+                    cudaMemset((trsv_blk[trsv_count]).d_left_sum, 0, sizeof(VALUE_TYPE) * blk_m[blk_count]);
+
+                    num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    num_blocks = ceil((double)blk_m[blk_count] / (double)(num_threads / WARP_SIZE));
+                    (trsv_blk[trsv_count]).method = 3;
+                    (trsv_blk[trsv_count]).nnzTR = blk_nnz[blk_count];
+                    (trsv_blk[trsv_count]).num_threads = num_threads;
+                    (trsv_blk[trsv_count]).num_blocks = num_blocks;
+                    (trsv_blk[trsv_count]).m = blk_m[blk_count];
+                    (trsv_blk[trsv_count]).substitution = substitution;
+                    
+                    num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    num_blocks = ceil((double)blk_n[blk_count] / (double)num_threads);
+                    pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_cscColPtrTR_sub, d_recblock_Ptr + ptr_offset[blk_count] - 1);
+                    thrust::exclusive_scan(thrust::device, d_recblock_Ptr + ptr_offset[blk_count] - 1,
+                                           d_recblock_Ptr + ptr_offset[blk_count] + blk_n[blk_count], d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+                    store_to_recblockdata<<<num_blocks, num_threads>>>(blk_n[blk_count], d_cscColPtrTR_sub, d_cscRowIdxTR_sub,
+                                                                       d_cscValTR_sub, d_recblock_Index, d_recblock_Val, d_recblock_Ptr + ptr_offset[blk_count] - 1, recblock_nnz_ptr);
+                }
+            }
+
+            free(levelPtr_local);
+            free(levelItem_local);
+            cudaFree(d_levelPtr_local);
+            cudaFree(d_levelItem_local);
+
+            if (cu_flag == 0)
+                ptr_offset[blk_count + 1] = ptr_offset[blk_count] + blk_m[blk_count];
+            else
+                ptr_offset[blk_count + 1] = ptr_offset[blk_count] + blk_m[blk_count] + 1;
+            recblock_nnz_ptr += blk_nnz[blk_count];
+            index_offset[blk_count + 1] = recblock_nnz_ptr;
+            dcsrindex_offset[blk_count + 1] = dcsrindex_offset[blk_count];
+
+            cudaFree(d_csrRowPtrTR_sub);
+            cudaFree(d_csrValTR_sub);
+            cudaFree(d_csrColIdxTR_sub);
+            cudaFree(d_cscColPtrTR_sub);
+            cudaFree(d_cscRowIdxTR_sub);
+            cudaFree(d_cscValTR_sub);
+
+            trsv_count++;
+
+            cudaDeviceSynchronize();
+        }
+        else
+        {
+            int *d_cscColPtrTR_sub;
+            int *d_cscRowIdxTR_sub;
+            VALUE_TYPE *d_cscValTR_sub;
+            cudaMalloc((void **)&d_cscColPtrTR_sub, sizeof(int) * (blk_n[blk_count] + 1));
+            cudaMalloc((void **)&d_cscRowIdxTR_sub, sizeof(int) * blk_nnz[blk_count]);
+            cudaMalloc((void **)&d_cscValTR_sub, sizeof(VALUE_TYPE) * blk_nnz[blk_count]);
+
+            int *d_csrRowPtrTR_sub;
+            int *d_csrColIdxTR_sub;
+            VALUE_TYPE *d_csrValTR_sub;
+            cudaMalloc((void **)&d_csrRowPtrTR_sub, sizeof(int) * (blk_m[blk_count] + 1));
+            cudaMalloc((void **)&d_csrColIdxTR_sub, sizeof(int) * blk_nnz[blk_count]);
+            cudaMalloc((void **)&d_csrValTR_sub, sizeof(VALUE_TYPE) * blk_nnz[blk_count]);
+
+            int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+            int num_blocks = ceil((double)blk_m[blk_count] / (double)(num_threads));
+            int upbound = subrec_upbound[blk_count];
+            int downbound = subrec_downbound[blk_count];
+            int leftbound = subrec_leftbound[blk_count];
+            int rightbound = subrec_rightbound[blk_count];
+            store_into_subrecmat_ptr<<<num_blocks, num_threads>>>(upbound, downbound, leftbound, rightbound,
+                                                                  d_cscColPtrTR_new, d_cscRowIdxTR_new, d_cscColPtrTR_sub);
+
+            thrust::exclusive_scan(thrust::device, d_cscColPtrTR_sub,
+                                   d_cscColPtrTR_sub + blk_n[blk_count] + 1, d_cscColPtrTR_sub, 0);
+
+            store_into_subrecmat_idxval<<<num_blocks, num_threads>>>(upbound, downbound, leftbound, rightbound, d_cscColPtrTR_new, d_cscRowIdxTR_new,
+                                                                     d_cscValTR_new, d_cscColPtrTR_sub, d_cscRowIdxTR_sub, d_cscValTR_sub);
+
+            matrix_transposition_cuda(blk_n[blk_count], blk_m[blk_count], blk_nnz[blk_count],
+                                      d_cscColPtrTR_sub, d_cscRowIdxTR_sub, d_cscValTR_sub,
+                                      d_csrColIdxTR_sub, d_csrRowPtrTR_sub, d_csrValTR_sub);
+
+            int *idx_offset;
+            cudaMalloc((void **)(&idx_offset), sizeof(int) * (blk_m[blk_count] + 1));
+            num_threads = WARP_PER_BLOCK * WARP_SIZE;
+            num_blocks = ceil((double)blk_m[blk_count] / (double)num_threads);
+
+            pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_m[blk_count], d_csrRowPtrTR_sub, idx_offset);
+
+            thrust::exclusive_scan(thrust::device, idx_offset,
+                                   idx_offset + blk_m[blk_count] + 1, idx_offset, recblock_nnz_ptr);
+
+            store_to_recblockdata<<<num_blocks, num_threads>>>(blk_m[blk_count], d_csrRowPtrTR_sub, d_csrColIdxTR_sub,
+                                                               d_csrValTR_sub, d_recblock_Index, d_recblock_Val, idx_offset, recblock_nnz_ptr);
+            cudaFree(idx_offset);
+
+            int *d_i_new;
+            int *d_lenmax;
+            int *d_longrow;
+            int *d_longlen;
+            int *d_longrow_idx;
+            cudaMalloc((void **)(&d_i_new), sizeof(int));
+            cudaMalloc((void **)(&d_lenmax), sizeof(int));
+            cudaMalloc((void **)(&d_longrow), sizeof(int));
+            cudaMalloc((void **)(&d_longlen), sizeof(int));
+            cudaMalloc((void **)(&d_longrow_idx), blk_m[blk_count] * sizeof(int));
+
+            cal_longrow<<<1, 1>>>(d_i_new, d_lenmax, d_longrow, d_longlen,
+                                  d_longrow_idx, d_csrRowPtrTR_sub, blk_m[blk_count]);
+
+            int m_new;
+            cudaMemcpy(&m_new, d_i_new, sizeof(int), cudaMemcpyDeviceToHost);
+            m_new--;
+            int lenmax;
+            cudaMemcpy(&lenmax, d_lenmax, sizeof(int), cudaMemcpyDeviceToHost);
+            int longrow;
+            cudaMemcpy(&longrow, d_longrow, sizeof(int), cudaMemcpyDeviceToHost);
+            int longlen;
+            cudaMemcpy(&longlen, d_longlen, sizeof(int), cudaMemcpyDeviceToHost);
+            int nnzr = (blk_nnz[blk_count] - longlen) / m_new;
+            double empty_ratio = 100 * (double)(blk_m[blk_count] - m_new) / (double)blk_m[blk_count];
+            int dcsr_i = 0;
+            int real_i = 0;
+            if (blk_nnz[blk_count] != 0)
+            {
+                int m = blk_m[blk_count];
+                int nnz = blk_nnz[blk_count];
+                cudaMalloc((void **)&((mv_blk[mv_count]).d_y), m * sizeof(VALUE_TYPE));
+                cudaMemset((mv_blk[mv_count].d_y), 0, m * sizeof(VALUE_TYPE));
+                if (nnzr <= 12 && empty_ratio <= 50)
+                {
+                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    int num_blocks = ceil((double)m / (double)num_threads);
+                    (mv_blk[mv_count]).method = 0;
+                    (mv_blk[mv_count]).num_threads = num_threads;
+                    (mv_blk[mv_count]).num_blocks = num_blocks;
+                    (mv_blk[mv_count]).m = m;
+
+                    int init_val;
+                    cudaMemcpy(&init_val, d_recblock_Ptr + ptr_offset[blk_count] - 1, sizeof(int), cudaMemcpyDeviceToHost);
+
+                    pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_m[blk_count], d_csrRowPtrTR_sub, d_recblock_Ptr + ptr_offset[blk_count] - 1);
+                    thrust::exclusive_scan(thrust::device, d_recblock_Ptr + ptr_offset[blk_count] - 1,
+                                           d_recblock_Ptr + ptr_offset[blk_count] + blk_m[blk_count], d_recblock_Ptr + ptr_offset[blk_count] - 1, init_val);
+                    real_i = m;
+                }
+                else if (nnzr <= 12 && empty_ratio > 50)
+                {
+                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    int num_blocks = ceil((double)m_new / (double)num_threads);
+                    (mv_blk[mv_count]).method = 1;
+                    (mv_blk[mv_count]).num_threads = num_threads;
+                    (mv_blk[mv_count]).num_blocks = num_blocks;
+                    (mv_blk[mv_count]).m_new = m_new;
+
+                    int *d_dcsr_i;
+                    cudaMalloc((void **)(&d_dcsr_i), sizeof(int));
+                    cudaMemcpy(d_dcsr_i, &dcsr_i, sizeof(int), cudaMemcpyHostToDevice);
+                    dcsr_recblockdata_ptr<<<1, 1>>>(m, d_csrRowPtrTR_sub, ptr_offset[blk_count],
+                                                    dcsrindex_offset[blk_count], d_dcsr_i, d_recblock_Ptr,
+                                                    d_recblock_dcsr_rowidx);
+                    cudaMemcpy(&dcsr_i, d_dcsr_i, sizeof(int), cudaMemcpyDeviceToHost);
+                    cudaFree(d_dcsr_i);
+                    real_i = dcsr_i;
+                }
+                else if (nnzr > 12 && empty_ratio <= 15)
+                {
+                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    int num_blocks = ceil((double)m / (double)(num_threads / WARP_SIZE));
+                    (mv_blk[mv_count]).method = 2;
+                    (mv_blk[mv_count]).num_threads = num_threads;
+                    (mv_blk[mv_count]).num_blocks = num_blocks;
+                    (mv_blk[mv_count]).m = m;
+
+                    int init_val;
+                    cudaMemcpy(&init_val, d_recblock_Ptr + ptr_offset[blk_count] - 1, sizeof(int), cudaMemcpyDeviceToHost);
+
+                    pre_store_to_recblockdata<<<num_blocks, num_threads>>>(blk_m[blk_count], d_csrRowPtrTR_sub, d_recblock_Ptr + ptr_offset[blk_count] - 1);
+                    thrust::exclusive_scan(thrust::device, d_recblock_Ptr + ptr_offset[blk_count] - 1,
+                                           d_recblock_Ptr + ptr_offset[blk_count] + blk_m[blk_count], d_recblock_Ptr + ptr_offset[blk_count] - 1, init_val);
+                    real_i = blk_m[blk_count];
+                }
+                else
+                {
+                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    int num_blocks = ceil((double)m_new / (double)(num_threads / WARP_SIZE));
+
+                    (mv_blk[mv_count]).method = 3;
+                    (mv_blk[mv_count]).num_threads = num_threads;
+                    (mv_blk[mv_count]).num_blocks = num_blocks;
+                    (mv_blk[mv_count]).m_new = m_new;
+
+                    int *d_dcsr_i;
+                    cudaMalloc((void **)(&d_dcsr_i), sizeof(int));
+                    cudaMemcpy(d_dcsr_i, &dcsr_i, sizeof(int), cudaMemcpyHostToDevice);
+                    dcsr_recblockdata_ptr<<<1, 1>>>(m, d_csrRowPtrTR_sub, ptr_offset[blk_count],
+                                                    dcsrindex_offset[blk_count], d_dcsr_i, d_recblock_Ptr,
+                                                    d_recblock_dcsr_rowidx);
+                    cudaMemcpy(&dcsr_i, d_dcsr_i, sizeof(int), cudaMemcpyDeviceToHost);
+                    cudaFree(d_dcsr_i);
+                    real_i = dcsr_i;
+                }
+
+                // a block with long rows is skewed enough that the row kernels leave most threads
+                // idle; merge-path spreads its nonzeros evenly instead of a separate longrow pass
+                (mv_blk[mv_count]).longrow = MERGE_PATH_ITEMS > 0 ? 0 : longrow;
+                if (longrow != 0 && MERGE_PATH_ITEMS > 0)
+                {
+                    (mv_blk[mv_count]).merge_nnz = nnz;
+                    (mv_blk[mv_count]).m = m;
+                }
+                else if (longrow != 0)
+                {
+                    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+                    int num_blocks = ceil((double)lenmax / (double)num_threads);
+                    (mv_blk[mv_count]).num_threads_l = num_threads;
+                    (mv_blk[mv_count]).num_blocks_l = num_blocks;
+                    cudaMalloc((void **)&((mv_blk[mv_count]).d_csrRowPtr_l), (m + 1) * sizeof(int));
+                    cudaMalloc((void **)&((mv_blk[mv_count]).d_csrColIdx_l), nnz * sizeof(int));
+                    cudaMalloc((void **)&((mv_blk[mv_count]).d_csrVal_l), nnz * sizeof(VALUE_TYPE));
+                    cudaMemcpy((mv_blk[mv_count]).d_csrRowPtr_l, d_csrRowPtrTR_sub, (m + 1) * sizeof(int), cudaMemcpyDeviceToDevice);
+                    cudaMemcpy((mv_blk[mv_count]).d_csrColIdx_l, d_csrColIdxTR_sub, nnz * sizeof(int), cudaMemcpyDeviceToDevice);
+                    cudaMemcpy((mv_blk[mv_count]).d_csrVal_l, d_csrValTR_sub, nnz * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+
+                    cudaMalloc((void **)&((mv_blk[mv_count]).d_longrow_idx), longrow * sizeof(int));
+                    cudaMemcpy((mv_blk[mv_count]).d_longrow_idx, d_longrow_idx, longrow * sizeof(int), cudaMemcpyDeviceToDevice);
+                }
+
+                int bsr = longrow == 0 && spmv_bsr_create(&(mv_blk[mv_count]), d_csrRowPtrTR_sub, d_csrColIdxTR_sub, d_csrValTR_sub, m, blk_n[blk_count], nnz);
+                if (!bsr && ((mv_blk[mv_count]).method == 0 || (mv_blk[mv_count]).method == 1) && longrow == 0)
+                    spmv_sell_create(&(mv_blk[mv_count]), d_csrRowPtrTR_sub, d_csrColIdxTR_sub, d_csrValTR_sub, m, nnz);
+            }
+
+            ptr_offset[blk_count + 1] = ptr_offset[blk_count] + real_i;
+            recblock_nnz_ptr += blk_nnz[blk_count];
+            index_offset[blk_count + 1] = recblock_nnz_ptr;
+            dcsrindex_offset[blk_count + 1] = dcsrindex_offset[blk_count] + dcsr_i;
+
+            cudaFree(d_csrRowPtrTR_sub);
+            cudaFree(d_csrColIdxTR_sub);
+            cudaFree(d_csrValTR_sub);
+            cudaFree(d_cscRowIdxTR_sub);
+            cudaFree(d_cscColPtrTR_sub);
+            cudaFree(d_cscValTR_sub);
+
+            mv_count++;
+        }
+    }
+
+    cudaFree(d_blk_nnz);
+    cudaFree(d_cscColPtrTR_new);
+    cudaFree(d_cscRowIdxTR_new);
+    cudaFree(d_cscValTR_new);
+    free(subtri_upbound);
+    free(subtri_downbound);
+    free(subrec_upbound);
+    free(subrec_downbound);
+    free(subrec_rightbound);
+    free(subrec_leftbound);
+
+    // the local columns of a square block at most INDEX16_MAX_WIDTH wide fit in 16 bits; its
+    // 32-bit range is dropped by recblocking_plan_compact. Triangles keep 32-bit indices: the
+    // cuSPARSE path needs them and the other five executors are not narrowed
+    // BSR and sliced ELL blocks read only their own copy, so they get neither this nor codes
+    int idx16_size = 0;
+    for (int i = 1; i < sum_block; i += 2)
+        if (mv_blk[i / 2].method != -1 && blk_n[i] <= INDEX16_MAX_WIDTH && !mv_blk[i / 2].bsr_dim && mv_blk[i / 2].d_sell_ptr == NULL)
+            idx16_size += index_offset[i + 1] - index_offset[i];
+    unsigned short *d_recblock_Index16 = NULL;
+    if (idx16_size)
+        cudaMalloc((void **)&d_recblock_Index16, idx16_size * sizeof(unsigned short));
+    int idx16_offset = 0;
+    for (int i = 1; i < sum_block; i += 2)
+    {
+        int nnz_i = index_offset[i + 1] - index_offset[i];
+        if (mv_blk[i / 2].method == -1 || blk_n[i] > INDEX16_MAX_WIDTH || !nnz_i || mv_blk[i / 2].bsr_dim || mv_blk[i / 2].d_sell_ptr != NULL)
+            continue;
+        mv_blk[i / 2].d_csrColIdx16 = d_recblock_Index16 + idx16_offset;
+        int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+        int num_blocks = ceil((double)nnz_i / (double)num_threads);
+        index_narrow_cuda<<<num_blocks, num_threads>>>(&d_recblock_Index[index_offset[i]], mv_blk[i / 2].d_csrColIdx16, nnz_i);
+        idx16_offset += nnz_i;
+    }
+
+    // lossless value dictionaries: a square block with at most VALUE_DICT_MAX distinct
+    // values reads one byte per nonzero instead of a VALUE_TYPE, and one with a single
+    // value (pattern matrices) reads no values at all. Blocks holding a NaN are left alone
+    int *dict_size = (int *)malloc(sizeof(int) * squ_block);
+    int max_nnz = 0;
+    for (int i = 1; i < sum_block; i += 2)
+        if (index_offset[i + 1] - index_offset[i] > max_nnz)
+            max_nnz = index_offset[i + 1] - index_offset[i];
+    VALUE_TYPE *d_val_sorted = NULL;
+    int *d_code_tmp = NULL;
+    int *d_nan;
+    cudaMalloc((void **)&d_nan, sizeof(int));
+    if (max_nnz)
+    {
+        cudaMalloc((void **)&d_val_sorted, max_nnz * sizeof(VALUE_TYPE));
+        cudaMalloc((void **)&d_code_tmp, max_nnz * sizeof(int));
+    }
+    int code_size = 0, dict_total = 0;
+    for (int i = 1; i < sum_block; i += 2)
+    {
+        int nnz_i = index_offset[i + 1] - index_offset[i];
+        dict_size[i / 2] = 0;
+        if (mv_blk[i / 2].method == -1 || !nnz_i || mv_blk[i / 2].bsr_dim || mv_blk[i / 2].d_sell_ptr != NULL)
+            continue;
+        int nan = 0;
+        cudaMemset(d_nan, 0, sizeof(int));
+        value_nan_cuda<<<ceil((double)nnz_i / (double)(WARP_PER_BLOCK * WARP_SIZE)), WARP_PER_BLOCK * WARP_SIZE>>>(&d_recblock_Val[index_offset[i]], nnz_i, d_nan);
+        cudaMemcpy(&nan, d_nan, sizeof(int), cudaMemcpyDeviceToHost);
+        if (nan)
+            continue;
+        cudaMemcpy(d_val_sorted, &d_recblock_Val[index_offset[i]], nnz_i * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+        thrust::sort(thrust::device, d_val_sorted, d_val_sorted + nnz_i);
+        int ndistinct = thrust::unique(thrust::device, d_val_sorted, d_val_sorted + nnz_i) - d_val_sorted;
+        if (ndistinct == 1)
+        {
+            mv_blk[i / 2].constant = 1;
+            cudaMemcpy(&(mv_blk[i / 2].value), d_val_sorted, sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+            continue;
+        }
+        if (ndistinct > VALUE_DICT_MAX)
+            continue;
+        dict_size[i / 2] = ndistinct;
+        code_size += nnz_i;
+        dict_total += ndistinct;
+    }
+    unsigned char *d_recblock_Code = NULL;
+    VALUE_TYPE *d_recblock_Dict = NULL;
+    if (code_size)
+    {
+        cudaMalloc((void **)&d_recblock_Code, code_size * sizeof(unsigned char));
+        cudaMalloc((void **)&d_recblock_Dict, dict_total * sizeof(VALUE_TYPE));
+    }
+    int code_offset = 0, dict_offset = 0;
+    for (int i = 1; i < sum_block; i += 2)
+    {
+        int nnz_i = index_offset[i + 1] - index_offset[i];
+        int ndistinct = dict_size[i / 2];
+        if (!ndistinct)
+            continue;
+        SpMV_block *blk = &(mv_blk[i / 2]);
+        blk->d_csrCode = d_recblock_Code + code_offset;
+        blk->d_dict = d_recblock_Dict + dict_offset;
+        cudaMemcpy(d_val_sorted, &d_recblock_Val[index_offset[i]], nnz_i * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+        thrust::sort(thrust::device, d_val_sorted, d_val_sorted + nnz_i);
+        thrust::unique(thrust::device, d_val_sorted, d_val_sorted + nnz_i);
+        cudaMemcpy(blk->d_dict, d_val_sorted, ndistinct * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice);
+        thrust::lower_bound(thrust::device, blk->d_dict, blk->d_dict + ndistinct,
+                            &d_recblock_Val[index_offset[i]], &d_recblock_Val[index_offset[i]] + nnz_i, d_code_tmp);
+        int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+        int num_blocks = ceil((double)nnz_i / (double)num_threads);
+        index_narrow_cuda<<<num_blocks, num_threads>>>(d_code_tmp, blk->d_csrCode, nnz_i);
+        code_offset += nnz_i;
+        dict_offset += ndistinct;
+    }
+    cudaFree(d_val_sorted);
+    cudaFree(d_code_tmp);
+    cudaFree(d_nan);
+    free(dict_size);
+
+    plan->m = m;
+    plan->n = n;
+    plan->substitution = substitution;
+    plan->sum_block = sum_block;
+    plan->tri_block = tri_block;
+    plan->squ_block = squ_block;
+    plan->trsv_blk = trsv_blk;
+    plan->mv_blk = mv_blk;
+    plan->blk_m = blk_m;
+    plan->blk_n = blk_n;
+    plan->blk_nnz = blk_nnz;
+    plan->loc_off = loc_off;
+    plan->tmp_off = tmp_off;
+    plan->d_recblock_Ptr = d_recblock_Ptr;
+    plan->d_recblock_Index = d_recblock_Index;
+    plan->d_recblock_Index16 = d_recblock_Index16;
+    plan->d_recblock_Code = d_recblock_Code;
+    plan->d_recblock_Dict = d_recblock_Dict;
+    plan->d_recblock_dcsr_rowidx = d_recblock_dcsr_rowidx;
+    plan->d_recblock_Val = d_recblock_Val;
+    plan->ptr_offset = ptr_offset;
+    plan->index_offset = index_offset;
+    plan->dcsrindex_offset = dcsrindex_offset;
+    plan->d_levelItem = d_levelItem;
+    cudaMalloc((void **)&(plan->d_b_perm), m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&(plan->d_x_perm), n * sizeof(VALUE_TYPE));
+    cudaMemset(plan->d_x_perm, 0, n * sizeof(VALUE_TYPE));
+
+    cudaStreamCreate(&(plan->stream));
+    plan->bound_b = NULL;
+    plan->bound_x = NULL;
+    plan->trans_ready = 0;
+    plan->bound_b_trans = NULL;
+    plan->bound_x_trans = NULL;
+#if USE_CUDA_GRAPH
+    plan->graph_exec = NULL;
+    plan->graph_exec_trans = NULL;
+#endif
+    recblocking_plan_compact(plan);
+    recblocking_plan_bind(plan, plan->d_b_perm, plan->d_x_perm);
+
+    // cuSPARSE csrsv2 is not documented to accept x aliasing b; all other executors
+    // read b of a row only in the thread that then writes x of that row
+    plan->inplace = 1;
+    for (int i = 0; i < tri_block; i++)
+        if (trsv_blk[i].method == 1)
+            plan->inplace = 0;
+    cudaDeviceSynchronize();
+}
+
+// x = T \ b, with b and x in the original (unpermuted) order
+void recblocking_plan_solve(RecBlockPlan *plan,
+                            VALUE_TYPE *d_b,
+                            VALUE_TYPE *d_x)
+{
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)plan->m / (double)num_threads);
+    levelset_reordering_vecb_cuda<<<num_blocks, num_threads, 0, plan->stream>>>(d_b, plan->d_b_perm, plan->d_levelItem, plan->m);
+    recblocking_plan_bind(plan, plan->d_b_perm, plan->d_x_perm);
+    recblocking_plan_execute(plan, plan->stream);
+    num_blocks = ceil((double)plan->n / (double)num_threads);
+    levelset_reordering_vecx_cuda<<<num_blocks, num_threads, 0, plan->stream>>>(plan->d_x_perm, d_x, plan->d_levelItem, plan->n);
+    cudaStreamSynchronize(plan->stream);
+}
+
+// v_perm[i] = v[levelItem[i]]: move a vector into the plan's level-set order once,
+// so that an iterative solver can keep all its vectors there
+void recblocking_plan_permute(RecBlockPlan *plan,
+                              VALUE_TYPE *d_v,
+                              VALUE_TYPE *d_v_perm)
+{
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)plan->m / (double)num_threads);
+    levelset_reordering_vecb_cuda<<<num_blocks, num_threads, 0, plan->stream>>>(d_v, d_v_perm, plan->d_levelItem, plan->m);
+}
+
+// v[levelItem[i]] = v_perm[i]
+void recblocking_plan_unpermute(RecBlockPlan *plan,
+                                VALUE_TYPE *d_v_perm,
+                                VALUE_TYPE *d_v)
+{
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)plan->n / (double)num_threads);
+    levelset_reordering_vecx_cuda<<<num_blocks, num_threads, 0, plan->stream>>>(d_v_perm, d_v, plan->d_levelItem, plan->n);
+}
+
+// x_perm = T \ b_perm with both vectors already in level-set order; b_perm is used
+// as workspace and left overwritten. Work is only enqueued on plan->stream, which
+// is a blocking stream and so stays ordered with the legacy default stream
+void recblocking_plan_solve_permuted(RecBlockPlan *plan,
+                                     VALUE_TYPE *d_b_perm,
+                                     VALUE_TYPE *d_x_perm)
+{
+    recblocking_plan_bind(plan, d_b_perm, d_x_perm);
+    recblocking_plan_execute(plan, plan->stream);
+}
+
+// bx_perm = T \ bx_perm in level-set order
+void recblocking_plan_solve_inplace(RecBlockPlan *plan,
+                                    VALUE_TYPE *d_bx_perm)
+{
+    if (plan->inplace)
+    {
+        recblocking_plan_bind(plan, d_bx_perm, d_bx_perm);
+        recblocking_plan_execute(plan, plan->stream);
+    }
+    else
+    {
+        recblocking_plan_bind(plan, d_bx_perm, plan->d_x_perm);
+        recblocking_plan_execute(plan, plan->stream);
+        cudaMemcpyAsync(d_bx_perm, plan->d_x_perm, plan->n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice, plan->stream);
+    }
+}
+
+// allocate the sync-free counters that the transposed schedule needs for triangles
+// whose own executor does not have them; only O(m) per block, the values are shared
+void recblocking_plan_prepare_transposed(RecBlockPlan *plan)
+{
+    if (plan->trans_ready)
+        return;
+    for (int i = 0; i < plan->tri_block; i++)
+    {
+        SpTRSV_block *blk = &(plan->trsv_blk[i]);
+        if (blk->method == 1 || blk->method == 2 || blk->method == 4 || blk->method == 5)
+        {
+            cudaMalloc((void **)&(blk->d_graphInDegree), blk->m * sizeof(int));
+            cudaMalloc((void **)&(blk->d_left_sum), blk->m * sizeof(VALUE_TYPE));
+            cudaMalloc((void **)&(blk->d_id_extractor), sizeof(int));
+        }
+    }
+
+    // the transposed schedule reads every block from the full arenas; the forward
+    // schedule is pointed at them too, so that only one copy is on the device
+    if (plan->recblock_Index_h != NULL)
+    {
+        int nnz = plan->index_offset[plan->sum_block];
+        cudaFree(plan->d_recblock_Index);
+        cudaFree(plan->d_recblock_Val);
+        cudaMalloc((void **)&(plan->d_recblock_Index), sizeof(int) * nnz);
+        cudaMalloc((void **)&(plan->d_recblock_Val), sizeof(double) * nnz);
+        cudaMemcpy(plan->d_recblock_Index, plan->recblock_Index_h, sizeof(int) * nnz, cudaMemcpyHostToDevice);
+        cudaMemcpy(plan->d_recblock_Val, plan->recblock_Val_h, sizeof(double) * nnz, cudaMemcpyHostToDevice);
+        free(plan->recblock_Index_h);
+        free(plan->recblock_Val_h);
+        plan->recblock_Index_h = NULL;
+        plan->recblock_Val_h = NULL;
+        memcpy(plan->sched_index_offset, plan->index_offset, sizeof(int) * (plan->sum_block + 1));
+        memcpy(plan->sched_val_offset, plan->index_offset, sizeof(int) * (plan->sum_block + 1));
+
+        VALUE_TYPE *b_t = plan->bound_b;
+        VALUE_TYPE *x_t = plan->bound_x;
+        plan->bound_b = NULL;
+        recblocking_plan_bind(plan, b_t, x_t);
+    }
+    plan->trans_ready = 1;
+}
+
+// enqueue the schedule of T^T x_t = b_t on permuted vectors (b_t consumed); the
+// level-set permutation is symmetric, so it serves the transpose as well
+void recblocking_plan_schedule_transposed(RecBlockPlan *plan,
+                                          VALUE_TYPE *b_t,
+                                          VALUE_TYPE *x_t,
+                                          cudaStream_t stream)
+{
+    transposed_schedule(plan->mv_blk, plan->trsv_blk, plan->sum_block, plan->blk_m, plan->blk_n, plan->loc_off, plan->tmp_off, plan->m, plan->substitution, x_t, b_t,
+                        plan->d_recblock_Ptr, plan->d_recblock_Index, plan->d_recblock_dcsr_rowidx, plan->d_recblock_Val, plan->ptr_offset, plan->index_offset, plan->dcsrindex_offset, stream);
+}
+
+// as recblocking_plan_bind, with a graph of its own so that alternating T and T^T
+// solves do not re-capture
+void recblocking_plan_bind_transposed(RecBlockPlan *plan,
+                                      VALUE_TYPE *b_t,
+                                      VALUE_TYPE *x_t)
+{
+    recblocking_plan_prepare_transposed(plan);
+    if (plan->bound_b_trans == b_t && plan->bound_x_trans == x_t)
+        return;
+    plan->bound_b_trans = b_t;
+    plan->bound_x_trans = x_t;
+#if USE_CUDA_GRAPH
+    if (plan->graph_exec_trans != NULL)
+    {
+        cudaGraphExecDestroy(plan->graph_exec_trans);
+        cudaGraphDestroy(plan->graph_trans);
+    }
+    cudaStreamBeginCapture(plan->stream, cudaStreamCaptureModeGlobal);
+    recblocking_plan_schedule_transposed(plan, b_t, x_t, plan->stream);
+    cudaStreamEndCapture(plan->stream, &(plan->graph_trans));
+    cudaGraphInstantiate(&(plan->graph_exec_trans), plan->graph_trans, NULL, NULL, 0);
+#endif
+}
+
+void recblocking_plan_execute_transposed(RecBlockPlan *plan,
+                                         cudaStream_t stream)
+{
+#if USE_CUDA_GRAPH
+    cudaGraphLaunch(plan->graph_exec_trans, stream);
+#else
+    recblocking_plan_schedule_transposed(plan, plan->bound_b_trans, plan->bound_x_trans, stream);
+#endif
+}
+
+// x = T^T \ b from the blocks of T, with b and x in the original order
+void recblocking_plan_solve_transposed(RecBlockPlan *plan,
+                                       VALUE_TYPE *d_b,
+                                       VALUE_TYPE *d_x)
+{
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)plan->n / (double)num_threads);
+    levelset_reordering_vecb_cuda<<<num_blocks, num_threads, 0, plan->stream>>>(d_b, plan->d_x_perm, plan->d_levelItem, plan->n);
+    recblocking_plan_bind_transposed(plan, plan->d_x_perm, plan->d_b_perm);
+    recblocking_plan_execute_transposed(plan, plan->stream);
+    num_blocks = ceil((double)plan->m / (double)num_threads);
+    levelset_reordering_vecx_cuda<<<num_blocks, num_threads, 0, plan->stream>>>(plan->d_b_perm, d_x, plan->d_levelItem, plan->m);
+    cudaStreamSynchronize(plan->stream);
+}
+
+// x_perm = T^T \ b_perm in level-set order; b_perm is used as workspace
+void recblocking_plan_solve_transposed_permuted(RecBlockPlan *plan,
+                                                VALUE_TYPE *d_b_perm,
+                                                VALUE_TYPE *d_x_perm)
+{
+    recblocking_plan_bind_transposed(plan, d_b_perm, d_x_perm);
+    recblocking_plan_execute_transposed(plan, plan->stream);
+}
+
+// b += delta and x = T \ b for x = T \ b_old, with delta given by its nnzd nonzeros
+// on the host and b, x on the device in the original order. Only the rows of x
+// reachable from the changed rows are recomputed, through the column structure
+// held by s; a larger update falls back to a full solve of the plan. Returns the
+// number of rows updated, or -1 on fallback
+int recblocking_plan_update(RecBlockPlan *plan,
+                            SpTRSV_sparse_rhs *s,
+                            const int nnzd,
+                            const int *idx,
+                            const VALUE_TYPE *delta,
+                            VALUE_TYPE *d_b,
+                            VALUE_TYPE *d_x)
+{
+    int nreach = sptrsv_sparse_rhs_update(s, nnzd, idx, delta, plan->m / INCREMENTAL_REACH_RATIO, d_b, d_x);
+    if (nreach < 0)
+        recblocking_plan_solve(plan, d_b, d_x);
+    else
+        cudaDeviceSynchronize();
+    return nreach;
+}
+
+void recblocking_plan_destroy(RecBlockPlan *plan)
+{
+#if USE_CUDA_GRAPH
+    cudaGraphExecDestroy(plan->graph_exec);
+    cudaGraphDestroy(plan->graph);
+    if (plan->graph_exec_trans != NULL)
+    {
+        cudaGraphExecDestroy(plan->graph_exec_trans);
+        cudaGraphDestroy(plan->graph_trans);
+    }
+#endif
+    cudaStreamDestroy(plan->stream);
+    if (plan->trans_ready)
+    {
+        for (int i = 0; i < plan->tri_block; i++)
+        {
+            SpTRSV_block *blk = &(plan->trsv_blk[i]);
+            if (blk->method == 1 || blk->method == 2 || blk->method == 4 || blk->method == 5)
+            {
+                cudaFree(blk->d_graphInDegree);
+                cudaFree(blk->d_left_sum);
+                cudaFree(blk->d_id_extractor);
+            }
+        }
+    }
+    // device_memfree also frees the block arrays themselves
+    device_memfree(plan->mv_blk, plan->trsv_blk, plan->tri_block, plan->squ_block);
+    free(plan->blk_m);
+    free(plan->blk_n);
+    free(plan->blk_nnz);
+    free(plan->loc_off);
+    free(plan->tmp_off);
+    free(plan->ptr_offset);
+    free(plan->index_offset);
+    free(plan->sched_index_offset);
+    free(plan->sched_val_offset);
+    free(plan->recblock_Index_h);
+    free(plan->recblock_Val_h);
+    free(plan->dcsrindex_offset);
+    cudaFree(plan->d_recblock_Ptr);
+    cudaFree(plan->d_recblock_Index);
+    cudaFree(plan->d_recblock_Index16);
+    cudaFree(plan->d_recblock_Code);
+    cudaFree(plan->d_recblock_Dict);
+    cudaFree(plan->d_recblock_dcsr_rowidx);
+    cudaFree(plan->d_recblock_Val);
+    cudaFree(plan->d_levelItem);
+    cudaFree(plan->d_b_perm);
+    cudaFree(plan->d_x_perm);
+}
+
+void recblocking_lu_plan_create(RecBlockLUPlan *lu,
+                                int *d_cscColPtrL,
+                                int *d_cscRowIdxL,
+                                VALUE_TYPE *d_cscValL,
+                                int nnzL,
+                                int *d_cscColPtrU,
+                                int *d_cscRowIdxU,
+                                VALUE_TYPE *d_cscValU,
+                                int nnzU,
+                                int m,
+                                int lv,
+                                int adaptive)
+{
+    recblocking_plan_create(&(lu->L), d_cscColPtrL, d_cscRowIdxL, d_cscValL, m, m, nnzL, SUBSTITUTION_FORWARD, lv, adaptive);
+    recblocking_plan_create(&(lu->U), d_cscColPtrU, d_cscRowIdxU, d_cscValU, m, m, nnzU, SUBSTITUTION_BACKWARD, lv, adaptive);
+
+    // compose the two level-set permutations: scatter out of L and gather into U in one step
+    int *d_levelItemInv;
+    cudaMalloc((void **)&d_levelItemInv, m * sizeof(int));
+    cudaMalloc((void **)&(lu->d_perm_LU), m * sizeof(int));
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)m / (double)num_threads);
+    levelset_inverse_perm_cuda<<<num_blocks, num_threads>>>(lu->L.d_levelItem, d_levelItemInv, m);
+    levelset_compose_perm_cuda<<<num_blocks, num_threads>>>(d_levelItemInv, lu->U.d_levelItem, lu->d_perm_LU, m);
+    cudaMalloc((void **)&(lu->d_perm_UL), m * sizeof(int));
+    levelset_inverse_perm_cuda<<<num_blocks, num_threads>>>(lu->U.d_levelItem, d_levelItemInv, m);
+    levelset_compose_perm_cuda<<<num_blocks, num_threads>>>(d_levelItemInv, lu->L.d_levelItem, lu->d_perm_UL, m);
+    cudaDeviceSynchronize();
+    cudaFree(d_levelItemInv);
+    lu->symmetric = 0;
+}
+
+// x = L^T \ (L \ b) from the blocks of L alone, both sweeps in the level order of L
+void recblocking_lu_plan_create_symmetric(RecBlockLUPlan *lu,
+                                          int *d_cscColPtrL,
+                                          int *d_cscRowIdxL,
+                                          VALUE_TYPE *d_cscValL,
+                                          int nnzL,
+                                          int m,
+                                          int lv,
+                                          int adaptive)
+{
+    recblocking_plan_create(&(lu->L), d_cscColPtrL, d_cscRowIdxL, d_cscValL, m, m, nnzL, SUBSTITUTION_FORWARD, lv, adaptive);
+    recblocking_plan_prepare_transposed(&(lu->L));
+    lu->d_perm_LU = NULL;
+    lu->d_perm_UL = NULL;
+    lu->symmetric = 1;
+}
+
+// x = U \ (L \ b), with b and x in the original order
+void recblocking_lu_plan_solve(RecBlockLUPlan *lu,
+                               VALUE_TYPE *d_b,
+                               VALUE_TYPE *d_x)
+{
+    int m = lu->L.m;
+    cudaStream_t stream = lu->L.stream;
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)m / (double)num_threads);
+    levelset_reordering_vecb_cuda<<<num_blocks, num_threads, 0, stream>>>(d_b, lu->L.d_b_perm, lu->L.d_levelItem, m);
+    recblocking_plan_bind(&(lu->L), lu->L.d_b_perm, lu->L.d_x_perm);
+    recblocking_plan_execute(&(lu->L), stream);
+    if (lu->symmetric)
+    {
+        recblocking_plan_bind_transposed(&(lu->L), lu->L.d_x_perm, lu->L.d_b_perm);
+        recblocking_plan_execute_transposed(&(lu->L), stream);
+        levelset_reordering_vecx_cuda<<<num_blocks, num_threads, 0, stream>>>(lu->L.d_b_perm, d_x, lu->L.d_levelItem, m);
+        cudaStreamSynchronize(stream);
+        return;
+    }
+    levelset_reordering_vecb_cuda<<<num_blocks, num_threads, 0, stream>>>(lu->L.d_x_perm, lu->U.d_b_perm, lu->d_perm_LU, m);
+    recblocking_plan_bind(&(lu->U), lu->U.d_b_perm, lu->U.d_x_perm);
+    recblocking_plan_execute(&(lu->U), stream);
+    levelset_reordering_vecx_cuda<<<num_blocks, num_threads, 0, stream>>>(lu->U.d_x_perm, d_x, lu->U.d_levelItem, m);
+    cudaStreamSynchronize(stream);
+}
+
+// z = U \ (L \ r) with r and z both in the level order of the L plan, so that
+// an iterative solver can keep every vector there; r is left untouched
+void recblocking_lu_plan_apply_permuted(RecBlockLUPlan *lu,
+                                        VALUE_TYPE *d_r,
+                                        VALUE_TYPE *d_z)
+{
+    int m = lu->L.m;
+    cudaStream_t stream = lu->L.stream;
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)m / (double)num_threads);
+    cudaMemcpyAsync(lu->L.d_b_perm, d_r, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice, stream);
+    recblocking_plan_bind(&(lu->L), lu->L.d_b_perm, lu->L.d_x_perm);
+    recblocking_plan_execute(&(lu->L), stream);
+    if (lu->symmetric)
+    {
+        recblocking_plan_bind_transposed(&(lu->L), lu->L.d_x_perm, lu->L.d_b_perm);
+        recblocking_plan_execute_transposed(&(lu->L), stream);
+        cudaMemcpyAsync(d_z, lu->L.d_b_perm, m * sizeof(VALUE_TYPE), cudaMemcpyDeviceToDevice, stream);
+        return;
+    }
+    levelset_reordering_vecb_cuda<<<num_blocks, num_threads, 0, stream>>>(lu->L.d_x_perm, lu->U.d_b_perm, lu->d_perm_LU, m);
+    recblocking_plan_bind(&(lu->U), lu->U.d_b_perm, lu->U.d_x_perm);
+    recblocking_plan_execute(&(lu->U), stream);
+    levelset_reordering_vecb_cuda<<<num_blocks, num_threads, 0, stream>>>(lu->U.d_x_perm, d_z, lu->d_perm_UL, m);
+}
+
+void recblocking_lu_plan_destroy(RecBlockLUPlan *lu)
+{
+    recblocking_plan_destroy(&(lu->L));
+    if (lu->symmetric)
+        return;
+    recblocking_plan_destroy(&(lu->U));
+    cudaFree(lu->d_perm_LU);
+    cudaFree(lu->d_perm_UL);
+}
+
+#endif
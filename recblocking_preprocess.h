@@ -12,6 +12,11 @@
 #include "utils_sptrsv_cuda.h"
 #include "utils_spmv_cuda.h"
 
+// adaptive recursion keeps splitting a triangle only while it has more levels than this
+#ifndef ADAPTIVE_LEVEL_THRESHOLD
+#define ADAPTIVE_LEVEL_THRESHOLD 20
+#endif
+
 void mat_preprocessing(const int *cscColPtrTR,
                        const int *cscRowIdxTR,
                        const VALUE_TYPE *cscValTR,
@@ -295,7 +300,200 @@ void mat_preprocessing(const int *cscColPtrTR,
     free(judge);
 }
 
-void get_recblock_size(int *cscRowIdxTR,
+// levels of the sub-triangle [up, down) of the reordered matrix, also returns its nnz
+int subtri_nlevel(const int *cscColPtrTR,
+                  const int *cscRowIdxTR,
+                  const int up,
+                  const int down,
+                  const int substitution,
+                  int *tri_nnz)
+{
+    int len = down - up;
+    int nnz = 0;
+    for (int j = up; j < down; j++)
+    {
+        for (int k = cscColPtrTR[j]; k < cscColPtrTR[j + 1]; k++)
+        {
+            int row = cscRowIdxTR[k];
+            if (substitution == SUBSTITUTION_FORWARD ? row < down : row >= up)
+                nnz++;
+        }
+    }
+    *tri_nnz = nnz;
+
+    // only the diagonal is left, the fasttrack executor solves it in one step
+    if (nnz == len)
+        return 1;
+
+    int *cscColPtr_sub = (int *)malloc(sizeof(int) * (len + 1));
+    int *cscRowIdx_sub = (int *)malloc(sizeof(int) * nnz);
+    int *csrRowPtr_sub = (int *)malloc(sizeof(int) * (len + 1));
+    cscColPtr_sub[0] = 0;
+
+    int nnz_ptr = 0;
+    for (int j = up; j < down; j++)
+    {
+        for (int k = cscColPtrTR[j]; k < cscColPtrTR[j + 1]; k++)
+        {
+            int row = cscRowIdxTR[k];
+            if (substitution == SUBSTITUTION_FORWARD ? row < down : row >= up)
+            {
+                cscRowIdx_sub[nnz_ptr] = row - up;
+                nnz_ptr++;
+            }
+        }
+        cscColPtr_sub[j - up + 1] = nnz_ptr;
+    }
+
+    matrix_transposition_litelite(len, len, nnz, cscColPtr_sub, cscRowIdx_sub, csrRowPtr_sub);
+
+    int *levelPtr_sub = (int *)malloc(sizeof(int) * (len + 1));
+    int *levelItem_sub = (int *)malloc(sizeof(int) * len);
+    int nlv = 0;
+    findlevel(cscColPtr_sub, cscRowIdx_sub, csrRowPtr_sub, len, &nlv, levelPtr_sub, levelItem_sub);
+
+    free(cscColPtr_sub);
+    free(cscRowIdx_sub);
+    free(csrRowPtr_sub);
+    free(levelPtr_sub);
+    free(levelItem_sub);
+
+    return nlv;
+}
+
+void mat_preprocessing_adaptive_split(const int *cscColPtrTR,
+                                      const int *cscRowIdxTR,
+                                      const int up,
+                                      const int down,
+                                      const int depth,
+                                      const int nlevel,
+                                      int *blk_count,
+                                      int *loc_off,
+                                      int *tmp_off,
+                                      int *blk_m,
+                                      int *blk_n,
+                                      int *blk_nnz,
+                                      int *subtri_upbound,
+                                      int *subtri_downbound,
+                                      int *subrec_upbound,
+                                      int *subrec_downbound,
+                                      int *subrec_rightbound,
+                                      int *subrec_leftbound,
+                                      int substitution)
+{
+    int mid = up + (down - up) / 2;
+    int tri_nnz = 0;
+    int leaf = depth == nlevel || mid == up;
+
+    // stop splitting once the triangle is cheap for a single executor:
+    // diagonal only (fasttrack) or shallow enough for the level-set method
+    if (!leaf)
+    {
+        int nlv = subtri_nlevel(cscColPtrTR, cscRowIdxTR, up, down, substitution, &tri_nnz);
+        leaf = nlv <= ADAPTIVE_LEVEL_THRESHOLD;
+    }
+    else
+    {
+        for (int j = up; j < down; j++)
+        {
+            for (int k = cscColPtrTR[j]; k < cscColPtrTR[j + 1]; k++)
+            {
+                int row = cscRowIdxTR[k];
+                if (substitution == SUBSTITUTION_FORWARD ? row < down : row >= up)
+                    tri_nnz++;
+            }
+        }
+    }
+
+    if (leaf)
+    {
+        int i = *blk_count;
+        blk_m[i] = down - up;
+        blk_n[i] = down - up;
+        blk_nnz[i] = tri_nnz;
+        subtri_upbound[i] = up;
+        subtri_downbound[i] = down;
+        loc_off[i] = up;
+        (*blk_count)++;
+        return;
+    }
+
+    // forward solves the upper half first, backward the lower half
+    int rec_up = substitution == SUBSTITUTION_FORWARD ? mid : up;
+    int rec_down = substitution == SUBSTITUTION_FORWARD ? down : mid;
+    int rec_left = substitution == SUBSTITUTION_FORWARD ? up : mid;
+    int rec_right = substitution == SUBSTITUTION_FORWARD ? mid : down;
+
+    if (substitution == SUBSTITUTION_FORWARD)
+        mat_preprocessing_adaptive_split(cscColPtrTR, cscRowIdxTR, up, mid, depth + 1, nlevel, blk_count,
+                                         loc_off, tmp_off, blk_m, blk_n, blk_nnz, subtri_upbound, subtri_downbound,
+                                         subrec_upbound, subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
+    else
+        mat_preprocessing_adaptive_split(cscColPtrTR, cscRowIdxTR, mid, down, depth + 1, nlevel, blk_count,
+                                         loc_off, tmp_off, blk_m, blk_n, blk_nnz, subtri_upbound, subtri_downbound,
+                                         subrec_upbound, subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
+
+    int i = *blk_count;
+    int sqr_nnz = 0;
+    for (int j = rec_left; j < rec_right; j++)
+    {
+        for (int k = cscColPtrTR[j]; k < cscColPtrTR[j + 1]; k++)
+        {
+            if (cscRowIdxTR[k] >= rec_up && cscRowIdxTR[k] < rec_down)
+                sqr_nnz++;
+        }
+    }
+
+    blk_m[i] = rec_down - rec_up;
+    blk_n[i] = rec_right - rec_left;
+    blk_nnz[i] = sqr_nnz;
+    tmp_off[i] = rec_up;
+    loc_off[i] = rec_left;
+    subrec_upbound[i] = rec_up;
+    subrec_downbound[i] = rec_down;
+    subrec_rightbound[i] = rec_right;
+    subrec_leftbound[i] = rec_left;
+    (*blk_count)++;
+
+    if (substitution == SUBSTITUTION_FORWARD)
+        mat_preprocessing_adaptive_split(cscColPtrTR, cscRowIdxTR, mid, down, depth + 1, nlevel, blk_count,
+                                         loc_off, tmp_off, blk_m, blk_n, blk_nnz, subtri_upbound, subtri_downbound,
+                                         subrec_upbound, subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
+    else
+        mat_preprocessing_adaptive_split(cscColPtrTR, cscRowIdxTR, up, mid, depth + 1, nlevel, blk_count,
+                                         loc_off, tmp_off, blk_m, blk_n, blk_nnz, subtri_upbound, subtri_downbound,
+                                         subrec_upbound, subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
+}
+
+// same block layout as mat_preprocessing, but a triangle is only split while findlevel
+// reports poor parallelism, so easy regions end up in fewer and larger blocks.
+// nlevel is the maximum depth, the number of blocks actually generated is returned.
+int mat_preprocessing_adaptive(const int *cscColPtrTR,
+                               const int *cscRowIdxTR,
+                               const int m,
+                               const int nlevel,
+                               int *loc_off,
+                               int *tmp_off,
+                               int *blk_m,
+                               int *blk_n,
+                               int *blk_nnz,
+                               int *subtri_upbound,
+                               int *subtri_downbound,
+                               int *subrec_upbound,
+                               int *subrec_downbound,
+                               int *subrec_rightbound,
+                               int *subrec_leftbound,
+                               int substitution)
+{
+    int blk_count = 0;
+    mat_preprocessing_adaptive_split(cscColPtrTR, cscRowIdxTR, 0, m, 0, nlevel, &blk_count,
+                                     loc_off, tmp_off, blk_m, blk_n, blk_nnz, subtri_upbound, subtri_downbound,
+                                     subrec_upbound, subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
+    printf("adaptive recursion: %d blocks (at most %d)\n", blk_count, (int)pow(2, nlevel + 1) - 1);
+    return blk_count;
+}
+
+int get_recblock_size(int *cscRowIdxTR,
                        int *cscColPtrTR,
                        VALUE_TYPE *cscValTR,
                        int *cscRowIdxTR_new,
@@ -307,6 +505,7 @@ void get_recblock_size(int *cscRowIdxTR,
                        int *levelItem,
                        int substitution,
                        int nlevel,
+                       int adaptive,
                        int *loc_off,
                        int *tmp_off,
                        int *blk_m,
@@ -343,9 +542,14 @@ void get_recblock_size(int *cscRowIdxTR,
 
     int blk_count = 0;
 
-    mat_preprocessing(cscColPtrTR_new, cscRowIdxTR_new, cscValTR_new, m, n,
-                      nlevel, loc_off, tmp_off, blk_m, blk_n, blk_nnz, subtri_upbound,
-                      subtri_downbound, subrec_upbound, subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
+    if (adaptive)
+        sum_block = mat_preprocessing_adaptive(cscColPtrTR_new, cscRowIdxTR_new, m, nlevel, loc_off, tmp_off,
+                                               blk_m, blk_n, blk_nnz, subtri_upbound, subtri_downbound, subrec_upbound,
+                                               subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
+    else
+        mat_preprocessing(cscColPtrTR_new, cscRowIdxTR_new, cscValTR_new, m, n,
+                          nlevel, loc_off, tmp_off, blk_m, blk_n, blk_nnz, subtri_upbound,
+                          subtri_downbound, subrec_upbound, subrec_downbound, subrec_rightbound, subrec_leftbound, substitution);
 
     // for (int i = 0; i < n + 1; i++)
     //     printf("%d ", cscColPtrTR_new[i]);
@@ -382,6 +586,8 @@ void get_recblock_size(int *cscRowIdxTR,
             *dcsr_size += blk_m[i];
         }
     }
+
+    return sum_block;
 }
 
 void L_preprocessing(int *cscRowIdxTR_new,
@@ -391,7 +597,7 @@ void L_preprocessing(int *cscRowIdxTR_new,
                      int m,
                      int n,
                      int substitution,
-                     int nlevel,
+                     int sum_block,
                      int *blk_m,
                      int *blk_n,
                      int *blk_nnz,
@@ -414,11 +620,6 @@ void L_preprocessing(int *cscRowIdxTR_new,
                      int idx_size,
                      int dcsr_size)
 {
-    // get auxiliary arrary for our datastruct
-    int tri_block = pow(2, nlevel);
-    int squ_block = tri_block - 1;
-    int sum_block = tri_block + squ_block;
-
     int blk_count = 0;
 
     // store sub-matrix into device
@@ -515,6 +716,8 @@ void L_preprocessing(int *cscRowIdxTR_new,
             {
                 int nnzr = blk_nnz[blk_count] / blk_m[blk_count];
                 // printf("nnzr = %d       nlv = %d\n", nnzr, nlv);
+                // coalescing runs of thin levels can bring a deep triangle under the launch limits
+                int ntask = levelset_coalesced_nlv(levelPtr_local, nlv);
                 if (nlv > 20000)
                 {
                     printf("trsv method = 1\n");
@@ -621,7 +824,7 @@ void L_preprocessing(int *cscRowIdxTR_new,
                     //     printf("%d ", recblock_Index[index_offset[blk_count] + i]);
                     // printf("\n");
                 }
-                else if ((nnzr <= 15 && nlv <= 20) || (nnzr == 1 && nlv <= 100))
+                else if ((nnzr <= 15 && ntask <= 20) || (nnzr == 1 && ntask <= 100))
                 {
                     printf("trsv method = 2\n");
                     // printf("YYY\n");
@@ -643,6 +846,7 @@ void L_preprocessing(int *cscRowIdxTR_new,
                         }
                         (trsv_blk[trsv_count]).nnz_lv_array[li] = nnz_lv;
                     }
+                    levelset_coalesce(&(trsv_blk[trsv_count]));
 
                     // printf("here:\n");
                     // for (int i = 0; i < nlv; i++)
@@ -661,6 +865,26 @@ void L_preprocessing(int *cscRowIdxTR_new,
                         recblock_Ptr[index] = recblock_Ptr[index - 1] + csrRowPtrTR_sub[i + 1] - csrRowPtrTR_sub[i];
                     }
                 }
+                else if (nnzr <= 15 && nlv <= P2P_LEVEL_THRESHOLD)
+                {
+                    printf("trsv method = 4\n");
+                    (trsv_blk[trsv_count]).method = 4;
+                    (trsv_blk[trsv_count]).m = blk_m[blk_count];
+                    (trsv_blk[trsv_count]).substitution = substitution;
+                    sptrsv_p2p_analyser(csrRowPtrTR_sub, csrColIdxTR_sub, blk_m[blk_count], substitution, &(trsv_blk[trsv_count]));
+
+                    for (int i = 0; i < blk_m[blk_count]; i++)
+                    {
+                        for (int j = csrRowPtrTR_sub[i]; j < csrRowPtrTR_sub[i + 1]; j++)
+                        {
+                            recblock_Index[recblock_nnz_ptr] = csrColIdxTR_sub[j];
+                            recblock_Val[recblock_nnz_ptr] = csrValTR_sub[j];
+                            recblock_nnz_ptr++;
+                        }
+                        int index = ptr_offset[blk_count] + i;
+                        recblock_Ptr[index] = recblock_Ptr[index - 1] + csrRowPtrTR_sub[i + 1] - csrRowPtrTR_sub[i];
+                    }
+                }
                 else
                 {
                     printf("trsv method = 3\n");
@@ -688,6 +912,7 @@ void L_preprocessing(int *cscRowIdxTR_new,
                     num_threads = WARP_PER_BLOCK * WARP_SIZE;
                     num_blocks = ceil((double)blk_m[blk_count] / (double)(num_threads / WARP_SIZE));
                     (trsv_blk[trsv_count]).method = 3;
+                    (trsv_blk[trsv_count]).nnzTR = blk_nnz[blk_count];
                     (trsv_blk[trsv_count]).num_threads = num_threads;
                     (trsv_blk[trsv_count]).num_blocks = num_blocks;
                     (trsv_blk[trsv_count]).m = blk_m[blk_count];
@@ -973,7 +1198,7 @@ void U_preprocessing(int *cscRowIdxTR_new,
                      int m,
                      int n,
                      int substitution,
-                     int nlevel,
+                     int sum_block,
                      int *blk_m,
                      int *blk_n,
                      int *blk_nnz,
@@ -996,11 +1221,6 @@ void U_preprocessing(int *cscRowIdxTR_new,
                      int idx_size,
                      int dcsr_size)
 {
-    // get auxiliary arrary for our datastruct
-    int tri_block = pow(2, nlevel);
-    int squ_block = tri_block - 1;
-    int sum_block = tri_block + squ_block;
-
     int blk_count = 0;
 
     // store sub-matrix into device
@@ -1083,6 +1303,8 @@ void U_preprocessing(int *cscRowIdxTR_new,
             {
                 int nnzr = blk_nnz[blk_count] / blk_m[blk_count];
                 printf("nnzr = %d       nlv = %d\n", nnzr, nlv);
+                // coalescing runs of thin levels can bring a deep triangle under the launch limits
+                int ntask = levelset_coalesced_nlv(levelPtr_local, nlv);
                 if (nlv > 20000)
                 {
                     int *d_csrRowPtrTR = NULL;
@@ -1183,7 +1405,7 @@ void U_preprocessing(int *cscRowIdxTR_new,
                     }
                     cu_flag = 1;
                 }
-                else if ((nnzr <= 15 && nlv <= 20) || (nnzr == 1 && nlv <= 100))
+                else if ((nnzr <= 15 && ntask <= 20) || (nnzr == 1 && ntask <= 100))
                 {
                     (trsv_blk[trsv_count]).method = 2;
                     (trsv_blk[trsv_count]).m = blk_m[blk_count];
@@ -1203,6 +1425,26 @@ void U_preprocessing(int *cscRowIdxTR_new,
                         }
                         (trsv_blk[trsv_count]).nnz_lv_array[li] = nnz_lv;
                     }
+                    levelset_coalesce(&(trsv_blk[trsv_count]));
+
+                    for (int i = 0; i < blk_m[blk_count]; i++)
+                    {
+                        for (int j = csrRowPtrTR_sub[i]; j < csrRowPtrTR_sub[i + 1]; j++)
+                        {
+                            recblock_Index[recblock_nnz_ptr] = csrColIdxTR_sub[j];
+                            recblock_Val[recblock_nnz_ptr] = csrValTR_sub[j];
+                            recblock_nnz_ptr++;
+                        }
+                        int index = ptr_offset[blk_count] + i;
+                        recblock_Ptr[index] = recblock_Ptr[index - 1] + csrRowPtrTR_sub[i + 1] - csrRowPtrTR_sub[i];
+                    }
+                }
+                else if (nnzr <= 15 && nlv <= P2P_LEVEL_THRESHOLD)
+                {
+                    (trsv_blk[trsv_count]).method = 4;
+                    (trsv_blk[trsv_count]).m = blk_m[blk_count];
+                    (trsv_blk[trsv_count]).substitution = substitution;
+                    sptrsv_p2p_analyser(csrRowPtrTR_sub, csrColIdxTR_sub, blk_m[blk_count], substitution, &(trsv_blk[trsv_count]));
 
                     for (int i = 0; i < blk_m[blk_count]; i++)
                     {
@@ -1242,6 +1484,7 @@ void U_preprocessing(int *cscRowIdxTR_new,
                     num_threads = WARP_PER_BLOCK * WARP_SIZE;
                     num_blocks = ceil((double)blk_m[blk_count] / (double)(num_threads / WARP_SIZE));
                     (trsv_blk[trsv_count]).method = 3;
+                    (trsv_blk[trsv_count]).nnzTR = blk_nnz[blk_count];
                     (trsv_blk[trsv_count]).num_threads = num_threads;
                     (trsv_blk[trsv_count]).num_blocks = num_blocks;
                     (trsv_blk[trsv_count]).m = blk_m[blk_count];
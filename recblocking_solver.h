@@ -24,6 +24,7 @@ void recblocking_solver(int *cscColPtr,
                         VALUE_TYPE *x_ref,
                         int rhs,
                         int lv,
+                        int adaptive,
                         int substitution,
                         double *cal_time)
 {
@@ -33,8 +34,24 @@ void recblocking_solver(int *cscColPtr,
 
     SpTRSV_block *trsv_blk = (SpTRSV_block *)malloc(sizeof(SpTRSV_block) * tri_block);
     SpMV_block *mv_blk = (SpMV_block *)malloc(sizeof(SpMV_block) * squ_block);
+    for (int i = 0; i < tri_block; i++)
+    {
+        trsv_blk[i].method = -1;
+        trsv_blk[i].d_dense = NULL;
+        trsv_blk[i].super = NULL;
+        trsv_blk[i].d_inv_ptr = NULL;
+    }
     for (int i = 0; i < squ_block; i++)
+    {
         mv_blk[i].method = -1;
+        mv_blk[i].d_csrColIdx16 = NULL;
+        mv_blk[i].d_csrCode = NULL;
+        mv_blk[i].d_dict = NULL;
+        mv_blk[i].constant = 0;
+        mv_blk[i].d_sell_ptr = NULL;
+        mv_blk[i].bsr_dim = 0;
+        mv_blk[i].merge_nnz = 0;
+    }
 
     int *blk_m = (int *)malloc(sizeof(int) * (squ_block + tri_block));
     int *blk_n = (int *)malloc(sizeof(int) * (squ_block + tri_block));
@@ -75,10 +92,10 @@ void recblocking_solver(int *cscColPtr,
         int *cscRowIdxTR_new = (int *)malloc(nnz * sizeof(int));
         VALUE_TYPE *cscValTR_new = (VALUE_TYPE *)malloc(nnz * sizeof(VALUE_TYPE));
 
-        get_recblock_size(cscRowIdx, cscColPtr, cscVal, cscRowIdxTR_new, cscColPtrTR_new, cscValTR_new,
-                          nnz, m, n, levelItem, substitution, lv, loc_off, tmp_off, blk_m, blk_n, blk_nnz,
-                          subtri_upbound, subtri_downbound, subrec_upbound, subrec_downbound, subrec_rightbound,
-                          subrec_leftbound, &ptr_size, &idx_size, &dcsr_size);
+        sum_block = get_recblock_size(cscRowIdx, cscColPtr, cscVal, cscRowIdxTR_new, cscColPtrTR_new, cscValTR_new,
+                                      nnz, m, n, levelItem, substitution, lv, adaptive, loc_off, tmp_off, blk_m, blk_n, blk_nnz,
+                                      subtri_upbound, subtri_downbound, subrec_upbound, subrec_downbound, subrec_rightbound,
+                                      subrec_leftbound, &ptr_size, &idx_size, &dcsr_size);
 
 
         recblock_Ptr = (int *)malloc(sizeof(int) * ptr_size);
@@ -95,7 +112,7 @@ void recblocking_solver(int *cscColPtr,
 
         // preprocess L matrix
         L_preprocessing(cscRowIdxTR_new, cscColPtrTR_new, cscValTR_new, nnz, m, n,
-                        substitution, lv, blk_m, blk_n, blk_nnz,
+                        substitution, sum_block, blk_m, blk_n, blk_nnz,
                         subtri_upbound, subtri_downbound, subrec_upbound,
                         subrec_downbound, subrec_rightbound, subrec_leftbound,
                         mv_blk, trsv_blk, recblock_Ptr, recblock_Index, recblock_dcsr_rowidx,
@@ -142,7 +159,7 @@ void recblocking_solver(int *cscColPtr,
 
         L_calculate(mv_blk, trsv_blk, sum_block, blk_m, blk_n, loc_off, tmp_off,
                     m, rhs, x_d, b_d, b_perm_d, d_recblock_Ptr, d_recblock_Index, d_recblock_dcsr_rowidx,
-                    d_recblock_Val, ptr_offset, index_offset, dcsrindex_offset, cal_time);
+                    d_recblock_Val, ptr_offset, index_offset, index_offset, dcsrindex_offset, cal_time);
 
         VALUE_TYPE *x_perm = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * n * rhs);
         cudaMemcpy(x_perm, x_d, rhs * n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
@@ -174,10 +191,10 @@ void recblocking_solver(int *cscColPtr,
         int *cscRowIdxTR_new = (int *)malloc(nnz * sizeof(int));
         VALUE_TYPE *cscValTR_new = (VALUE_TYPE *)malloc(nnz * sizeof(VALUE_TYPE));
 
-        get_recblock_size(cscRowIdx, cscColPtr, cscVal, cscRowIdxTR_new, cscColPtrTR_new, cscValTR_new,
-                          nnz, m, n, levelItem, substitution, lv, loc_off, tmp_off, blk_m, blk_n, blk_nnz,
-                          subtri_upbound, subtri_downbound, subrec_upbound, subrec_downbound, subrec_rightbound,
-                          subrec_leftbound, &ptr_size, &idx_size, &dcsr_size);
+        sum_block = get_recblock_size(cscRowIdx, cscColPtr, cscVal, cscRowIdxTR_new, cscColPtrTR_new, cscValTR_new,
+                                      nnz, m, n, levelItem, substitution, lv, adaptive, loc_off, tmp_off, blk_m, blk_n, blk_nnz,
+                                      subtri_upbound, subtri_downbound, subrec_upbound, subrec_downbound, subrec_rightbound,
+                                      subrec_leftbound, &ptr_size, &idx_size, &dcsr_size);
 
         recblock_Ptr = (int *)malloc(sizeof(int) * ptr_size);
         recblock_Ptr[0] = 0;
@@ -193,7 +210,7 @@ void recblocking_solver(int *cscColPtr,
 
         // preprocess U matrix
         U_preprocessing(cscRowIdxTR_new, cscColPtrTR_new, cscValTR_new, nnz, m, n,
-                        substitution, lv, blk_m, blk_n, blk_nnz,
+                        substitution, sum_block, blk_m, blk_n, blk_nnz,
                         subtri_upbound, subtri_downbound, subrec_upbound,
                         subrec_downbound, subrec_rightbound, subrec_leftbound,
                         mv_blk, trsv_blk, recblock_Ptr, recblock_Index, recblock_dcsr_rowidx,
@@ -229,7 +246,7 @@ void recblocking_solver(int *cscColPtr,
 
         U_calculate(mv_blk, trsv_blk, sum_block, blk_m, blk_n, loc_off, tmp_off,
                     m, nnz, rhs, x_d, b_d, b_perm, d_recblock_Ptr, d_recblock_Index, d_recblock_dcsr_rowidx,
-                    d_recblock_Val, ptr_offset, index_offset, dcsrindex_offset, cal_time);
+                    d_recblock_Val, ptr_offset, index_offset, index_offset, dcsrindex_offset, cal_time);
 
         VALUE_TYPE *x_perm = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * n * rhs);
         cudaMemcpy(x_perm, x_d, rhs * n * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
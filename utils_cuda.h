@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include "common.h"
+#include "findlevel.h"
 #include <cuda_runtime.h>
 
 __global__ void matrix_transposition_litelite_cuda(int nnz,
@@ -732,6 +733,26 @@ void levelset_reordering_colrow_csc_cuda(int *cscColPtrTR,
     cudaMalloc((void **)&nlv, 1 * sizeof(int));
     findlevel_cuda(cscColPtrTR, cscRowIdxTR, d_csrRowPtrTR_tmp,
                    m, nlv, levelPtr, levelItem);
+    if (LEVEL_LOCALITY_SORT)
+    {
+        // the level walk is serial anyway; sort on the host and copy the order back
+        int h_nlv;
+        cudaMemcpy(&h_nlv, nlv, sizeof(int), cudaMemcpyDeviceToHost);
+        int *h_cscColPtr = (int *)malloc((m + 1) * sizeof(int));
+        int *h_cscRowIdx = (int *)malloc(nnzTR * sizeof(int));
+        int *h_levelPtr = (int *)malloc((h_nlv + 1) * sizeof(int));
+        int *h_levelItem = (int *)malloc(m * sizeof(int));
+        cudaMemcpy(h_cscColPtr, cscColPtrTR, (m + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+        cudaMemcpy(h_cscRowIdx, cscRowIdxTR, nnzTR * sizeof(int), cudaMemcpyDeviceToHost);
+        cudaMemcpy(h_levelPtr, levelPtr, (h_nlv + 1) * sizeof(int), cudaMemcpyDeviceToHost);
+        cudaMemcpy(h_levelItem, levelItem, m * sizeof(int), cudaMemcpyDeviceToHost);
+        findlevel_locality_sort(h_cscColPtr, h_cscRowIdx, m, nnzTR, h_nlv, h_levelPtr, h_levelItem);
+        cudaMemcpy(levelItem, h_levelItem, m * sizeof(int), cudaMemcpyHostToDevice);
+        free(h_cscColPtr);
+        free(h_cscRowIdx);
+        free(h_levelPtr);
+        free(h_levelItem);
+    }
     int *d_levelItem_tmp;
     int *d_levelperm;
     cudaMalloc((void **)&d_levelItem_tmp, m * sizeof(int));
@@ -875,4 +896,25 @@ __global__ void levelset_reordering_vecx_cuda(VALUE_TYPE *x_perm,
         x[levelItem[global_x_id]] = x_perm[global_x_id];
 }
 
+__global__ void levelset_inverse_perm_cuda(int *levelItem,
+                                           int *levelItemInv,
+                                           int m)
+{
+    const int global_x_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id < m)
+        levelItemInv[levelItem[global_x_id]] = global_x_id;
+}
+
+// perm[i] = first_inv[second[i]]: the gather that moves a vector from the first
+// permuted order straight into the second one
+__global__ void levelset_compose_perm_cuda(int *first_inv,
+                                           int *second,
+                                           int *perm,
+                                           int m)
+{
+    const int global_x_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_x_id < m)
+        perm[global_x_id] = first_inv[second[global_x_id]];
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef _UTILS_NUMA_
+#define _UTILS_NUMA_
+
+#include "common.h"
+#include <ctype.h>
+#include <sched.h>
+#include <cuda_runtime.h>
+
+// host thread placement relative to the device
+#define PIN_NONE 0
+#define PIN_NODE 1    // any cpu of the NUMA node the GPU is attached to
+#define PIN_COMPACT 2 // a single cpu of that node
+
+// NUMA node of the PCI slot holding the device, -1 if unknown
+int gpu_numa_node(int device_id)
+{
+    char busid[32];
+    if (cudaDeviceGetPCIBusId(busid, sizeof(busid), device_id) != cudaSuccess)
+        return -1;
+    // sysfs spells the bus id in lower case
+    for (int i = 0; busid[i]; i++)
+        busid[i] = tolower(busid[i]);
+
+    char path[128];
+    sprintf(path, "/sys/bus/pci/devices/%s/numa_node", busid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    int node = -1;
+    if (fscanf(f, "%d", &node) != 1)
+        node = -1;
+    fclose(f);
+    return node;
+}
+
+// parse /sys/devices/system/node/nodeN/cpulist (e.g. "0-15,32-47"), returns the number of cpus
+int numa_node_cpuset(int node, cpu_set_t *set)
+{
+    char path[128];
+    sprintf(path, "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return 0;
+
+    CPU_ZERO(set);
+    int count = 0;
+    int lo, hi;
+    while (fscanf(f, "%d", &lo) == 1)
+    {
+        hi = lo;
+        int sep = fgetc(f);
+        if (sep == '-')
+        {
+            if (fscanf(f, "%d", &hi) != 1)
+                break;
+            sep = fgetc(f);
+        }
+        for (int c = lo; c <= hi && c < CPU_SETSIZE; c++)
+        {
+            CPU_SET(c, set);
+            count++;
+        }
+        if (sep != ',')
+            break;
+    }
+    fclose(f);
+    return count;
+}
+
+// bind the host thread next to the device, so that the host buffers it fills
+// (and first-touches) during preprocessing live on the GPU-local node
+void pin_host_to_device(int device_id, int policy)
+{
+    if (policy == PIN_NONE)
+        return;
+
+    int node = gpu_numa_node(device_id);
+    if (node < 0)
+    {
+        printf("pin: NUMA node of device %d unknown, host thread not pinned\n", device_id);
+        return;
+    }
+
+    cpu_set_t set;
+    int ncpu = numa_node_cpuset(node, &set);
+    if (ncpu == 0)
+    {
+        printf("pin: no cpu list for NUMA node %d, host thread not pinned\n", node);
+        return;
+    }
+
+    if (policy == PIN_COMPACT)
+    {
+        int first = 0;
+        while (!CPU_ISSET(first, &set))
+            first++;
+        CPU_ZERO(&set);
+        CPU_SET(first, &set);
+        ncpu = 1;
+    }
+
+    if (sched_setaffinity(0, sizeof(cpu_set_t), &set) != 0)
+    {
+        printf("pin: sched_setaffinity failed, host thread not pinned\n");
+        return;
+    }
+    printf("pin: device %d is on NUMA node %d, host thread bound to %d cpu(s)\n", device_id, node, ncpu);
+}
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "utils.h"
+#include "findlevel.h"
 
 // code for for reordering columns of CSC according to level-set execution order
 void levelset_reordering_col_csc(const int *cscColPtrTR,
@@ -126,6 +127,8 @@ void levelset_reordering_colrow_csc(const int *cscColPtrTR,
 
     int nlv = 0;
     findlevel(cscColPtrTR, cscRowIdxTR, csrRowPtrTR, m, &nlv, levelPtr, levelItem);
+    if (LEVEL_LOCALITY_SORT)
+        findlevel_locality_sort(cscColPtrTR, cscRowIdxTR, m, nnzTR, nlv, levelPtr, levelItem);
 
     int *levelItem_tmp = (int *)malloc(m * sizeof(int));
     memcpy(levelItem_tmp, levelItem, m * sizeof(int));
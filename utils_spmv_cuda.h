@@ -9,6 +9,44 @@
 #define LONGROW_THRESHOLD 2048
 #define SHORTROW_THRESHOLD 8
 
+// square blocks at most this wide keep their column indices as unsigned short;
+// 0 keeps every block on 32-bit indices
+#ifndef INDEX16_MAX_WIDTH
+#define INDEX16_MAX_WIDTH 65536
+#endif
+
+// square blocks with at most this many distinct values store an 8-bit code per
+// nonzero into a table of those values (so at most 256); 0 keeps every block on plain values
+#ifndef VALUE_DICT_MAX
+#define VALUE_DICT_MAX 256
+#endif
+#if VALUE_DICT_MAX > 256
+#error "VALUE_DICT_MAX must fit 8-bit codes"
+#endif
+
+// sliced ELL (SELL-C-sigma) for short-row square blocks: the nonempty rows are sorted
+// by length inside windows of SELL_SIGMA rows and packed into slices of WARP_SIZE rows;
+// a block takes it when the padding stays under SELL_PADDING_LIMIT times its nnz.
+// SELL_SIGMA 0 keeps every block on CSR/DCSR
+#ifndef SELL_SIGMA
+#define SELL_SIGMA 256
+#endif
+#ifndef SELL_PADDING_LIMIT
+#define SELL_PADDING_LIMIT 1.2
+#endif
+
+// square blocks whose r x r tiles (r = 6, 4, 3 or 2, aligned to the block origin) are
+// at least BSR_MIN_FILL full are stored as BSR; a value above 1 disables it
+#ifndef BSR_MIN_FILL
+#define BSR_MIN_FILL 0.8
+#endif
+
+// merge-path SpMV, used for square blocks with rows over LONGROW_THRESHOLD: each thread
+// takes this many steps of the merge of row ends and nonzeros (0 keeps the longrow pass)
+#ifndef MERGE_PATH_ITEMS
+#define MERGE_PATH_ITEMS 8
+#endif
+
 typedef struct SpMV_block
 {
     int method;
@@ -25,8 +63,77 @@ typedef struct SpMV_block
     int m_new;
     int *d_longrow_idx;
     int longrow;
+    unsigned short *d_csrColIdx16; // local column indices when the block is narrow enough, else NULL
+    unsigned char *d_csrCode;      // codes into d_dict when the block has few distinct values, else NULL
+    VALUE_TYPE *d_dict;
+    int constant; // every stored value equals value; the block has no range in the compacted value arena
+    VALUE_TYPE value;
+    int sell_rows;    // sliced ELL copy of the block, used instead of the above when d_sell_ptr != NULL
+    int *d_sell_ptr;  // slice starts; entry k of lane r in slice s is at d_sell_ptr[s] + k * WARP_SIZE + r
+    int *d_sell_col;  // -1 pads a lane past the end of its row
+    VALUE_TYPE *d_sell_val;
+    int *d_sell_row;  // block row of each sorted position, merging the DCSR row map
+    int bsr_dim;      // BSR copy with bsr_dim x bsr_dim row-major tiles, used first when nonzero
+    int bsr_m;
+    int bsr_n;
+    int *d_bsr_ptr;
+    int *d_bsr_col;   // block column of each tile
+    VALUE_TYPE *d_bsr_val;
+    int merge_nnz;    // nonzero: merge-path over all rows, with no longrow pass
 } SpMV_block;
 
+template <typename T>
+__global__ void index_narrow_cuda(const int *d_idx,
+                                  T *d_idx_narrow,
+                                  const int n)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < n)
+        d_idx_narrow[global_id] = (T)d_idx[global_id];
+}
+
+// *d_flag = 1 when one of the n values is NaN, which sorting and searching do not order
+__global__ void value_nan_cuda(const VALUE_TYPE *d_val,
+                               const int n,
+                               int *d_flag)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < n && d_val[global_id] != d_val[global_id])
+        *d_flag = 1;
+}
+
+// a block whose stored values are all equal passes this instead of a value array
+typedef struct SpMV_constant
+{
+    VALUE_TYPE value;
+} SpMV_constant;
+
+__forceinline__ __device__ VALUE_TYPE spmv_term(const VALUE_TYPE xv, const VALUE_TYPE *d_csrVal, const VALUE_TYPE *d_dict, const int j)
+{
+    return xv * d_csrVal[j];
+}
+
+__forceinline__ __device__ VALUE_TYPE spmv_term(const VALUE_TYPE xv, const unsigned char *d_csrCode, const VALUE_TYPE *d_dict, const int j)
+{
+    return xv * d_dict[d_csrCode[j]];
+}
+
+__forceinline__ __device__ VALUE_TYPE spmv_term(const VALUE_TYPE xv, const SpMV_constant c, const VALUE_TYPE *d_dict, const int j)
+{
+    return xv;
+}
+
+template <typename vT>
+__forceinline__ __device__ VALUE_TYPE spmv_scale(const VALUE_TYPE sum, const vT *d_csrVal)
+{
+    return sum;
+}
+
+__forceinline__ __device__ VALUE_TYPE spmv_scale(const VALUE_TYPE sum, const SpMV_constant c)
+{
+    return sum * c.value;
+}
+
 __global__ void spmv_longrow_csr_cuda_executor(const int *d_csrRowPtr,
                                                const int *d_csrColIdx,
                                                const VALUE_TYPE *d_csrVal,
@@ -57,12 +164,14 @@ __global__ void spmv_longrow_csr_cuda_executor(const int *d_csrRowPtr,
     }
 }
 
+template <typename iT, typename vT>
 __global__ void spmv_threadsca_csr_cuda_executor(const int *d_csrRowPtr,
-                                                 const int *d_csrColIdx,
-                                                 const VALUE_TYPE *d_csrVal,
+                                                 const iT *d_csrColIdx,
+                                                 const vT d_csrVal,
                                                  const int m,
                                                  const VALUE_TYPE *d_x,
-                                                 VALUE_TYPE *d_y)
+                                                 VALUE_TYPE *d_y,
+                                                 const VALUE_TYPE *d_dict = NULL)
 {
     const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
     if (global_id < m)
@@ -74,19 +183,21 @@ __global__ void spmv_threadsca_csr_cuda_executor(const int *d_csrRowPtr,
         if (stop - start <= LONGROW_THRESHOLD)
         {
             for (int j = start; j < stop; j++)
-                sum += d_x[d_csrColIdx[j]] * d_csrVal[j];
+                sum += spmv_term(d_x[d_csrColIdx[j]], d_csrVal, d_dict, j);
         }
-        d_y[rowid] = sum;
+        d_y[rowid] = spmv_scale(sum, d_csrVal);
     }
 }
 
+template <typename iT, typename vT>
 __global__ void spmv_threadsca_dcsr_cuda_executor(const int *d_csrRowPtr,
-                                                  const int *d_csrColIdx,
-                                                  const VALUE_TYPE *d_csrVal,
+                                                  const iT *d_csrColIdx,
+                                                  const vT d_csrVal,
                                                   const int m,
                                                   const VALUE_TYPE *d_x,
                                                   VALUE_TYPE *d_y,
-                                                  const int *d_row_perm)
+                                                  const int *d_row_perm,
+                                                  const VALUE_TYPE *d_dict = NULL)
 {
     const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
     if (global_id < m)
@@ -98,9 +209,9 @@ __global__ void spmv_threadsca_dcsr_cuda_executor(const int *d_csrRowPtr,
         if (stop - start <= LONGROW_THRESHOLD)
         {
             for (int j = start; j < stop; j++)
-                sum += d_x[d_csrColIdx[j]] * d_csrVal[j];
+                sum += spmv_term(d_x[d_csrColIdx[j]], d_csrVal, d_dict, j);
         }
-        d_y[d_row_perm[rowid]] = sum;
+        d_y[d_row_perm[rowid]] = spmv_scale(sum, d_csrVal);
     }
 
     // const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
@@ -123,12 +234,14 @@ __global__ void spmv_threadsca_dcsr_cuda_executor(const int *d_csrRowPtr,
     // }
 }
 
+template <typename iT, typename vT>
 __global__ void spmv_warpvec_csr_cuda_executor(const int *d_csrRowPtr,
-                                               const int *d_csrColIdx,
-                                               const VALUE_TYPE *d_csrVal,
+                                               const iT *d_csrColIdx,
+                                               const vT d_csrVal,
                                                const int m,
                                                const VALUE_TYPE *d_x,
-                                               VALUE_TYPE *d_y)
+                                               VALUE_TYPE *d_y,
+                                               const VALUE_TYPE *d_dict = NULL)
 {
     const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
 
@@ -152,23 +265,25 @@ __global__ void spmv_warpvec_csr_cuda_executor(const int *d_csrRowPtr,
     {
         for (int j = start + lane_id; j < stop; j += WARP_SIZE)
         {
-            sum += d_x[d_csrColIdx[j]] * d_csrVal[j];
+            sum += spmv_term(d_x[d_csrColIdx[j]], d_csrVal, d_dict, j);
         }
         sum = sum_32_shfl(sum);
     }
 
     //finish
     if (!lane_id)
-        d_y[rowid] = sum;
+        d_y[rowid] = spmv_scale(sum, d_csrVal);
 }
 
+template <typename iT, typename vT>
 __global__ void spmv_warpvec_dcsr_cuda_executor(const int *d_csrRowPtr,
-                                                const int *d_csrColIdx,
-                                                const VALUE_TYPE *d_csrVal,
+                                                const iT *d_csrColIdx,
+                                                const vT d_csrVal,
                                                 const int m,
                                                 const VALUE_TYPE *d_x,
                                                 VALUE_TYPE *d_y,
-                                                const int *d_row_perm)
+                                                const int *d_row_perm,
+                                                const VALUE_TYPE *d_dict = NULL)
 {
     const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
 
@@ -192,14 +307,383 @@ __global__ void spmv_warpvec_dcsr_cuda_executor(const int *d_csrRowPtr,
     {
         for (int j = start + lane_id; j < stop; j += WARP_SIZE)
         {
-            sum += d_x[d_csrColIdx[j]] * d_csrVal[j];
+            sum += spmv_term(d_x[d_csrColIdx[j]], d_csrVal, d_dict, j);
         }
         sum = sum_32_shfl(sum);
     }
 
     //finish
     if (!lane_id)
-        d_y[d_row_perm[rowid]] = sum;
+        d_y[d_row_perm[rowid]] = spmv_scale(sum, d_csrVal);
+}
+
+// thread t walks steps [t * items, (t + 1) * items) of the merge of the row ends with the
+// nonzero indices; rows it does not both start and finish are added atomically into a
+// zeroed d_y
+template <typename iT, typename vT>
+__global__ void spmv_mergepath_csr_cuda_executor(const int *d_csrRowPtr,
+                                                 const iT *d_csrColIdx,
+                                                 const vT d_csrVal,
+                                                 const int m,
+                                                 const int nnz,
+                                                 const int items,
+                                                 const VALUE_TYPE *d_x,
+                                                 VALUE_TYPE *d_y,
+                                                 const int *d_row_perm,
+                                                 const VALUE_TYPE *d_dict = NULL)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    const int diag = global_id * items;
+    if (diag >= m + nnz)
+        return;
+    const int diag_end = diag + items < m + nnz ? diag + items : m + nnz;
+    const int base = d_csrRowPtr[0];
+
+    // rows i consumed before the diagonal: the first with row end > diag - 1 - i
+    int lo = diag - nnz > 0 ? diag - nnz : 0;
+    int hi = diag < m ? diag : m;
+    while (lo < hi)
+    {
+        const int mid = (lo + hi) / 2;
+        if (d_csrRowPtr[mid + 1] - base <= diag - 1 - mid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    int i = lo;
+    int j = diag - lo;
+    int started = i < m && j == d_csrRowPtr[i] - base;
+
+    VALUE_TYPE sum = 0;
+    for (int step = diag; step < diag_end; step++)
+    {
+        if (j < d_csrRowPtr[i + 1] - base)
+        {
+            sum += spmv_term(d_x[d_csrColIdx[j]], d_csrVal, d_dict, j);
+            j++;
+        }
+        else
+        {
+            const int row = d_row_perm == NULL ? i : d_row_perm[i];
+            if (started)
+                d_y[row] = spmv_scale(sum, d_csrVal);
+            else
+                atomicAdd(&d_y[row], spmv_scale(sum, d_csrVal));
+            sum = 0;
+            started = 1;
+            i++;
+        }
+    }
+    if (i < m && sum != 0)
+        atomicAdd(&d_y[d_row_perm == NULL ? i : d_row_perm[i]], spmv_scale(sum, d_csrVal));
+}
+
+template <int R>
+__global__ void spmv_bsr_cuda_executor(const int *d_bsr_ptr,
+                                       const int *d_bsr_col,
+                                       const VALUE_TYPE *d_bsr_val,
+                                       const int m,
+                                       const int n,
+                                       const VALUE_TYPE *d_x,
+                                       VALUE_TYPE *d_y)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id * R >= m)
+        return;
+
+    VALUE_TYPE sum[R];
+#pragma unroll
+    for (int r = 0; r < R; r++)
+        sum[r] = 0;
+    for (int t = d_bsr_ptr[global_id]; t < d_bsr_ptr[global_id + 1]; t++)
+    {
+        const int col = d_bsr_col[t] * R;
+        const VALUE_TYPE *tile = &d_bsr_val[t * R * R];
+        VALUE_TYPE xv[R];
+#pragma unroll
+        for (int c = 0; c < R; c++)
+            xv[c] = col + c < n ? d_x[col + c] : 0;
+#pragma unroll
+        for (int r = 0; r < R; r++)
+        {
+#pragma unroll
+            for (int c = 0; c < R; c++)
+                sum[r] += tile[r * R + c] * xv[c];
+        }
+    }
+#pragma unroll
+    for (int r = 0; r < R; r++)
+        if (global_id * R + r < m)
+            d_y[global_id * R + r] = sum[r];
+}
+
+// build the BSR copy of a square block given as CSR with local columns, with the
+// largest tile size that is full enough; returns 0 and leaves blk untouched if none is
+int spmv_bsr_create(SpMV_block *blk,
+                    const int *d_csrRowPtr,
+                    const int *d_csrColIdx,
+                    const VALUE_TYPE *d_csrVal,
+                    const int m,
+                    const int n,
+                    const int nnz)
+{
+    if (BSR_MIN_FILL > 1 || !nnz)
+        return 0;
+
+    int *csrRowPtr = (int *)malloc(sizeof(int) * (m + 1));
+    int *csrColIdx = (int *)malloc(sizeof(int) * nnz);
+    cudaMemcpy(csrRowPtr, d_csrRowPtr, sizeof(int) * (m + 1), cudaMemcpyDeviceToHost);
+    cudaMemcpy(csrColIdx, d_csrColIdx, sizeof(int) * nnz, cudaMemcpyDeviceToHost);
+
+    const int dims[4] = {6, 4, 3, 2};
+    int R = 0;
+    int *pos = (int *)malloc(sizeof(int) * (n + 1));
+    for (int d = 0; d < 4 && !R; d++)
+    {
+        int r = dims[d];
+        int mb = (m + r - 1) / r;
+        int nb = (n + r - 1) / r;
+        for (int j = 0; j < nb; j++)
+            pos[j] = -1;
+        long ntile = 0;
+        for (int ib = 0; ib < mb; ib++)
+            for (int i = ib * r; i < m && i < (ib + 1) * r; i++)
+                for (int j = csrRowPtr[i]; j < csrRowPtr[i + 1]; j++)
+                    if (pos[csrColIdx[j] / r] != ib)
+                    {
+                        pos[csrColIdx[j] / r] = ib;
+                        ntile++;
+                    }
+        if (nnz >= BSR_MIN_FILL * ntile * r * r)
+            R = r;
+    }
+    if (!R)
+    {
+        free(csrRowPtr);
+        free(csrColIdx);
+        free(pos);
+        return 0;
+    }
+
+    VALUE_TYPE *csrVal = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * nnz);
+    cudaMemcpy(csrVal, d_csrVal, sizeof(VALUE_TYPE) * nnz, cudaMemcpyDeviceToHost);
+    int mb = (m + R - 1) / R;
+    int nb = (n + R - 1) / R;
+    int *bsr_ptr = (int *)malloc(sizeof(int) * (mb + 1));
+    for (int j = 0; j < nb; j++)
+        pos[j] = -1;
+    bsr_ptr[0] = 0;
+    for (int ib = 0; ib < mb; ib++)
+    {
+        bsr_ptr[ib + 1] = bsr_ptr[ib];
+        for (int i = ib * R; i < m && i < (ib + 1) * R; i++)
+            for (int j = csrRowPtr[i]; j < csrRowPtr[i + 1]; j++)
+                if (pos[csrColIdx[j] / R] != ib)
+                {
+                    pos[csrColIdx[j] / R] = ib;
+                    bsr_ptr[ib + 1]++;
+                }
+    }
+    int ntile = bsr_ptr[mb];
+    int *bsr_col = (int *)malloc(sizeof(int) * ntile);
+    VALUE_TYPE *bsr_val = (VALUE_TYPE *)calloc((size_t)ntile * R * R, sizeof(VALUE_TYPE));
+    // pos now holds the tile of each block column within the current block row
+    for (int j = 0; j < nb; j++)
+        pos[j] = -1;
+    for (int ib = 0; ib < mb; ib++)
+    {
+        int t = bsr_ptr[ib];
+        for (int i = ib * R; i < m && i < (ib + 1) * R; i++)
+            for (int j = csrRowPtr[i]; j < csrRowPtr[i + 1]; j++)
+            {
+                int jb = csrColIdx[j] / R;
+                if (pos[jb] < bsr_ptr[ib])
+                {
+                    pos[jb] = t;
+                    bsr_col[t++] = jb;
+                }
+                bsr_val[(size_t)pos[jb] * R * R + (i % R) * R + csrColIdx[j] % R] = csrVal[j];
+            }
+    }
+
+    blk->bsr_dim = R;
+    blk->bsr_m = m;
+    blk->bsr_n = n;
+    cudaMalloc((void **)&(blk->d_bsr_ptr), sizeof(int) * (mb + 1));
+    cudaMalloc((void **)&(blk->d_bsr_col), sizeof(int) * ntile);
+    cudaMalloc((void **)&(blk->d_bsr_val), sizeof(VALUE_TYPE) * ntile * R * R);
+    cudaMemcpy(blk->d_bsr_ptr, bsr_ptr, sizeof(int) * (mb + 1), cudaMemcpyHostToDevice);
+    cudaMemcpy(blk->d_bsr_col, bsr_col, sizeof(int) * ntile, cudaMemcpyHostToDevice);
+    cudaMemcpy(blk->d_bsr_val, bsr_val, sizeof(VALUE_TYPE) * ntile * R * R, cudaMemcpyHostToDevice);
+
+    free(csrRowPtr);
+    free(csrColIdx);
+    free(csrVal);
+    free(pos);
+    free(bsr_ptr);
+    free(bsr_col);
+    free(bsr_val);
+    return 1;
+}
+
+// one thread per stored row of a sliced ELL block, walking its slice column by column
+__global__ void spmv_sell_cuda_executor(const int *d_sell_ptr,
+                                        const int *d_sell_col,
+                                        const VALUE_TYPE *d_sell_val,
+                                        const int *d_sell_row,
+                                        const int nrow,
+                                        const VALUE_TYPE *d_x,
+                                        VALUE_TYPE *d_y)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < nrow)
+    {
+        const int slice = global_id / WARP_SIZE;
+        const int lane_id = (WARP_SIZE - 1) & global_id;
+        VALUE_TYPE sum = 0;
+        for (int j = d_sell_ptr[slice] + lane_id; j < d_sell_ptr[slice + 1]; j += WARP_SIZE)
+        {
+            const int col = d_sell_col[j];
+            if (col < 0)
+                break;
+            sum += d_x[col] * d_sell_val[j];
+        }
+        d_y[d_sell_row[global_id]] = sum;
+    }
+}
+
+// build the sliced ELL copy of a square block given as CSR with local columns;
+// returns 0 and leaves blk untouched when the padding would be too large
+int spmv_sell_create(SpMV_block *blk,
+                     const int *d_csrRowPtr,
+                     const int *d_csrColIdx,
+                     const VALUE_TYPE *d_csrVal,
+                     const int m,
+                     const int nnz)
+{
+    if (!SELL_SIGMA || !nnz)
+        return 0;
+
+    int *csrRowPtr = (int *)malloc(sizeof(int) * (m + 1));
+    cudaMemcpy(csrRowPtr, d_csrRowPtr, sizeof(int) * (m + 1), cudaMemcpyDeviceToHost);
+
+    int *row = (int *)malloc(sizeof(int) * m);
+    int *key = (int *)malloc(sizeof(int) * m);
+    int nrow = 0;
+    for (int i = 0; i < m; i++)
+        if (csrRowPtr[i + 1] != csrRowPtr[i])
+        {
+            row[nrow] = i;
+            key[nrow] = -(csrRowPtr[i + 1] - csrRowPtr[i]);
+            nrow++;
+        }
+    for (int w = 0; w < nrow; w += SELL_SIGMA)
+        quicksort_keyval<int, int>(key, row, w, (w + SELL_SIGMA < nrow ? w + SELL_SIGMA : nrow) - 1);
+
+    int nslice = (nrow + WARP_SIZE - 1) / WARP_SIZE;
+    int *sell_ptr = (int *)malloc(sizeof(int) * (nslice + 1));
+    sell_ptr[0] = 0;
+    for (int s = 0; s < nslice; s++)
+    {
+        // the sort windows need not line up with the slices, so take the longest row of each
+        int width = 0;
+        for (int p = s * WARP_SIZE; p < nrow && p < (s + 1) * WARP_SIZE; p++)
+            width = -key[p] > width ? -key[p] : width;
+        sell_ptr[s + 1] = sell_ptr[s] + width * WARP_SIZE;
+    }
+    int padded = sell_ptr[nslice];
+    if (padded > SELL_PADDING_LIMIT * nnz)
+    {
+        free(csrRowPtr);
+        free(row);
+        free(key);
+        free(sell_ptr);
+        return 0;
+    }
+
+    int *csrColIdx = (int *)malloc(sizeof(int) * nnz);
+    VALUE_TYPE *csrVal = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * nnz);
+    cudaMemcpy(csrColIdx, d_csrColIdx, sizeof(int) * nnz, cudaMemcpyDeviceToHost);
+    cudaMemcpy(csrVal, d_csrVal, sizeof(VALUE_TYPE) * nnz, cudaMemcpyDeviceToHost);
+    int *sell_col = (int *)malloc(sizeof(int) * padded);
+    VALUE_TYPE *sell_val = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * padded);
+    for (int j = 0; j < padded; j++)
+    {
+        sell_col[j] = -1;
+        sell_val[j] = 0;
+    }
+    for (int p = 0; p < nrow; p++)
+    {
+        int base = sell_ptr[p / WARP_SIZE] + p % WARP_SIZE;
+        for (int j = csrRowPtr[row[p]]; j < csrRowPtr[row[p] + 1]; j++)
+        {
+            int k = j - csrRowPtr[row[p]];
+            sell_col[base + k * WARP_SIZE] = csrColIdx[j];
+            sell_val[base + k * WARP_SIZE] = csrVal[j];
+        }
+    }
+
+    blk->sell_rows = nrow;
+    cudaMalloc((void **)&(blk->d_sell_ptr), sizeof(int) * (nslice + 1));
+    cudaMalloc((void **)&(blk->d_sell_col), sizeof(int) * padded);
+    cudaMalloc((void **)&(blk->d_sell_val), sizeof(VALUE_TYPE) * padded);
+    cudaMalloc((void **)&(blk->d_sell_row), sizeof(int) * nrow);
+    cudaMemcpy(blk->d_sell_ptr, sell_ptr, sizeof(int) * (nslice + 1), cudaMemcpyHostToDevice);
+    cudaMemcpy(blk->d_sell_col, sell_col, sizeof(int) * padded, cudaMemcpyHostToDevice);
+    cudaMemcpy(blk->d_sell_val, sell_val, sizeof(VALUE_TYPE) * padded, cudaMemcpyHostToDevice);
+    cudaMemcpy(blk->d_sell_row, row, sizeof(int) * nrow, cudaMemcpyHostToDevice);
+
+    free(csrRowPtr);
+    free(csrColIdx);
+    free(csrVal);
+    free(row);
+    free(key);
+    free(sell_ptr);
+    free(sell_col);
+    free(sell_val);
+    return 1;
+}
+
+// b[col] -= A(row, col) * x[row] over the stored rows of A, i.e. b -= A^T x; d_row_perm
+// maps the stored rows of a DCSR block to block rows and is NULL for CSR
+__global__ void spmv_transpose_threadsca_csr_cuda_executor(const int *d_csrRowPtr,
+                                                           const int *d_csrColIdx,
+                                                           const VALUE_TYPE *d_csrVal,
+                                                           const int m,
+                                                           const VALUE_TYPE *d_x,
+                                                           VALUE_TYPE *d_b,
+                                                           const int *d_row_perm)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < m)
+    {
+        const int start = d_csrRowPtr[global_id] - d_csrRowPtr[0];
+        const int stop = d_csrRowPtr[global_id + 1] - d_csrRowPtr[0];
+        const VALUE_TYPE xr = d_x[d_row_perm == NULL ? global_id : d_row_perm[global_id]];
+        for (int j = start; j < stop; j++)
+            atomicAdd(&d_b[d_csrColIdx[j]], -d_csrVal[j] * xr);
+    }
+}
+
+__global__ void spmv_transpose_warpvec_csr_cuda_executor(const int *d_csrRowPtr,
+                                                         const int *d_csrColIdx,
+                                                         const VALUE_TYPE *d_csrVal,
+                                                         const int m,
+                                                         const VALUE_TYPE *d_x,
+                                                         VALUE_TYPE *d_b,
+                                                         const int *d_row_perm)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    const int rowid = global_id / WARP_SIZE;
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    if (rowid >= m)
+        return;
+
+    const int start = d_csrRowPtr[rowid] - d_csrRowPtr[0];
+    const int stop = d_csrRowPtr[rowid + 1] - d_csrRowPtr[0];
+    const VALUE_TYPE xr = d_x[d_row_perm == NULL ? rowid : d_row_perm[rowid]];
+    for (int j = start + lane_id; j < stop; j += WARP_SIZE)
+        atomicAdd(&d_b[d_csrColIdx[j]], -d_csrVal[j] * xr);
 }
 
 __global__ void subKernel(VALUE_TYPE *b,
@@ -211,4 +695,88 @@ __global__ void subKernel(VALUE_TYPE *b,
         b[global_id] = b[global_id] - y[global_id];
 }
 
+// row pass of a square block into blk->d_y; the longrow pass and the update of b stay with the caller
+template <typename iT, typename vT>
+void spmv_block_cuda_executor(const SpMV_block *blk,
+                              const int *d_csrRowPtr,
+                              const iT *d_csrColIdx,
+                              const vT d_csrVal,
+                              const VALUE_TYPE *d_x,
+                              const int *d_row_perm,
+                              cudaStream_t stream)
+{
+    if (blk->merge_nnz)
+    {
+        int rows = blk->method == 0 || blk->method == 2 ? blk->m : blk->m_new;
+        int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+        int num_blocks = ceil((double)(rows + blk->merge_nnz) / (double)(MERGE_PATH_ITEMS * num_threads));
+        cudaMemsetAsync(blk->d_y, 0, blk->m * sizeof(VALUE_TYPE), stream);
+        spmv_mergepath_csr_cuda_executor<<<num_blocks, num_threads, 0, stream>>>(d_csrRowPtr, d_csrColIdx, d_csrVal, rows, blk->merge_nnz, MERGE_PATH_ITEMS, d_x, blk->d_y,
+                                                                                 blk->method == 0 || blk->method == 2 ? NULL : d_row_perm, blk->d_dict);
+    }
+    else if (blk->method == 0)
+        spmv_threadsca_csr_cuda_executor<<<blk->num_blocks, blk->num_threads, 0, stream>>>(d_csrRowPtr, d_csrColIdx, d_csrVal, blk->m, d_x, blk->d_y, blk->d_dict);
+    else if (blk->method == 1)
+        spmv_threadsca_dcsr_cuda_executor<<<blk->num_blocks, blk->num_threads, 0, stream>>>(d_csrRowPtr, d_csrColIdx, d_csrVal, blk->m_new, d_x, blk->d_y, d_row_perm, blk->d_dict);
+    else if (blk->method == 2)
+        spmv_warpvec_csr_cuda_executor<<<blk->num_blocks, blk->num_threads, 0, stream>>>(d_csrRowPtr, d_csrColIdx, d_csrVal, blk->m, d_x, blk->d_y, blk->d_dict);
+    else if (blk->method == 3)
+        spmv_warpvec_dcsr_cuda_executor<<<blk->num_blocks, blk->num_threads, 0, stream>>>(d_csrRowPtr, d_csrColIdx, d_csrVal, blk->m_new, d_x, blk->d_y, d_row_perm, blk->d_dict);
+}
+
+// same, on the constant or the value codes of the block when it has them
+template <typename iT>
+void spmv_block_cuda_executor_values(const SpMV_block *blk,
+                                     const int *d_csrRowPtr,
+                                     const iT *d_csrColIdx,
+                                     const VALUE_TYPE *d_csrVal,
+                                     const VALUE_TYPE *d_x,
+                                     const int *d_row_perm,
+                                     cudaStream_t stream)
+{
+    if (blk->constant)
+    {
+        SpMV_constant c;
+        c.value = blk->value;
+        spmv_block_cuda_executor(blk, d_csrRowPtr, d_csrColIdx, c, d_x, d_row_perm, stream);
+    }
+    else if (blk->d_csrCode != NULL)
+        spmv_block_cuda_executor(blk, d_csrRowPtr, d_csrColIdx, blk->d_csrCode, d_x, d_row_perm, stream);
+    else
+        spmv_block_cuda_executor(blk, d_csrRowPtr, d_csrColIdx, d_csrVal, d_x, d_row_perm, stream);
+}
+
+// same, on the BSR or sliced ELL copy or the narrowest index and value storage the block has
+void spmv_block_cuda_executor_compact(const SpMV_block *blk,
+                                      const int *d_csrRowPtr,
+                                      const int *d_csrColIdx,
+                                      const VALUE_TYPE *d_csrVal,
+                                      const VALUE_TYPE *d_x,
+                                      const int *d_row_perm,
+                                      cudaStream_t stream)
+{
+    if (blk->bsr_dim)
+    {
+        int num_blocks = ceil((double)((blk->bsr_m + blk->bsr_dim - 1) / blk->bsr_dim) / (double)blk->num_threads);
+        if (blk->bsr_dim == 2)
+            spmv_bsr_cuda_executor<2><<<num_blocks, blk->num_threads, 0, stream>>>(blk->d_bsr_ptr, blk->d_bsr_col, blk->d_bsr_val, blk->bsr_m, blk->bsr_n, d_x, blk->d_y);
+        else if (blk->bsr_dim == 3)
+            spmv_bsr_cuda_executor<3><<<num_blocks, blk->num_threads, 0, stream>>>(blk->d_bsr_ptr, blk->d_bsr_col, blk->d_bsr_val, blk->bsr_m, blk->bsr_n, d_x, blk->d_y);
+        else if (blk->bsr_dim == 4)
+            spmv_bsr_cuda_executor<4><<<num_blocks, blk->num_threads, 0, stream>>>(blk->d_bsr_ptr, blk->d_bsr_col, blk->d_bsr_val, blk->bsr_m, blk->bsr_n, d_x, blk->d_y);
+        else
+            spmv_bsr_cuda_executor<6><<<num_blocks, blk->num_threads, 0, stream>>>(blk->d_bsr_ptr, blk->d_bsr_col, blk->d_bsr_val, blk->bsr_m, blk->bsr_n, d_x, blk->d_y);
+    }
+    else if (blk->d_sell_ptr != NULL)
+    {
+        int num_blocks = ceil((double)blk->sell_rows / (double)blk->num_threads);
+        spmv_sell_cuda_executor<<<num_blocks, blk->num_threads, 0, stream>>>(blk->d_sell_ptr, blk->d_sell_col, blk->d_sell_val, blk->d_sell_row,
+                                                                             blk->sell_rows, d_x, blk->d_y);
+    }
+    else if (blk->d_csrColIdx16 != NULL)
+        spmv_block_cuda_executor_values(blk, d_csrRowPtr, blk->d_csrColIdx16, d_csrVal, d_x, d_row_perm, stream);
+    else
+        spmv_block_cuda_executor_values(blk, d_csrRowPtr, d_csrColIdx, d_csrVal, d_x, d_row_perm, stream);
+}
+
 #endif
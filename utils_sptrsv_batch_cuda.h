@@ -0,0 +1,377 @@
+#ifndef _UTILS_SPTRSV_BATCH_CUDA_
+#define _UTILS_SPTRSV_BATCH_CUDA_
+
+#include "common.h"
+#include "tranpose.h"
+#include <cuda_runtime.h>
+
+// threads of the thread block that solves one system of a batch
+#ifndef BATCH_THREADS
+#define BATCH_THREADS (WARP_PER_BLOCK * WARP_SIZE)
+#endif
+
+// Many small independent triangles solved by one launch: every system is packed into
+// one CSR arena (its rows, columns and levels shifted by the systems before it) and
+// thread block s solves system s level by level, with __syncthreads between levels.
+// Vectors are packed the same way, system s owning rows sys_row[s]..sys_row[s+1]-1.
+typedef struct SpTRSV_batch
+{
+    int nsys;
+    int substitution;
+    int m_total;
+    int nnz_total;
+    int nlv_total;
+    int *sys_row; // host copies of the system offsets
+    int *sys_lv;
+    int *d_sys_row;
+    int *d_sys_lv;
+    int *d_levelPtr; // arena-wide, over the levels of all systems
+    int *d_levelItem;
+    int *d_csrRowPtr;
+    int *d_csrColIdx;
+    VALUE_TYPE *d_csrVal;
+} SpTRSV_batch;
+
+__global__ void sptrsv_batch_levelset_cuda(const int *d_sys_lv,
+                                           const int *d_levelPtr,
+                                           const int *d_levelItem,
+                                           const int *d_csrRowPtr,
+                                           const int *d_csrColIdx,
+                                           const VALUE_TYPE *d_csrVal,
+                                           const int substitution,
+                                           const VALUE_TYPE *d_b,
+                                           VALUE_TYPE *d_x)
+{
+    const int sys = blockIdx.x;
+    for (int li = d_sys_lv[sys]; li < d_sys_lv[sys + 1]; li++)
+    {
+        for (int k = d_levelPtr[li] + threadIdx.x; k < d_levelPtr[li + 1]; k += blockDim.x)
+        {
+            const int row = d_levelItem[k];
+            const int rowstart = d_csrRowPtr[row];
+            const int rowstop = d_csrRowPtr[row + 1];
+            const int pos = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstart;
+            const int start_ptr = substitution == SUBSTITUTION_FORWARD ? rowstart : rowstart + 1;
+            const int stop_ptr = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstop;
+            VALUE_TYPE sum = 0;
+            for (int j = start_ptr; j < stop_ptr; j++)
+                sum += d_csrVal[j] * d_x[d_csrColIdx[j]];
+            d_x[row] = (d_b[row] - sum) / d_csrVal[pos];
+        }
+        __syncthreads();
+    }
+}
+
+// pack nsys host CSC triangles (all lower or all upper, with full diagonals) into
+// one arena, find the levels of each system and upload it all at once
+void sptrsv_batch_create(SpTRSV_batch *batch,
+                         const int nsys,
+                         int *const *cscColPtr,
+                         int *const *cscRowIdx,
+                         VALUE_TYPE *const *cscVal,
+                         const int *m,
+                         const int substitution)
+{
+    int *sys_row = (int *)malloc((nsys + 1) * sizeof(int));
+    int *sys_nnz = (int *)malloc((nsys + 1) * sizeof(int));
+    sys_row[0] = 0;
+    sys_nnz[0] = 0;
+    for (int s = 0; s < nsys; s++)
+    {
+        sys_row[s + 1] = sys_row[s] + m[s];
+        sys_nnz[s + 1] = sys_nnz[s] + cscColPtr[s][m[s]];
+    }
+    const int m_total = sys_row[nsys];
+    const int nnz_total = sys_nnz[nsys];
+
+    int *csrRowPtr = (int *)malloc((m_total + 1) * sizeof(int));
+    int *csrColIdx = (int *)malloc(nnz_total * sizeof(int));
+    VALUE_TYPE *csrVal = (VALUE_TYPE *)malloc(nnz_total * sizeof(VALUE_TYPE));
+    int *level = (int *)malloc(m_total * sizeof(int));
+    int *levelPtr = (int *)malloc((m_total + 1) * sizeof(int));
+    int *levelItem = (int *)malloc(m_total * sizeof(int));
+    int *sys_lv = (int *)malloc((nsys + 1) * sizeof(int));
+    sys_lv[0] = 0;
+    csrRowPtr[0] = 0;
+
+    for (int s = 0; s < nsys; s++)
+    {
+        const int ms = m[s];
+        const int r0 = sys_row[s];
+        const int p0 = sys_nnz[s];
+
+        // the CSR of a system is the transposed CSC, shifted into the arena
+        int *rowPtr = (int *)malloc((ms + 1) * sizeof(int));
+        matrix_transposition(ms, ms, cscColPtr[s][ms], cscColPtr[s], cscRowIdx[s], cscVal[s],
+                             &csrColIdx[p0], rowPtr, &csrVal[p0]);
+        for (int i = 0; i < ms; i++)
+            csrRowPtr[r0 + i + 1] = p0 + rowPtr[i + 1];
+        for (int p = p0; p < sys_nnz[s + 1]; p++)
+            csrColIdx[p] += r0;
+        free(rowPtr);
+
+        // levels in substitution order, then bucketed into the arena
+        int nlv = 0;
+        for (int ii = 0; ii < ms; ii++)
+        {
+            const int i = r0 + (substitution == SUBSTITUTION_FORWARD ? ii : ms - 1 - ii);
+            int lv = 0;
+            for (int p = csrRowPtr[i]; p < csrRowPtr[i + 1]; p++)
+                if (csrColIdx[p] != i && level[csrColIdx[p]] + 1 > lv)
+                    lv = level[csrColIdx[p]] + 1;
+            level[i] = lv;
+            if (lv + 1 > nlv)
+                nlv = lv + 1;
+        }
+        const int l0 = sys_lv[s];
+        sys_lv[s + 1] = l0 + nlv;
+        memset(&levelPtr[l0], 0, (nlv + 1) * sizeof(int));
+        for (int i = r0; i < r0 + ms; i++)
+            levelPtr[l0 + level[i] + 1]++;
+        levelPtr[l0] = r0;
+        for (int li = l0; li < l0 + nlv; li++)
+            levelPtr[li + 1] += levelPtr[li];
+        for (int i = r0; i < r0 + ms; i++)
+            levelItem[levelPtr[l0 + level[i]]++] = i;
+        for (int li = l0 + nlv; li > l0; li--)
+            levelPtr[li] = levelPtr[li - 1];
+        levelPtr[l0] = r0;
+    }
+    const int nlv_total = sys_lv[nsys];
+
+    batch->nsys = nsys;
+    batch->substitution = substitution;
+    batch->m_total = m_total;
+    batch->nnz_total = nnz_total;
+    batch->nlv_total = nlv_total;
+    batch->sys_row = sys_row;
+    batch->sys_lv = sys_lv;
+    cudaMalloc((void **)&(batch->d_sys_row), (nsys + 1) * sizeof(int));
+    cudaMalloc((void **)&(batch->d_sys_lv), (nsys + 1) * sizeof(int));
+    cudaMalloc((void **)&(batch->d_levelPtr), (nlv_total + 1) * sizeof(int));
+    cudaMalloc((void **)&(batch->d_levelItem), m_total * sizeof(int));
+    cudaMalloc((void **)&(batch->d_csrRowPtr), (m_total + 1) * sizeof(int));
+    cudaMalloc((void **)&(batch->d_csrColIdx), nnz_total * sizeof(int));
+    cudaMalloc((void **)&(batch->d_csrVal), nnz_total * sizeof(VALUE_TYPE));
+    cudaMemcpy(batch->d_sys_row, sys_row, (nsys + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(batch->d_sys_lv, sys_lv, (nsys + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(batch->d_levelPtr, levelPtr, (nlv_total + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(batch->d_levelItem, levelItem, m_total * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(batch->d_csrRowPtr, csrRowPtr, (m_total + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(batch->d_csrColIdx, csrColIdx, nnz_total * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(batch->d_csrVal, csrVal, nnz_total * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+
+    free(sys_nnz);
+    free(csrRowPtr);
+    free(csrColIdx);
+    free(csrVal);
+    free(level);
+    free(levelPtr);
+    free(levelItem);
+}
+
+// x_s = T_s \ b_s for every system s, with b and x packed as the arena rows
+void sptrsv_batch_solve(SpTRSV_batch *batch,
+                        const VALUE_TYPE *d_b,
+                        VALUE_TYPE *d_x,
+                        cudaStream_t stream)
+{
+    sptrsv_batch_levelset_cuda<<<batch->nsys, BATCH_THREADS, 0, stream>>>(batch->d_sys_lv, batch->d_levelPtr, batch->d_levelItem,
+                                                                          batch->d_csrRowPtr, batch->d_csrColIdx, batch->d_csrVal,
+                                                                          batch->substitution, d_b, d_x);
+}
+
+void sptrsv_batch_destroy(SpTRSV_batch *batch)
+{
+    free(batch->sys_row);
+    free(batch->sys_lv);
+    cudaFree(batch->d_sys_row);
+    cudaFree(batch->d_sys_lv);
+    cudaFree(batch->d_levelPtr);
+    cudaFree(batch->d_levelItem);
+    cudaFree(batch->d_csrRowPtr);
+    cudaFree(batch->d_csrColIdx);
+    cudaFree(batch->d_csrVal);
+}
+
+// Many systems sharing one pattern, solved in lockstep: the structure (CSR and level
+// schedule) is stored once and values and vectors are interleaved across the batch,
+// entry p of system k at p * nbatch + k. A warp takes one row for WARP_SIZE systems,
+// so every index load is a broadcast and every value or vector load is coalesced.
+typedef struct SpTRSV_lockstep
+{
+    int m;
+    int nnz;
+    int nbatch;
+    int substitution;
+    int nlv;
+    int *levelPtr; // host, for the launches
+    int *d_levelItem;
+    int *d_csrRowPtr;
+    int *d_csrColIdx;
+    int *d_csc2csr; // CSC entry p is CSR entry d_csc2csr[p]
+    VALUE_TYPE *d_csrVal;
+} SpTRSV_lockstep;
+
+__global__ void sptrsv_lockstep_level_cuda(const int *d_csrRowPtr,
+                                           const int *d_csrColIdx,
+                                           const VALUE_TYPE *d_csrVal,
+                                           const int *d_levelItem,
+                                           const int lv_begin,
+                                           const int lv_end,
+                                           const int nbatch,
+                                           const int substitution,
+                                           const VALUE_TYPE *d_b,
+                                           VALUE_TYPE *d_x)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    const int warp_id = global_id / WARP_SIZE;
+    const int slices = (nbatch + WARP_SIZE - 1) / WARP_SIZE;
+    const int item = lv_begin + warp_id / slices;
+    const int k = (warp_id % slices) * WARP_SIZE + lane_id;
+    if (item >= lv_end || k >= nbatch)
+        return;
+
+    const int row = d_levelItem[item];
+    const int rowstart = d_csrRowPtr[row];
+    const int rowstop = d_csrRowPtr[row + 1];
+    const int pos = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstart;
+    const int start_ptr = substitution == SUBSTITUTION_FORWARD ? rowstart : rowstart + 1;
+    const int stop_ptr = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstop;
+    VALUE_TYPE sum = 0;
+    for (int j = start_ptr; j < stop_ptr; j++)
+        sum += d_csrVal[(size_t)j * nbatch + k] * d_x[(size_t)d_csrColIdx[j] * nbatch + k];
+    d_x[(size_t)row * nbatch + k] = (d_b[(size_t)row * nbatch + k] - sum) / d_csrVal[(size_t)pos * nbatch + k];
+}
+
+__global__ void sptrsv_lockstep_values_cuda(const int *d_csc2csr,
+                                            const VALUE_TYPE *d_cscVal,
+                                            const int nnz,
+                                            const int nbatch,
+                                            VALUE_TYPE *d_csrVal)
+{
+    const size_t global_id = (size_t)blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < (size_t)nnz * nbatch)
+    {
+        const int p = global_id / nbatch;
+        const int k = global_id % nbatch;
+        d_csrVal[(size_t)d_csc2csr[p] * nbatch + k] = d_cscVal[global_id];
+    }
+}
+
+// the structure of a batch of nbatch systems from the host CSC pattern they share
+void sptrsv_lockstep_create(SpTRSV_lockstep *ls,
+                            const int *cscColPtr,
+                            const int *cscRowIdx,
+                            const int m,
+                            const int nbatch,
+                            const int substitution)
+{
+    const int nnz = cscColPtr[m];
+    int *csrRowPtr = (int *)malloc((m + 1) * sizeof(int));
+    int *csrColIdx = (int *)malloc(nnz * sizeof(int));
+    int *csc2csr = (int *)malloc(nnz * sizeof(int));
+    int *incr = (int *)malloc((m + 1) * sizeof(int));
+    memset(csrRowPtr, 0, (m + 1) * sizeof(int));
+    for (int p = 0; p < nnz; p++)
+        csrRowPtr[cscRowIdx[p] + 1]++;
+    for (int i = 0; i < m; i++)
+        csrRowPtr[i + 1] += csrRowPtr[i];
+    memcpy(incr, csrRowPtr, (m + 1) * sizeof(int));
+    for (int j = 0; j < m; j++)
+    {
+        for (int p = cscColPtr[j]; p < cscColPtr[j + 1]; p++)
+        {
+            int q = incr[cscRowIdx[p]]++;
+            csrColIdx[q] = j;
+            csc2csr[p] = q;
+        }
+    }
+
+    int *level = (int *)malloc(m * sizeof(int));
+    int nlv = 0;
+    for (int ii = 0; ii < m; ii++)
+    {
+        const int i = substitution == SUBSTITUTION_FORWARD ? ii : m - 1 - ii;
+        int lv = 0;
+        for (int p = csrRowPtr[i]; p < csrRowPtr[i + 1]; p++)
+            if (csrColIdx[p] != i && level[csrColIdx[p]] + 1 > lv)
+                lv = level[csrColIdx[p]] + 1;
+        level[i] = lv;
+        if (lv + 1 > nlv)
+            nlv = lv + 1;
+    }
+    int *levelPtr = (int *)malloc((nlv + 1) * sizeof(int));
+    int *levelItem = (int *)malloc(m * sizeof(int));
+    memset(levelPtr, 0, (nlv + 1) * sizeof(int));
+    for (int i = 0; i < m; i++)
+        levelPtr[level[i] + 1]++;
+    for (int li = 0; li < nlv; li++)
+        levelPtr[li + 1] += levelPtr[li];
+    memcpy(incr, levelPtr, nlv * sizeof(int));
+    for (int i = 0; i < m; i++)
+        levelItem[incr[level[i]]++] = i;
+
+    ls->m = m;
+    ls->nnz = nnz;
+    ls->nbatch = nbatch;
+    ls->substitution = substitution;
+    ls->nlv = nlv;
+    ls->levelPtr = levelPtr;
+    cudaMalloc((void **)&(ls->d_levelItem), m * sizeof(int));
+    cudaMalloc((void **)&(ls->d_csrRowPtr), (m + 1) * sizeof(int));
+    cudaMalloc((void **)&(ls->d_csrColIdx), nnz * sizeof(int));
+    cudaMalloc((void **)&(ls->d_csc2csr), nnz * sizeof(int));
+    cudaMalloc((void **)&(ls->d_csrVal), (size_t)nnz * nbatch * sizeof(VALUE_TYPE));
+    cudaMemcpy(ls->d_levelItem, levelItem, m * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(ls->d_csrRowPtr, csrRowPtr, (m + 1) * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(ls->d_csrColIdx, csrColIdx, nnz * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(ls->d_csc2csr, csc2csr, nnz * sizeof(int), cudaMemcpyHostToDevice);
+
+    free(csrRowPtr);
+    free(csrColIdx);
+    free(csc2csr);
+    free(incr);
+    free(level);
+    free(levelItem);
+}
+
+// load the values of all systems, given on the device in CSC order and interleaved
+// (entry p of system k at p * nbatch + k); can be called again for the next sweep
+void sptrsv_lockstep_set_values(SpTRSV_lockstep *ls,
+                                const VALUE_TYPE *d_cscVal)
+{
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)ls->nnz * ls->nbatch / (double)num_threads);
+    sptrsv_lockstep_values_cuda<<<num_blocks, num_threads>>>(ls->d_csc2csr, d_cscVal, ls->nnz, ls->nbatch, ls->d_csrVal);
+}
+
+// x_k = T_k \ b_k for all systems, with b and x interleaved (row i of system k at i * nbatch + k)
+void sptrsv_lockstep_solve(SpTRSV_lockstep *ls,
+                           const VALUE_TYPE *d_b,
+                           VALUE_TYPE *d_x,
+                           cudaStream_t stream)
+{
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int slices = (ls->nbatch + WARP_SIZE - 1) / WARP_SIZE;
+    for (int li = 0; li < ls->nlv; li++)
+    {
+        int warps = (ls->levelPtr[li + 1] - ls->levelPtr[li]) * slices;
+        int num_blocks = ceil((double)warps / (double)WARP_PER_BLOCK);
+        sptrsv_lockstep_level_cuda<<<num_blocks, num_threads, 0, stream>>>(ls->d_csrRowPtr, ls->d_csrColIdx, ls->d_csrVal, ls->d_levelItem,
+                                                                           ls->levelPtr[li], ls->levelPtr[li + 1], ls->nbatch, ls->substitution, d_b, d_x);
+    }
+}
+
+void sptrsv_lockstep_destroy(SpTRSV_lockstep *ls)
+{
+    free(ls->levelPtr);
+    cudaFree(ls->d_levelItem);
+    cudaFree(ls->d_csrRowPtr);
+    cudaFree(ls->d_csrColIdx);
+    cudaFree(ls->d_csc2csr);
+    cudaFree(ls->d_csrVal);
+}
+
+#endif
@@ -6,6 +6,77 @@
 #include "cusparse.h"
 #include "utils_reordering.h"
 
+// levels with at most this many rows are thin; runs of them are coalesced into one serial task
+#define THIN_LEVEL_THRESHOLD 4
+
+// kinds of task in a coalesced level-set schedule (serial_lv_array)
+#define LEVEL_TASK_PARALLEL 0
+#define LEVEL_TASK_SERIAL 1
+#define LEVEL_TASK_CHAIN 2
+// a chain task runs on one thread, so it is only used when its rows average at most this
+// many nonzeros (diagonal included); longer rows go to the one-warp serial task
+#define LEVEL_CHAIN_MAX_ROW_NNZ 2
+
+// rows per chunk (one thread block) in the point-to-point level-set method
+#define P2P_CHUNK_ROWS (WARP_PER_BLOCK * WARP_SIZE)
+// deepest triangle handed to the point-to-point method before falling back to sync-free
+#define P2P_LEVEL_THRESHOLD 2000
+
+// triangles up to DENSE_TRSV_MAX rows holding at least DENSE_TRSV_MIN_FILL of a full
+// triangle are also kept packed dense and solved by one thread block in shared memory
+#ifndef DENSE_TRSV_MAX
+#define DENSE_TRSV_MAX 1024
+#endif
+#ifndef DENSE_TRSV_MIN_FILL
+#define DENSE_TRSV_MIN_FILL 0.5
+#endif
+#define DENSE_TRSV_THREADS 256
+
+// supernodes: runs of at most SUPERNODE_MAX_WIDTH consecutive columns sharing their row
+// pattern below the diagonal, allowing SUPERNODE_RELAX explicit zeros per column; a
+// triangle takes the supernodal executor when they average SUPERNODE_MIN_WIDTH columns
+#define SUPERNODE_MAX_WIDTH WARP_SIZE
+#ifndef SUPERNODE_MIN_WIDTH
+#define SUPERNODE_MIN_WIDTH 4
+#endif
+#ifndef SUPERNODE_RELAX
+#define SUPERNODE_RELAX 0
+#endif
+
+// a triangle of at most INVERSE_MAX_ROWS rows and INVERSE_MIN_LEVELS or more levels is
+// replaced by its explicit inverse when that holds at most INVERSE_FILL_BUDGET times its
+// nnz; rows of the inverse then stay under the SpMV long-row threshold
+#define INVERSE_MAX_ROWS 2048
+#ifndef INVERSE_MIN_LEVELS
+#define INVERSE_MIN_LEVELS 8
+#endif
+#ifndef INVERSE_FILL_BUDGET
+#define INVERSE_FILL_BUDGET 4
+#endif
+// numerical safeguard: entries of the inverse grow geometrically with the depth of the
+// triangle, and the SpMV then cancels where substitution would not; an inverse with an
+// entry above INVERSE_MAX_GROWTH times the matching 1 / T(k,k) is rejected
+#ifndef INVERSE_MAX_GROWTH
+#define INVERSE_MAX_GROWTH 1e4
+#endif
+
+// a triangle as dense column-major panels, one per supernode, in lower form
+// (index-reversed when backward); supernodes are grouped into levels
+typedef struct SpTRSV_supernodal
+{
+    int m;
+    int substitution;
+    int nsuper;
+    int nlv;
+    int *levelPtr;      // host
+    int *d_levelItem;
+    int *d_super_ptr;   // first column of each supernode
+    int *d_row_ptr;     // rows of supernode s: d_row_idx[d_row_ptr[s] .. d_row_ptr[s + 1]), diagonal ones first
+    int *d_row_idx;
+    int *d_val_ptr;
+    VALUE_TYPE *d_val;  // panel of s starts at d_val_ptr[s], leading dimension = its number of rows
+} SpTRSV_supernodal;
+
 typedef struct SpTRSV_block
 {
     int method;
@@ -36,8 +107,188 @@ typedef struct SpTRSV_block
     int *m_lv_array;
     int *offset_array;
     int *nnz_lv_array;
+    int *serial_lv_array;
+    int nchunks;
+    int *d_chunk_ptr;
+    int *d_dep_ptr;
+    int *d_dep_idx;
+    int *d_chunk_done;
+    int *d_ticket;
+    VALUE_TYPE *d_dense; // packed lower copy (index-reversed when backward) used instead when not NULL
+    SpTRSV_supernodal *super; // used instead when not NULL and there is no dense copy
+    int *d_inv_ptr;           // CSR of the inverse, used before all of the above when not NULL
+    int *d_inv_idx;
+    VALUE_TYPE *d_inv_val;
+    VALUE_TYPE *d_inv_b;      // copy of b when x aliases it
 } SpTRSV_block;
 
+// number of launches the level-set method needs once runs of thin levels are coalesced
+int levelset_coalesced_nlv(const int *levelPtr,
+                           const int nlv)
+{
+    int ntask = 0;
+    int li = 0;
+    while (li < nlv)
+    {
+        int lj = li;
+        while (lj < nlv && levelPtr[lj + 1] - levelPtr[lj] <= THIN_LEVEL_THRESHOLD)
+            lj++;
+        li = lj - li >= 2 ? lj : li + 1;
+        ntask++;
+    }
+    return ntask;
+}
+
+// rewrite the per-level arrays of a level-set block into tasks: a run of two or more
+// thin levels becomes one serial task over its contiguous rows, and a run in which
+// every level has a single short row is a pure dependency chain solved by one thread
+void levelset_coalesce(SpTRSV_block *blk)
+{
+    int nlv = blk->nlv;
+    int ntask = 0;
+    blk->serial_lv_array = (int *)malloc(sizeof(int) * nlv);
+    int li = 0;
+    while (li < nlv)
+    {
+        int lj = li;
+        int chain = 1;
+        while (lj < nlv && blk->m_lv_array[lj] <= THIN_LEVEL_THRESHOLD)
+        {
+            chain &= blk->m_lv_array[lj] == 1;
+            lj++;
+        }
+        if (lj - li < 2)
+        {
+            lj = li + 1;
+            chain = 0;
+        }
+
+        int m_task = 0;
+        int nnz_task = 0;
+        for (int k = li; k < lj; k++)
+        {
+            m_task += blk->m_lv_array[k];
+            nnz_task += blk->nnz_lv_array[k];
+        }
+        blk->offset_array[ntask] = blk->offset_array[li];
+        blk->m_lv_array[ntask] = m_task;
+        blk->nnz_lv_array[ntask] = nnz_task;
+        chain &= nnz_task <= LEVEL_CHAIN_MAX_ROW_NNZ * m_task;
+        blk->serial_lv_array[ntask] = lj - li == 1 ? LEVEL_TASK_PARALLEL : (chain ? LEVEL_TASK_CHAIN : LEVEL_TASK_SERIAL);
+        ntask++;
+        li = lj;
+    }
+    blk->nlv = ntask;
+}
+
+// split a CSR triangle into chunks of mutually independent rows and record, for every
+// chunk, the earlier chunks it reads from; a dependency that is already implied through
+// another listed chunk is dropped, so each chunk waits only on the few it truly needs
+void sptrsv_p2p_analyser(const int *csrRowPtr,
+                         const int *csrColIdx,
+                         const int m,
+                         const int substitution,
+                         SpTRSV_block *blk)
+{
+    int *chunk_ptr = (int *)malloc(sizeof(int) * (m + 1));
+    int *chunk_of = (int *)malloc(sizeof(int) * m);
+    int nchunks = 0;
+    int start = 0;
+    chunk_ptr[0] = 0;
+    for (int k = 0; k < m; k++)
+    {
+        const int row = substitution == SUBSTITUTION_FORWARD ? k : m - 1 - k;
+        int split = k - start >= P2P_CHUNK_ROWS;
+        for (int j = csrRowPtr[row]; j < csrRowPtr[row + 1] && !split; j++)
+        {
+            const int col = csrColIdx[j];
+            const int kj = substitution == SUBSTITUTION_FORWARD ? col : m - 1 - col;
+            if (col != row && kj >= start)
+                split = 1;
+        }
+        if (split)
+        {
+            nchunks++;
+            chunk_ptr[nchunks] = k;
+            start = k;
+        }
+        chunk_of[k] = nchunks;
+    }
+    nchunks++;
+    chunk_ptr[nchunks] = m;
+
+    // direct dependencies of every chunk
+    int *mark = (int *)malloc(sizeof(int) * nchunks);
+    for (int c = 0; c < nchunks; c++)
+        mark[c] = -1;
+    int *dep_ptr = (int *)malloc(sizeof(int) * (nchunks + 1));
+    int *dep_idx = (int *)malloc(sizeof(int) * (csrRowPtr[m] - csrRowPtr[0]));
+    dep_ptr[0] = 0;
+    for (int c = 0; c < nchunks; c++)
+    {
+        dep_ptr[c + 1] = dep_ptr[c];
+        for (int k = chunk_ptr[c]; k < chunk_ptr[c + 1]; k++)
+        {
+            const int row = substitution == SUBSTITUTION_FORWARD ? k : m - 1 - k;
+            for (int j = csrRowPtr[row]; j < csrRowPtr[row + 1]; j++)
+            {
+                const int col = csrColIdx[j];
+                if (col == row)
+                    continue;
+                const int d = chunk_of[substitution == SUBSTITUTION_FORWARD ? col : m - 1 - col];
+                if (mark[d] != c)
+                {
+                    mark[d] = c;
+                    dep_idx[dep_ptr[c + 1]++] = d;
+                }
+            }
+        }
+    }
+
+    // transitive reduction over one hop: drop d if another dependency e of c depends on d
+    for (int c = 0; c < nchunks; c++)
+        mark[c] = -1;
+    int *red_ptr = (int *)malloc(sizeof(int) * (nchunks + 1));
+    int *red_idx = (int *)malloc(sizeof(int) * (dep_ptr[nchunks] + 1));
+    red_ptr[0] = 0;
+    for (int c = 0; c < nchunks; c++)
+    {
+        for (int k = dep_ptr[c]; k < dep_ptr[c + 1]; k++)
+        {
+            const int e = dep_idx[k];
+            for (int kk = dep_ptr[e]; kk < dep_ptr[e + 1]; kk++)
+                mark[dep_idx[kk]] = c;
+        }
+        red_ptr[c + 1] = red_ptr[c];
+        for (int k = dep_ptr[c]; k < dep_ptr[c + 1]; k++)
+            if (mark[dep_idx[k]] != c)
+                red_idx[red_ptr[c + 1]++] = dep_idx[k];
+    }
+    printf("p2p: %d chunks, %d of %d dependencies kept\n", nchunks, red_ptr[nchunks], dep_ptr[nchunks]);
+
+    blk->nchunks = nchunks;
+    blk->num_threads = P2P_CHUNK_ROWS;
+    blk->num_blocks = nchunks;
+    cudaMalloc((void **)&(blk->d_chunk_ptr), sizeof(int) * (nchunks + 1));
+    cudaMalloc((void **)&(blk->d_dep_ptr), sizeof(int) * (nchunks + 1));
+    cudaMalloc((void **)&(blk->d_dep_idx), sizeof(int) * (red_ptr[nchunks] + 1));
+    cudaMalloc((void **)&(blk->d_chunk_done), sizeof(int) * nchunks);
+    cudaMalloc((void **)&(blk->d_ticket), sizeof(int));
+    cudaMemcpy(blk->d_chunk_ptr, chunk_ptr, sizeof(int) * (nchunks + 1), cudaMemcpyHostToDevice);
+    cudaMemcpy(blk->d_dep_ptr, red_ptr, sizeof(int) * (nchunks + 1), cudaMemcpyHostToDevice);
+    cudaMemcpy(blk->d_dep_idx, red_idx, sizeof(int) * red_ptr[nchunks], cudaMemcpyHostToDevice);
+    cudaMemset(blk->d_chunk_done, 0, sizeof(int) * nchunks);
+    cudaMemset(blk->d_ticket, 0, sizeof(int));
+
+    free(chunk_ptr);
+    free(chunk_of);
+    free(mark);
+    free(dep_ptr);
+    free(dep_idx);
+    free(red_ptr);
+    free(red_idx);
+}
+
 __global__ void sptrsv_syncfree_csc_cuda_analyser(const int *d_cscRowIdx,
                                                   const int m,
                                                   const int nnz,
@@ -113,6 +364,53 @@ __global__ void sptrsv_syncfree_warpvec_csc_cuda_executor(const int *d_cscColPtr
         d_x[perm_id] = xi;
 }
 
+// sync-free on CSR: rows are handed out in topological order, and each lane waits for
+// the rows it reads to be flagged in d_ready before pulling them (used to solve with
+// the transpose of a block stored in CSC)
+__global__ void sptrsv_syncfree_warpvec_csr_cuda_executor(const int *d_csrRowPtr,
+                                                          const int *d_csrColIdx,
+                                                          const VALUE_TYPE *d_csrVal,
+                                                          int *d_ready,
+                                                          const int m,
+                                                          const int substitution,
+                                                          const VALUE_TYPE *d_b,
+                                                          VALUE_TYPE *d_x,
+                                                          int *d_id_extractor)
+{
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    int global_x_id = 0;
+    if (!lane_id)
+        global_x_id = atomicAdd(d_id_extractor, 1);
+    global_x_id = __shfl_sync(0xffffffff, global_x_id, 0);
+
+    if (global_x_id >= m)
+        return;
+
+    const int rowidx = substitution == SUBSTITUTION_FORWARD ? global_x_id : m - 1 - global_x_id;
+    const int rowstart = d_csrRowPtr[rowidx] - d_csrRowPtr[0];
+    const int rowstop = d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0];
+    const int pos = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstart;
+    const int start_ptr = substitution == SUBSTITUTION_FORWARD ? rowstart : rowstart + 1;
+    const int stop_ptr = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstop;
+
+    VALUE_TYPE sum = 0;
+    for (int j = start_ptr + lane_id; j < stop_ptr; j += WARP_SIZE)
+    {
+        const int col = d_csrColIdx[j];
+        while (((volatile int *)d_ready)[col] == 0)
+            ;
+        sum += d_csrVal[j] * ((volatile VALUE_TYPE *)d_x)[col];
+    }
+    sum = sum_32_shfl(sum);
+
+    if (!lane_id)
+    {
+        d_x[rowidx] = (d_b[rowidx] - sum) / d_csrVal[pos];
+        __threadfence();
+        atomicExch(&d_ready[rowidx], 1);
+    }
+}
+
 __global__ void sptrsv_levelset_threadsca_csr_cuda_executor_fasttrack(const int *d_csrRowPtr,
                                                                       const int *d_csrColIdx,
                                                                       const VALUE_TYPE *d_csrVal,
@@ -160,6 +458,122 @@ __global__ void sptrsv_levelset_threadsca_csr_cuda_executor(const int *d_csrRowP
     }
 }
 
+// one warp walks a run of thin levels row by row, in topological order
+__global__ void sptrsv_levelset_serial_csr_cuda_executor(const int *d_csrRowPtr,
+                                                         const int *d_csrColIdx,
+                                                         const VALUE_TYPE *d_csrVal,
+                                                         const int m,
+                                                         const int m_total,
+                                                         const int offset,
+                                                         const int substitution,
+                                                         const VALUE_TYPE *d_b,
+                                                         VALUE_TYPE *d_x)
+{
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    for (int r = 0; r < m; r++)
+    {
+        int rowidx = r + offset;
+        rowidx = substitution == SUBSTITUTION_FORWARD ? rowidx : m_total - 1 - rowidx;
+
+        const int start = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx] - d_csrRowPtr[0]) : (d_csrRowPtr[rowidx] - d_csrRowPtr[0]) + 1;
+        const int stop = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) : (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) + 1;
+
+        VALUE_TYPE sum = 0;
+        for (int j = start + lane_id; j < stop - 1; j += WARP_SIZE)
+            sum += d_x[d_csrColIdx[j]] * d_csrVal[j];
+        sum = sum_32_shfl(sum);
+
+        if (!lane_id)
+        {
+            const int pos = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) - 1 : (d_csrRowPtr[rowidx] - d_csrRowPtr[0]);
+            d_x[rowidx] = (d_b[rowidx] - sum) / d_csrVal[pos];
+        }
+        __syncwarp();
+    }
+}
+
+// a single thread solves a pure dependency chain (one row per level)
+__global__ void sptrsv_levelset_chain_csr_cuda_executor(const int *d_csrRowPtr,
+                                                        const int *d_csrColIdx,
+                                                        const VALUE_TYPE *d_csrVal,
+                                                        const int m,
+                                                        const int m_total,
+                                                        const int offset,
+                                                        const int substitution,
+                                                        const VALUE_TYPE *d_b,
+                                                        VALUE_TYPE *d_x)
+{
+    for (int r = 0; r < m; r++)
+    {
+        int rowidx = r + offset;
+        rowidx = substitution == SUBSTITUTION_FORWARD ? rowidx : m_total - 1 - rowidx;
+
+        const int start = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx] - d_csrRowPtr[0]) : (d_csrRowPtr[rowidx] - d_csrRowPtr[0]) + 1;
+        const int stop = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) : (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) + 1;
+        VALUE_TYPE sum = 0;
+        for (int j = start; j < stop - 1; j++)
+            sum += d_x[d_csrColIdx[j]] * d_csrVal[j];
+
+        const int pos = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) - 1 : d_csrRowPtr[rowidx] - d_csrRowPtr[0];
+        d_x[rowidx] = (d_b[rowidx] - sum) / d_csrVal[pos];
+    }
+}
+
+// single launch over all chunks; blocks take chunks in topological order through a ticket
+// that is never reset, so the ticket also yields the epoch that marks a chunk as done
+__global__ void sptrsv_p2p_threadsca_csr_cuda_executor(const int *d_csrRowPtr,
+                                                       const int *d_csrColIdx,
+                                                       const VALUE_TYPE *d_csrVal,
+                                                       const int m,
+                                                       const int substitution,
+                                                       const VALUE_TYPE *d_b,
+                                                       VALUE_TYPE *d_x,
+                                                       const int nchunks,
+                                                       const int *d_chunk_ptr,
+                                                       const int *d_dep_ptr,
+                                                       const int *d_dep_idx,
+                                                       volatile int *d_chunk_done,
+                                                       int *d_ticket)
+{
+    __shared__ int s_ticket;
+    if (!threadIdx.x)
+        s_ticket = atomicAdd(d_ticket, 1);
+    __syncthreads();
+    const int chunk = s_ticket % nchunks;
+    const int epoch = s_ticket / nchunks + 1;
+
+    // wait only for the chunks this one depends on
+    for (int k = d_dep_ptr[chunk] + threadIdx.x; k < d_dep_ptr[chunk + 1]; k += blockDim.x)
+    {
+        while (d_chunk_done[d_dep_idx[k]] < epoch)
+            ;
+    }
+    __threadfence();
+    __syncthreads();
+
+    const int k = d_chunk_ptr[chunk] + threadIdx.x;
+    if (k < d_chunk_ptr[chunk + 1])
+    {
+        const int rowidx = substitution == SUBSTITUTION_FORWARD ? k : m - 1 - k;
+        const int start = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx] - d_csrRowPtr[0]) : (d_csrRowPtr[rowidx] - d_csrRowPtr[0]) + 1;
+        const int stop = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) : (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) + 1;
+        // x is produced by other blocks during this launch, so bypass the non-coherent L1
+        const volatile VALUE_TYPE *d_x_v = d_x;
+        VALUE_TYPE sum = 0;
+        for (int j = start; j < stop - 1; j++)
+            sum += d_x_v[d_csrColIdx[j]] * d_csrVal[j];
+
+        const int pos = substitution == SUBSTITUTION_FORWARD ? (d_csrRowPtr[rowidx + 1] - d_csrRowPtr[0]) - 1 : d_csrRowPtr[rowidx] - d_csrRowPtr[0];
+        d_x[rowidx] = (d_b[rowidx] - sum) / d_csrVal[pos];
+    }
+
+    // publish
+    __threadfence();
+    __syncthreads();
+    if (!threadIdx.x)
+        d_chunk_done[chunk] = epoch;
+}
+
 __global__ void sptrsv_levelset_warpvec_csr_cuda_executor(const int *d_csrRowPtr,
                                                           const int *d_csrColIdx,
                                                           const VALUE_TYPE *d_csrVal,
@@ -215,4 +629,452 @@ __global__ void sptrsv_syncfree_csc_cuda_executor_fasttrack(const int *d_cscColP
     }
 }
 
+// column j of the packed lower triangle starts at j * m - j * (j - 1) / 2
+__forceinline__ __device__ __host__ int sptrsv_dense_pos(const int i, const int j, const int m)
+{
+    return j * m - j * (j - 1) / 2 + (i - j);
+}
+
+// one thread block: warp 0 solves each WARP_SIZE-wide diagonal tile with shuffles,
+// then all threads apply the tile to the rows below it
+__global__ void sptrsv_dense_cuda_executor(const VALUE_TYPE *d_dense,
+                                           const int m,
+                                           const int substitution,
+                                           const VALUE_TYPE *d_b,
+                                           VALUE_TYPE *d_x)
+{
+    __shared__ VALUE_TYPE s_x[DENSE_TRSV_MAX];
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+
+    for (int i = threadIdx.x; i < m; i += blockDim.x)
+        s_x[i] = d_b[substitution == SUBSTITUTION_FORWARD ? i : m - 1 - i];
+    __syncthreads();
+
+    for (int kb = 0; kb < m; kb += WARP_SIZE)
+    {
+        const int nb = m - kb < WARP_SIZE ? m - kb : WARP_SIZE;
+        if (threadIdx.x < WARP_SIZE)
+        {
+            VALUE_TYPE xv = lane_id < nb ? s_x[kb + lane_id] : 0;
+            for (int j = 0; j < nb; j++)
+            {
+                if (lane_id == j)
+                    xv /= d_dense[sptrsv_dense_pos(kb + j, kb + j, m)];
+                const VALUE_TYPE xj = __shfl_sync(0xffffffff, xv, j);
+                if (lane_id > j && lane_id < nb)
+                    xv -= d_dense[sptrsv_dense_pos(kb + lane_id, kb + j, m)] * xj;
+            }
+            if (lane_id < nb)
+                s_x[kb + lane_id] = xv;
+        }
+        __syncthreads();
+
+        for (int i = kb + nb + threadIdx.x; i < m; i += blockDim.x)
+        {
+            VALUE_TYPE sum = 0;
+            for (int j = 0; j < nb; j++)
+                sum += d_dense[sptrsv_dense_pos(i, kb + j, m)] * s_x[kb + j];
+            s_x[i] -= sum;
+        }
+        __syncthreads();
+    }
+
+    for (int i = threadIdx.x; i < m; i += blockDim.x)
+        d_x[substitution == SUBSTITUTION_FORWARD ? i : m - 1 - i] = s_x[i];
+}
+
+// packs a triangle given as CSR with local columns when it is small and dense enough;
+// returns 0 and leaves blk->d_dense NULL otherwise
+int sptrsv_dense_create(SpTRSV_block *blk,
+                        const int *d_csrRowPtr,
+                        const int *d_csrColIdx,
+                        const VALUE_TYPE *d_csrVal,
+                        const int m,
+                        const int nnz,
+                        const int substitution)
+{
+    if (m > DENSE_TRSV_MAX || nnz < DENSE_TRSV_MIN_FILL * ((double)m * (m + 1) / 2))
+        return 0;
+
+    int *csrRowPtr = (int *)malloc(sizeof(int) * (m + 1));
+    int *csrColIdx = (int *)malloc(sizeof(int) * nnz);
+    VALUE_TYPE *csrVal = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * nnz);
+    cudaMemcpy(csrRowPtr, d_csrRowPtr, sizeof(int) * (m + 1), cudaMemcpyDeviceToHost);
+    cudaMemcpy(csrColIdx, d_csrColIdx, sizeof(int) * nnz, cudaMemcpyDeviceToHost);
+    cudaMemcpy(csrVal, d_csrVal, sizeof(VALUE_TYPE) * nnz, cudaMemcpyDeviceToHost);
+
+    int size = m * (m + 1) / 2;
+    VALUE_TYPE *dense = (VALUE_TYPE *)calloc(size, sizeof(VALUE_TYPE));
+    for (int i = 0; i < m; i++)
+        for (int j = csrRowPtr[i]; j < csrRowPtr[i + 1]; j++)
+        {
+            if (substitution == SUBSTITUTION_FORWARD)
+                dense[sptrsv_dense_pos(i, csrColIdx[j], m)] = csrVal[j];
+            else
+                dense[sptrsv_dense_pos(m - 1 - i, m - 1 - csrColIdx[j], m)] = csrVal[j];
+        }
+
+    cudaMalloc((void **)&(blk->d_dense), sizeof(VALUE_TYPE) * size);
+    cudaMemcpy(blk->d_dense, dense, sizeof(VALUE_TYPE) * size, cudaMemcpyHostToDevice);
+    free(csrRowPtr);
+    free(csrColIdx);
+    free(csrVal);
+    free(dense);
+    return 1;
+}
+
+// one warp per supernode of the level: solve the diagonal tile with shuffles, then
+// subtract the panel below it from the right-hand side of later supernodes, kept in d_x
+__global__ void sptrsv_supernodal_cuda_executor(const int *d_super_ptr,
+                                                const int *d_row_ptr,
+                                                const int *d_row_idx,
+                                                const int *d_val_ptr,
+                                                const VALUE_TYPE *d_val,
+                                                const int *d_levelItem,
+                                                const int lv_start,
+                                                const int lv_end,
+                                                const int m,
+                                                const int substitution,
+                                                VALUE_TYPE *d_x)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    const int warp_id = global_id / WARP_SIZE;
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    if (warp_id >= lv_end - lv_start)
+        return;
+
+    const int sn = d_levelItem[lv_start + warp_id];
+    const int first = d_super_ptr[sn];
+    const int width = d_super_ptr[sn + 1] - first;
+    const int *rows = &d_row_idx[d_row_ptr[sn]];
+    const int nrow = d_row_ptr[sn + 1] - d_row_ptr[sn];
+    const VALUE_TYPE *panel = &d_val[d_val_ptr[sn]];
+
+    const int xidx = substitution == SUBSTITUTION_FORWARD ? first + lane_id : m - 1 - first - lane_id;
+    VALUE_TYPE xv = lane_id < width ? d_x[xidx] : 0;
+    for (int k = 0; k < width; k++)
+    {
+        if (lane_id == k)
+            xv /= panel[k * nrow + k];
+        const VALUE_TYPE xk = __shfl_sync(0xffffffff, xv, k);
+        if (lane_id > k && lane_id < width)
+            xv -= panel[k * nrow + lane_id] * xk;
+    }
+    if (lane_id < width)
+        d_x[xidx] = xv;
+
+    for (int pb = width; pb < nrow; pb += WARP_SIZE)
+    {
+        const int p = pb + lane_id;
+        VALUE_TYPE sum = 0;
+        for (int k = 0; k < width; k++)
+        {
+            const VALUE_TYPE xk = __shfl_sync(0xffffffff, xv, k);
+            if (p < nrow)
+                sum += panel[k * nrow + p] * xk;
+        }
+        if (p < nrow)
+            atomicAdd(&d_x[substitution == SUBSTITUTION_FORWARD ? rows[p] : m - 1 - rows[p]], -sum);
+    }
+}
+
+// finds the supernodes of a triangle given as CSC with local indices; returns NULL
+// when they are too narrow to pay off
+SpTRSV_supernodal *sptrsv_supernodal_create(const int *cscColPtr,
+                                            const int *cscRowIdx,
+                                            const VALUE_TYPE *cscVal,
+                                            const int m,
+                                            const int substitution)
+{
+    // lower form: a backward triangle is index-reversed
+    const int nnz = cscColPtr[m];
+    int *colPtr = (int *)malloc(sizeof(int) * (m + 1));
+    int *rowIdx = (int *)malloc(sizeof(int) * nnz);
+    VALUE_TYPE *val = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * nnz);
+    if (substitution == SUBSTITUTION_FORWARD)
+    {
+        memcpy(colPtr, cscColPtr, sizeof(int) * (m + 1));
+        memcpy(rowIdx, cscRowIdx, sizeof(int) * nnz);
+        memcpy(val, cscVal, sizeof(VALUE_TYPE) * nnz);
+    }
+    else
+    {
+        colPtr[0] = 0;
+        for (int j = 0; j < m; j++)
+            colPtr[j + 1] = colPtr[j] + cscColPtr[m - j] - cscColPtr[m - 1 - j];
+        for (int j = 0; j < m; j++)
+            for (int p = cscColPtr[m - 1 - j]; p < cscColPtr[m - j]; p++)
+            {
+                rowIdx[colPtr[j] + p - cscColPtr[m - 1 - j]] = m - 1 - cscRowIdx[p];
+                val[colPtr[j] + p - cscColPtr[m - 1 - j]] = cscVal[p];
+            }
+    }
+    for (int j = 0; j < m; j++)
+        quicksort_keyval<int, VALUE_TYPE>(rowIdx, val, colPtr[j], colPtr[j + 1] - 1);
+
+    // partition: column c joins the supernode of s while its pattern is inside that of s
+    int *super_ptr = (int *)malloc(sizeof(int) * (m + 1));
+    int nsuper = 0;
+    for (int s = 0; s < m;)
+    {
+        int c = s + 1;
+        for (; c < m && c - s < SUPERNODE_MAX_WIDTH; c++)
+        {
+            int p = colPtr[s];
+            while (p < colPtr[s + 1] && rowIdx[p] < c)
+                p++;
+            int avail = colPtr[s + 1] - p;
+            int q = colPtr[c];
+            for (; q < colPtr[c + 1]; q++)
+            {
+                while (p < colPtr[s + 1] && rowIdx[p] < rowIdx[q])
+                    p++;
+                if (p == colPtr[s + 1] || rowIdx[p] != rowIdx[q])
+                    break;
+            }
+            if (q < colPtr[c + 1] || avail - (colPtr[c + 1] - colPtr[c]) > SUPERNODE_RELAX)
+                break;
+        }
+        super_ptr[nsuper++] = s;
+        s = c;
+    }
+    super_ptr[nsuper] = m;
+    if (m < SUPERNODE_MIN_WIDTH * nsuper)
+    {
+        free(colPtr);
+        free(rowIdx);
+        free(val);
+        free(super_ptr);
+        return NULL;
+    }
+
+    // panels take the rows of their first column
+    int *row_ptr = (int *)malloc(sizeof(int) * (nsuper + 1));
+    int *val_ptr = (int *)malloc(sizeof(int) * (nsuper + 1));
+    row_ptr[0] = 0;
+    val_ptr[0] = 0;
+    for (int sn = 0; sn < nsuper; sn++)
+    {
+        int nrow = colPtr[super_ptr[sn] + 1] - colPtr[super_ptr[sn]];
+        row_ptr[sn + 1] = row_ptr[sn] + nrow;
+        val_ptr[sn + 1] = val_ptr[sn] + nrow * (super_ptr[sn + 1] - super_ptr[sn]);
+    }
+    int *row_idx = (int *)malloc(sizeof(int) * row_ptr[nsuper]);
+    VALUE_TYPE *panel = (VALUE_TYPE *)calloc(val_ptr[nsuper], sizeof(VALUE_TYPE));
+    int *super_of = (int *)malloc(sizeof(int) * m);
+    for (int sn = 0; sn < nsuper; sn++)
+    {
+        int first = super_ptr[sn];
+        int nrow = row_ptr[sn + 1] - row_ptr[sn];
+        memcpy(&row_idx[row_ptr[sn]], &rowIdx[colPtr[first]], sizeof(int) * nrow);
+        for (int c = first; c < super_ptr[sn + 1]; c++)
+        {
+            super_of[c] = sn;
+            int p = 0;
+            for (int q = colPtr[c]; q < colPtr[c + 1]; q++)
+            {
+                while (row_idx[row_ptr[sn] + p] != rowIdx[q])
+                    p++;
+                panel[val_ptr[sn] + (c - first) * nrow + p] = val[q];
+            }
+        }
+    }
+
+    // a supernode comes one level after every supernode whose panel updates it
+    int *level = (int *)calloc(nsuper, sizeof(int));
+    int nlv = 0;
+    for (int sn = 0; sn < nsuper; sn++)
+    {
+        int width = super_ptr[sn + 1] - super_ptr[sn];
+        for (int p = row_ptr[sn] + width; p < row_ptr[sn + 1]; p++)
+            if (level[super_of[row_idx[p]]] < level[sn] + 1)
+                level[super_of[row_idx[p]]] = level[sn] + 1;
+        nlv = level[sn] + 1 > nlv ? level[sn] + 1 : nlv;
+    }
+    int *levelPtr = (int *)calloc(nlv + 1, sizeof(int));
+    int *levelItem = (int *)malloc(sizeof(int) * nsuper);
+    for (int sn = 0; sn < nsuper; sn++)
+        levelPtr[level[sn] + 1]++;
+    for (int li = 0; li < nlv; li++)
+        levelPtr[li + 1] += levelPtr[li];
+    for (int sn = 0; sn < nsuper; sn++)
+        levelItem[levelPtr[level[sn]]++] = sn;
+    for (int li = nlv; li > 0; li--)
+        levelPtr[li] = levelPtr[li - 1];
+    levelPtr[0] = 0;
+
+    SpTRSV_supernodal *sup = (SpTRSV_supernodal *)malloc(sizeof(SpTRSV_supernodal));
+    sup->m = m;
+    sup->substitution = substitution;
+    sup->nsuper = nsuper;
+    sup->nlv = nlv;
+    sup->levelPtr = levelPtr;
+    cudaMalloc((void **)&(sup->d_levelItem), sizeof(int) * nsuper);
+    cudaMalloc((void **)&(sup->d_super_ptr), sizeof(int) * (nsuper + 1));
+    cudaMalloc((void **)&(sup->d_row_ptr), sizeof(int) * (nsuper + 1));
+    cudaMalloc((void **)&(sup->d_row_idx), sizeof(int) * row_ptr[nsuper]);
+    cudaMalloc((void **)&(sup->d_val_ptr), sizeof(int) * (nsuper + 1));
+    cudaMalloc((void **)&(sup->d_val), sizeof(VALUE_TYPE) * val_ptr[nsuper]);
+    cudaMemcpy(sup->d_levelItem, levelItem, sizeof(int) * nsuper, cudaMemcpyHostToDevice);
+    cudaMemcpy(sup->d_super_ptr, super_ptr, sizeof(int) * (nsuper + 1), cudaMemcpyHostToDevice);
+    cudaMemcpy(sup->d_row_ptr, row_ptr, sizeof(int) * (nsuper + 1), cudaMemcpyHostToDevice);
+    cudaMemcpy(sup->d_row_idx, row_idx, sizeof(int) * row_ptr[nsuper], cudaMemcpyHostToDevice);
+    cudaMemcpy(sup->d_val_ptr, val_ptr, sizeof(int) * (nsuper + 1), cudaMemcpyHostToDevice);
+    cudaMemcpy(sup->d_val, panel, sizeof(VALUE_TYPE) * val_ptr[nsuper], cudaMemcpyHostToDevice);
+
+    free(colPtr);
+    free(rowIdx);
+    free(val);
+    free(super_ptr);
+    free(row_ptr);
+    free(val_ptr);
+    free(row_idx);
+    free(panel);
+    free(super_of);
+    free(level);
+    free(levelItem);
+    return sup;
+}
+
+// x = T \ b level by level; x may alias b
+void sptrsv_supernodal_solve(const SpTRSV_supernodal *sup,
+                             const VALUE_TYPE *d_b,
+                             VALUE_TYPE *d_x,
+                             cudaStream_t stream)
+{
+    if (d_x != d_b)
+        cudaMemcpyAsync(d_x, d_b, sizeof(VALUE_TYPE) * sup->m, cudaMemcpyDeviceToDevice, stream);
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    for (int li = 0; li < sup->nlv; li++)
+    {
+        int nsn = sup->levelPtr[li + 1] - sup->levelPtr[li];
+        int num_blocks = ceil((double)nsn / (double)WARP_PER_BLOCK);
+        sptrsv_supernodal_cuda_executor<<<num_blocks, num_threads, 0, stream>>>(sup->d_super_ptr, sup->d_row_ptr, sup->d_row_idx, sup->d_val_ptr, sup->d_val,
+                                                                                sup->d_levelItem, sup->levelPtr[li], sup->levelPtr[li + 1], sup->m, sup->substitution, d_x);
+    }
+}
+
+void sptrsv_supernodal_destroy(SpTRSV_supernodal *sup)
+{
+    free(sup->levelPtr);
+    cudaFree(sup->d_levelItem);
+    cudaFree(sup->d_super_ptr);
+    cudaFree(sup->d_row_ptr);
+    cudaFree(sup->d_row_idx);
+    cudaFree(sup->d_val_ptr);
+    cudaFree(sup->d_val);
+    free(sup);
+}
+
+// computes inv(T) for a triangle given as CSC with local indices, column by column in
+// lower form; returns 0 and leaves blk untouched as soon as the fill exceeds the budget
+int sptrsv_inverse_create(SpTRSV_block *blk,
+                          const int *cscColPtr,
+                          const int *cscRowIdx,
+                          const VALUE_TYPE *cscVal,
+                          const int m,
+                          const int substitution)
+{
+    const int nnz = cscColPtr[m];
+    if (m > INVERSE_MAX_ROWS)
+        return 0;
+    const long budget = (long)INVERSE_FILL_BUDGET * nnz;
+
+    // column j of T (lower form) is column rev(j) of the input
+    int *diag = (int *)malloc(sizeof(int) * m);
+    for (int j = 0; j < m; j++)
+    {
+        int c = substitution == SUBSTITUTION_FORWARD ? j : m - 1 - j;
+        diag[j] = -1;
+        for (int p = cscColPtr[c]; p < cscColPtr[c + 1]; p++)
+            if (cscRowIdx[p] == c)
+                diag[j] = p;
+    }
+
+    int *inv_row = (int *)malloc(sizeof(int) * budget);
+    int *inv_col = (int *)malloc(sizeof(int) * budget);
+    VALUE_TYPE *inv_val = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * budget);
+    VALUE_TYPE *z = (VALUE_TYPE *)calloc(m, sizeof(VALUE_TYPE));
+    char *touched = (char *)calloc(m, sizeof(char));
+    long fill = 0;
+    int ok = 1;
+    for (int j = 0; j < m && ok; j++)
+    {
+        // T z = e_j; z is nonzero only on rows reachable from j, all at or below it
+        z[j] = 1;
+        touched[j] = 1;
+        for (int k = j; k < m; k++)
+        {
+            if (!touched[k])
+                continue;
+            touched[k] = 0;
+            if (fill == budget || diag[k] < 0)
+            {
+                ok = 0;
+                break;
+            }
+            int c = substitution == SUBSTITUTION_FORWARD ? k : m - 1 - k;
+            if (fabs(z[k]) > INVERSE_MAX_GROWTH)
+            {
+                ok = 0;
+                break;
+            }
+            z[k] /= cscVal[diag[k]];
+            for (int p = cscColPtr[c]; p < cscColPtr[c + 1]; p++)
+            {
+                int i = substitution == SUBSTITUTION_FORWARD ? cscRowIdx[p] : m - 1 - cscRowIdx[p];
+                if (i > k)
+                {
+                    z[i] -= cscVal[p] * z[k];
+                    touched[i] = 1;
+                }
+            }
+            inv_row[fill] = substitution == SUBSTITUTION_FORWARD ? k : m - 1 - k;
+            inv_col[fill] = substitution == SUBSTITUTION_FORWARD ? j : m - 1 - j;
+            inv_val[fill] = z[k];
+            fill++;
+            z[k] = 0;
+        }
+    }
+
+    if (ok)
+    {
+        // triplets to CSR by row
+        int *inv_ptr = (int *)calloc(m + 1, sizeof(int));
+        for (long p = 0; p < fill; p++)
+            inv_ptr[inv_row[p] + 1]++;
+        for (int i = 0; i < m; i++)
+            inv_ptr[i + 1] += inv_ptr[i];
+        int *pos = (int *)malloc(sizeof(int) * m);
+        memcpy(pos, inv_ptr, sizeof(int) * m);
+        int *csr_idx = (int *)malloc(sizeof(int) * fill);
+        VALUE_TYPE *csr_val = (VALUE_TYPE *)malloc(sizeof(VALUE_TYPE) * fill);
+        for (long p = 0; p < fill; p++)
+        {
+            csr_idx[pos[inv_row[p]]] = inv_col[p];
+            csr_val[pos[inv_row[p]]++] = inv_val[p];
+        }
+
+        cudaMalloc((void **)&(blk->d_inv_ptr), sizeof(int) * (m + 1));
+        cudaMalloc((void **)&(blk->d_inv_idx), sizeof(int) * fill);
+        cudaMalloc((void **)&(blk->d_inv_val), sizeof(VALUE_TYPE) * fill);
+        cudaMalloc((void **)&(blk->d_inv_b), sizeof(VALUE_TYPE) * m);
+        cudaMemcpy(blk->d_inv_ptr, inv_ptr, sizeof(int) * (m + 1), cudaMemcpyHostToDevice);
+        cudaMemcpy(blk->d_inv_idx, csr_idx, sizeof(int) * fill, cudaMemcpyHostToDevice);
+        cudaMemcpy(blk->d_inv_val, csr_val, sizeof(VALUE_TYPE) * fill, cudaMemcpyHostToDevice);
+        free(inv_ptr);
+        free(pos);
+        free(csr_idx);
+        free(csr_val);
+    }
+
+    free(diag);
+    free(inv_row);
+    free(inv_col);
+    free(inv_val);
+    free(z);
+    free(touched);
+    return ok;
+}
+
 #endif
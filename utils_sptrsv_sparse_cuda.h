@@ -0,0 +1,630 @@
+#ifndef _UTILS_SPTRSV_SPARSE_CUDA_
+#define _UTILS_SPTRSV_SPARSE_CUDA_
+
+#include "common.h"
+#include "utils.h"
+#include <cuda_runtime.h>
+
+// average number of columns per level of the reach below which the whole reach is
+// solved by one warp in topological order instead of one launch per level
+#define SPARSE_RHS_PARALLEL_WIDTH (WARP_PER_BLOCK * WARP_SIZE)
+
+// Solve with a sparse b: x is nonzero only on the set of rows reachable from the
+// nonzeros of b through the column graph of the triangle (Gilbert-Peierls), so the
+// reach is found by a depth-first search on the host and only those columns are
+// pushed on the device. Nothing here touches O(m) or O(nnz) data per solve.
+typedef struct SpTRSV_sparse_rhs
+{
+    int m;
+    int substitution;
+    const int *cscColPtr; // host copy of the structure, for the search
+    const int *cscRowIdx;
+    const int *d_cscColPtr;
+    const int *d_cscRowIdx;
+    const VALUE_TYPE *d_cscVal;
+    int stamp;
+    int *mark;   // mark[j] == stamp: column j is in the current reach
+    int *stack;  // dfs stack of columns
+    int *pstack; // and of the position reached in each column
+    int *reach;  // topological order of the reach, in reach[top..m-1]
+    int *level;
+    int *levelPtr;
+    int *levelItem;
+    int *d_levelItem;
+    int *d_b_idx;
+    VALUE_TYPE *d_b_val;
+    VALUE_TYPE *d_x; // dense workspace, only ever read and written on the reach
+    VALUE_TYPE *d_x_val;
+} SpTRSV_sparse_rhs;
+
+__global__ void sptrsv_sparse_rhs_init_cuda(VALUE_TYPE *d_x,
+                                            const int *d_levelItem,
+                                            const int nreach)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < nreach)
+        d_x[d_levelItem[global_id]] = 0;
+}
+
+__global__ void sptrsv_sparse_rhs_scatter_cuda(VALUE_TYPE *d_x,
+                                               const int *d_b_idx,
+                                               const VALUE_TYPE *d_b_val,
+                                               const int nnzb)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < nnzb)
+        d_x[d_b_idx[global_id]] = d_b_val[global_id];
+}
+
+// one warp per column of a level of the reach: finish x_j, then push x_j down its column
+__global__ void sptrsv_sparse_rhs_push_cuda(const int *d_cscColPtr,
+                                            const int *d_cscRowIdx,
+                                            const VALUE_TYPE *d_cscVal,
+                                            const int *d_levelItem,
+                                            const int lv_begin,
+                                            const int lv_end,
+                                            const int substitution,
+                                            VALUE_TYPE *d_x)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    const int item = lv_begin + global_id / WARP_SIZE;
+    if (item >= lv_end)
+        return;
+
+    const int col = d_levelItem[item];
+    const int colstart = d_cscColPtr[col];
+    const int colstop = d_cscColPtr[col + 1];
+    const int pos = substitution == SUBSTITUTION_FORWARD ? colstart : colstop - 1;
+    const VALUE_TYPE xj = d_x[col] / d_cscVal[pos];
+    __syncwarp();
+    if (!lane_id)
+        d_x[col] = xj;
+
+    const int start_ptr = substitution == SUBSTITUTION_FORWARD ? colstart + 1 : colstart;
+    const int stop_ptr = substitution == SUBSTITUTION_FORWARD ? colstop : colstop - 1;
+    for (int j = start_ptr + lane_id; j < stop_ptr; j += WARP_SIZE)
+        atomicAdd(&d_x[d_cscRowIdx[j]], -xj * d_cscVal[j]);
+}
+
+// the whole reach by one warp, column after column in topological order
+__global__ void sptrsv_sparse_rhs_serial_cuda(const int *d_cscColPtr,
+                                              const int *d_cscRowIdx,
+                                              const VALUE_TYPE *d_cscVal,
+                                              const int *d_levelItem,
+                                              const int nreach,
+                                              const int substitution,
+                                              VALUE_TYPE *d_x)
+{
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    for (int item = 0; item < nreach; item++)
+    {
+        const int col = d_levelItem[item];
+        const int colstart = d_cscColPtr[col];
+        const int colstop = d_cscColPtr[col + 1];
+        const int pos = substitution == SUBSTITUTION_FORWARD ? colstart : colstop - 1;
+        const VALUE_TYPE xj = d_x[col] / d_cscVal[pos];
+        __syncwarp();
+        if (!lane_id)
+            d_x[col] = xj;
+
+        // distinct rows within a column, so no atomics are needed inside one warp
+        const int start_ptr = substitution == SUBSTITUTION_FORWARD ? colstart + 1 : colstart;
+        const int stop_ptr = substitution == SUBSTITUTION_FORWARD ? colstop : colstop - 1;
+        for (int j = start_ptr + lane_id; j < stop_ptr; j += WARP_SIZE)
+            d_x[d_cscRowIdx[j]] -= xj * d_cscVal[j];
+        __syncwarp();
+    }
+}
+
+// d_v[idx[k]] += val[k]
+__global__ void sptrsv_sparse_rhs_accumulate_cuda(VALUE_TYPE *d_v,
+                                                  const int *d_idx,
+                                                  const VALUE_TYPE *d_val,
+                                                  const int nnz)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < nnz)
+        d_v[d_idx[global_id]] += d_val[global_id];
+}
+
+__global__ void sptrsv_sparse_rhs_add_cuda(const VALUE_TYPE *d_dx,
+                                           const int *d_levelItem,
+                                           const int nreach,
+                                           VALUE_TYPE *d_x)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < nreach)
+    {
+        const int row = d_levelItem[global_id];
+        d_x[row] += d_dx[row];
+    }
+}
+
+__global__ void sptrsv_sparse_rhs_gather_cuda(const VALUE_TYPE *d_x,
+                                              const int *d_levelItem,
+                                              const int nreach,
+                                              VALUE_TYPE *d_x_val)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    if (global_id < nreach)
+        d_x_val[global_id] = d_x[d_levelItem[global_id]];
+}
+
+void sptrsv_sparse_rhs_create(SpTRSV_sparse_rhs *s,
+                              const int *cscColPtr,
+                              const int *cscRowIdx,
+                              const int *d_cscColPtr,
+                              const int *d_cscRowIdx,
+                              const VALUE_TYPE *d_cscVal,
+                              const int m,
+                              const int substitution)
+{
+    s->m = m;
+    s->substitution = substitution;
+    s->cscColPtr = cscColPtr;
+    s->cscRowIdx = cscRowIdx;
+    s->d_cscColPtr = d_cscColPtr;
+    s->d_cscRowIdx = d_cscRowIdx;
+    s->d_cscVal = d_cscVal;
+    s->stamp = 0;
+    s->mark = (int *)malloc(m * sizeof(int));
+    memset(s->mark, 0, m * sizeof(int));
+    s->stack = (int *)malloc(m * sizeof(int));
+    s->pstack = (int *)malloc(m * sizeof(int));
+    s->reach = (int *)malloc(m * sizeof(int));
+    s->level = (int *)malloc(m * sizeof(int));
+    s->levelPtr = (int *)malloc((m + 1) * sizeof(int));
+    s->levelItem = (int *)malloc(m * sizeof(int));
+    cudaMalloc((void **)&(s->d_levelItem), m * sizeof(int));
+    cudaMalloc((void **)&(s->d_b_idx), m * sizeof(int));
+    cudaMalloc((void **)&(s->d_b_val), m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&(s->d_x), m * sizeof(VALUE_TYPE));
+    cudaMalloc((void **)&(s->d_x_val), m * sizeof(VALUE_TYPE));
+}
+
+// reach of the nonzeros of b in topological order, in reach[top..m-1]; returns top,
+// or -1 once the reach holds more than limit rows
+int sptrsv_sparse_rhs_reach(SpTRSV_sparse_rhs *s,
+                            const int nnzb,
+                            const int *b_idx,
+                            const int limit)
+{
+    const int m = s->m;
+    const int *cscColPtr = s->cscColPtr;
+    const int *cscRowIdx = s->cscRowIdx;
+    // the diagonal is the first entry of a lower column and the last of an upper one
+    const int skip_first = s->substitution == SUBSTITUTION_FORWARD ? 1 : 0;
+    const int skip_last = 1 - skip_first;
+
+    s->stamp++;
+    int top = m;
+    for (int k = 0; k < nnzb; k++)
+    {
+        if (s->mark[b_idx[k]] == s->stamp)
+            continue;
+        int head = 0;
+        s->stack[0] = b_idx[k];
+        while (head >= 0)
+        {
+            int j = s->stack[head];
+            if (s->mark[j] != s->stamp)
+            {
+                s->mark[j] = s->stamp;
+                s->pstack[head] = cscColPtr[j] + skip_first;
+            }
+            int stop = cscColPtr[j + 1] - skip_last;
+            int done = 1;
+            for (int p = s->pstack[head]; p < stop; p++)
+            {
+                int i = cscRowIdx[p];
+                if (s->mark[i] == s->stamp)
+                    continue;
+                s->pstack[head] = p + 1;
+                s->stack[++head] = i;
+                done = 0;
+                break;
+            }
+            if (done)
+            {
+                head--;
+                s->reach[--top] = j;
+                if (m - top > limit)
+                    return -1;
+            }
+        }
+    }
+    return top;
+}
+
+// reach of b_idx, bucketed by level into levelItem/levelPtr and uploaded; returns
+// the size of the reach, or -1 as soon as it grows beyond limit rows
+int sptrsv_sparse_rhs_analyse(SpTRSV_sparse_rhs *s,
+                              const int nnzb,
+                              const int *b_idx,
+                              const int limit,
+                              int *nlevel)
+{
+    const int m = s->m;
+    const int *cscColPtr = s->cscColPtr;
+    const int *cscRowIdx = s->cscRowIdx;
+    const int skip_first = s->substitution == SUBSTITUTION_FORWARD ? 1 : 0;
+    const int skip_last = 1 - skip_first;
+
+    int top = sptrsv_sparse_rhs_reach(s, nnzb, b_idx, limit);
+    if (top < 0)
+        return -1;
+    int nreach = m - top;
+
+    // levels within the reach only, by relaxing along the topological order
+    for (int k = top; k < m; k++)
+        s->level[s->reach[k]] = 0;
+    int nlv = 0;
+    for (int k = top; k < m; k++)
+    {
+        int j = s->reach[k];
+        int lj = s->level[j];
+        if (lj + 1 > nlv)
+            nlv = lj + 1;
+        for (int p = cscColPtr[j] + skip_first; p < cscColPtr[j + 1] - skip_last; p++)
+        {
+            int i = cscRowIdx[p];
+            if (s->level[i] < lj + 1)
+                s->level[i] = lj + 1;
+        }
+    }
+    memset(s->levelPtr, 0, (nlv + 1) * sizeof(int));
+    for (int k = top; k < m; k++)
+        s->levelPtr[s->level[s->reach[k]] + 1]++;
+    for (int li = 0; li < nlv; li++)
+        s->levelPtr[li + 1] += s->levelPtr[li];
+    for (int k = top; k < m; k++)
+    {
+        int j = s->reach[k];
+        s->levelItem[s->levelPtr[s->level[j]]++] = j;
+    }
+    for (int li = nlv; li > 0; li--)
+        s->levelPtr[li] = s->levelPtr[li - 1];
+    s->levelPtr[0] = 0;
+    *nlevel = nlv;
+
+    cudaMemcpy(s->d_levelItem, s->levelItem, nreach * sizeof(int), cudaMemcpyHostToDevice);
+    return nreach;
+}
+
+// solve for b on the analysed reach, leaving the result in the workspace s->d_x
+void sptrsv_sparse_rhs_push(SpTRSV_sparse_rhs *s,
+                            const int nnzb,
+                            const int *b_idx,
+                            const VALUE_TYPE *b_val,
+                            const int nreach,
+                            const int nlv)
+{
+    cudaMemcpy(s->d_b_idx, b_idx, nnzb * sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(s->d_b_val, b_val, nnzb * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)nreach / (double)num_threads);
+    sptrsv_sparse_rhs_init_cuda<<<num_blocks, num_threads>>>(s->d_x, s->d_levelItem, nreach);
+    num_blocks = ceil((double)nnzb / (double)num_threads);
+    sptrsv_sparse_rhs_scatter_cuda<<<num_blocks, num_threads>>>(s->d_x, s->d_b_idx, s->d_b_val, nnzb);
+
+    if (nreach < SPARSE_RHS_PARALLEL_WIDTH * nlv)
+    {
+        sptrsv_sparse_rhs_serial_cuda<<<1, WARP_SIZE>>>(s->d_cscColPtr, s->d_cscRowIdx, s->d_cscVal,
+                                                        s->d_levelItem, nreach, s->substitution, s->d_x);
+    }
+    else
+    {
+        for (int li = 0; li < nlv; li++)
+        {
+            num_blocks = ceil((double)(s->levelPtr[li + 1] - s->levelPtr[li]) / (double)(num_threads / WARP_SIZE));
+            sptrsv_sparse_rhs_push_cuda<<<num_blocks, num_threads>>>(s->d_cscColPtr, s->d_cscRowIdx, s->d_cscVal, s->d_levelItem,
+                                                                     s->levelPtr[li], s->levelPtr[li + 1], s->substitution, s->d_x);
+        }
+    }
+}
+
+// x = T \ b for b given by its nnzb nonzeros on the host; x is returned in the same
+// form (x_idx, x_val with room for m entries) and its nonzero count is returned
+int sptrsv_sparse_rhs_solve(SpTRSV_sparse_rhs *s,
+                            const int nnzb,
+                            const int *b_idx,
+                            const VALUE_TYPE *b_val,
+                            int *x_idx,
+                            VALUE_TYPE *x_val,
+                            int *nlevel)
+{
+    int nreach = sptrsv_sparse_rhs_analyse(s, nnzb, b_idx, s->m, nlevel);
+    sptrsv_sparse_rhs_push(s, nnzb, b_idx, b_val, nreach, *nlevel);
+
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)nreach / (double)num_threads);
+    sptrsv_sparse_rhs_gather_cuda<<<num_blocks, num_threads>>>(s->d_x, s->d_levelItem, nreach, s->d_x_val);
+    memcpy(x_idx, s->levelItem, nreach * sizeof(int));
+    cudaMemcpy(x_val, s->d_x_val, nreach * sizeof(VALUE_TYPE), cudaMemcpyDeviceToHost);
+    return nreach;
+}
+
+// x += T \ delta and b += delta for a delta given by its nnzd nonzeros on the host,
+// with b and x on the device in the original order. Returns the number of rows of x
+// that changed, or -1 without touching x when more than limit rows would (b is
+// still updated then, so a full solve of it gives the new x).
+int sptrsv_sparse_rhs_update(SpTRSV_sparse_rhs *s,
+                             const int nnzd,
+                             const int *idx,
+                             const VALUE_TYPE *delta,
+                             const int limit,
+                             VALUE_TYPE *d_b,
+                             VALUE_TYPE *d_x)
+{
+    int nlv;
+    int nreach = sptrsv_sparse_rhs_analyse(s, nnzd, idx, limit, &nlv);
+    if (nreach < 0)
+    {
+        cudaMemcpy(s->d_b_idx, idx, nnzd * sizeof(int), cudaMemcpyHostToDevice);
+        cudaMemcpy(s->d_b_val, delta, nnzd * sizeof(VALUE_TYPE), cudaMemcpyHostToDevice);
+    }
+    else
+        sptrsv_sparse_rhs_push(s, nnzd, idx, delta, nreach, nlv);
+
+    int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+    int num_blocks = ceil((double)nnzd / (double)num_threads);
+    sptrsv_sparse_rhs_accumulate_cuda<<<num_blocks, num_threads>>>(d_b, s->d_b_idx, s->d_b_val, nnzd);
+    if (nreach > 0)
+    {
+        num_blocks = ceil((double)nreach / (double)num_threads);
+        sptrsv_sparse_rhs_add_cuda<<<num_blocks, num_threads>>>(s->d_x, s->d_levelItem, nreach, d_x);
+    }
+    return nreach;
+}
+
+void sptrsv_sparse_rhs_destroy(SpTRSV_sparse_rhs *s)
+{
+    free(s->mark);
+    free(s->stack);
+    free(s->pstack);
+    free(s->reach);
+    free(s->level);
+    free(s->levelPtr);
+    free(s->levelItem);
+    cudaFree(s->d_levelItem);
+    cudaFree(s->d_b_idx);
+    cudaFree(s->d_b_val);
+    cudaFree(s->d_x);
+    cudaFree(s->d_x_val);
+}
+
+// Solve for a few wanted rows of x only: x_i needs exactly the rows it reaches
+// through the row graph of the triangle (its ancestors in the dependency DAG), so
+// those are found by a depth-first search of the CSR on the host and only they are
+// pulled on the device. Every other row of x, and the rows of b they read, are
+// left untouched.
+typedef struct SpTRSV_partial
+{
+    int m;
+    int substitution;
+    const int *csrRowPtr; // host copy of the structure, for the search
+    const int *csrColIdx;
+    const int *d_csrRowPtr;
+    const int *d_csrColIdx;
+    const VALUE_TYPE *d_csrVal;
+    int stamp;
+    int *mark;   // mark[i] == stamp: row i is an ancestor of the current targets
+    int *stack;  // dfs stack of rows
+    int *pstack; // and of the position reached in each row
+    int *order;  // the ancestors, every row after the rows it reads
+    int *level;
+    int *levelPtr;
+    int *levelItem;
+    int *d_levelItem;
+} SpTRSV_partial;
+
+// one warp per row of a level of the ancestors: x_i = (b_i - sum a_ij x_j) / a_ii
+__global__ void sptrsv_partial_pull_cuda(const int *d_csrRowPtr,
+                                         const int *d_csrColIdx,
+                                         const VALUE_TYPE *d_csrVal,
+                                         const int *d_levelItem,
+                                         const int lv_begin,
+                                         const int lv_end,
+                                         const int substitution,
+                                         const VALUE_TYPE *d_b,
+                                         VALUE_TYPE *d_x)
+{
+    const int global_id = blockIdx.x * blockDim.x + threadIdx.x;
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    const int item = lv_begin + global_id / WARP_SIZE;
+    if (item >= lv_end)
+        return;
+
+    const int row = d_levelItem[item];
+    const int rowstart = d_csrRowPtr[row];
+    const int rowstop = d_csrRowPtr[row + 1];
+    const int pos = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstart;
+    const int start_ptr = substitution == SUBSTITUTION_FORWARD ? rowstart : rowstart + 1;
+    const int stop_ptr = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstop;
+    VALUE_TYPE sum = 0;
+    for (int j = start_ptr + lane_id; j < stop_ptr; j += WARP_SIZE)
+        sum += d_csrVal[j] * d_x[d_csrColIdx[j]];
+    sum = sum_32_shfl(sum);
+    if (!lane_id)
+        d_x[row] = (d_b[row] - sum) / d_csrVal[pos];
+}
+
+// all ancestors by one warp, row after row in topological order
+__global__ void sptrsv_partial_serial_cuda(const int *d_csrRowPtr,
+                                           const int *d_csrColIdx,
+                                           const VALUE_TYPE *d_csrVal,
+                                           const int *d_levelItem,
+                                           const int nanc,
+                                           const int substitution,
+                                           const VALUE_TYPE *d_b,
+                                           VALUE_TYPE *d_x)
+{
+    const int lane_id = (WARP_SIZE - 1) & threadIdx.x;
+    for (int item = 0; item < nanc; item++)
+    {
+        const int row = d_levelItem[item];
+        const int rowstart = d_csrRowPtr[row];
+        const int rowstop = d_csrRowPtr[row + 1];
+        const int pos = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstart;
+        const int start_ptr = substitution == SUBSTITUTION_FORWARD ? rowstart : rowstart + 1;
+        const int stop_ptr = substitution == SUBSTITUTION_FORWARD ? rowstop - 1 : rowstop;
+        VALUE_TYPE sum = 0;
+        for (int j = start_ptr + lane_id; j < stop_ptr; j += WARP_SIZE)
+            sum += d_csrVal[j] * d_x[d_csrColIdx[j]];
+        sum = sum_32_shfl(sum);
+        if (!lane_id)
+            d_x[row] = (d_b[row] - sum) / d_csrVal[pos];
+        __syncwarp();
+    }
+}
+
+void sptrsv_partial_create(SpTRSV_partial *p,
+                           const int *csrRowPtr,
+                           const int *csrColIdx,
+                           const int *d_csrRowPtr,
+                           const int *d_csrColIdx,
+                           const VALUE_TYPE *d_csrVal,
+                           const int m,
+                           const int substitution)
+{
+    p->m = m;
+    p->substitution = substitution;
+    p->csrRowPtr = csrRowPtr;
+    p->csrColIdx = csrColIdx;
+    p->d_csrRowPtr = d_csrRowPtr;
+    p->d_csrColIdx = d_csrColIdx;
+    p->d_csrVal = d_csrVal;
+    p->stamp = 0;
+    p->mark = (int *)malloc(m * sizeof(int));
+    memset(p->mark, 0, m * sizeof(int));
+    p->stack = (int *)malloc(m * sizeof(int));
+    p->pstack = (int *)malloc(m * sizeof(int));
+    p->order = (int *)malloc(m * sizeof(int));
+    p->level = (int *)malloc(m * sizeof(int));
+    p->levelPtr = (int *)malloc((m + 1) * sizeof(int));
+    p->levelItem = (int *)malloc(m * sizeof(int));
+    cudaMalloc((void **)&(p->d_levelItem), m * sizeof(int));
+}
+
+// ancestors of the ntarget rows in target, in order[0..nanc-1] with every row after
+// the rows it reads and with its level set; returns nanc
+int sptrsv_partial_ancestors(SpTRSV_partial *p,
+                             const int ntarget,
+                             const int *target)
+{
+    const int *csrRowPtr = p->csrRowPtr;
+    const int *csrColIdx = p->csrColIdx;
+    // the diagonal is the last entry of a lower row and the first of an upper one
+    const int skip_first = p->substitution == SUBSTITUTION_FORWARD ? 0 : 1;
+    const int skip_last = 1 - skip_first;
+
+    p->stamp++;
+    int nanc = 0;
+    for (int k = 0; k < ntarget; k++)
+    {
+        if (p->mark[target[k]] == p->stamp)
+            continue;
+        int head = 0;
+        p->stack[0] = target[k];
+        while (head >= 0)
+        {
+            int i = p->stack[head];
+            if (p->mark[i] != p->stamp)
+            {
+                p->mark[i] = p->stamp;
+                p->pstack[head] = csrRowPtr[i] + skip_first;
+            }
+            int done = 1;
+            int stop = csrRowPtr[i + 1] - skip_last;
+            for (int q = p->pstack[head]; q < stop; q++)
+            {
+                int j = csrColIdx[q];
+                if (p->mark[j] == p->stamp)
+                    continue;
+                p->pstack[head] = q + 1;
+                p->stack[++head] = j;
+                done = 0;
+                break;
+            }
+            if (done)
+            {
+                // postorder: every row it reads is already placed
+                head--;
+                int lv = 0;
+                for (int q = csrRowPtr[i] + skip_first; q < stop; q++)
+                    if (p->level[csrColIdx[q]] + 1 > lv)
+                        lv = p->level[csrColIdx[q]] + 1;
+                p->level[i] = lv;
+                p->order[nanc++] = i;
+            }
+        }
+    }
+    return nanc;
+}
+
+// x_i = (T \ b)_i for the ntarget rows in target (host indices), with b and x dense
+// on the device in the original order. Only the ancestors of the targets are
+// written in x; their count is returned
+int sptrsv_partial_solve(SpTRSV_partial *p,
+                         const int ntarget,
+                         const int *target,
+                         const VALUE_TYPE *d_b,
+                         VALUE_TYPE *d_x,
+                         int *nlevel)
+{
+    int nanc = sptrsv_partial_ancestors(p, ntarget, target);
+
+    int nlv = 0;
+    for (int k = 0; k < nanc; k++)
+        if (p->level[p->order[k]] + 1 > nlv)
+            nlv = p->level[p->order[k]] + 1;
+    memset(p->levelPtr, 0, (nlv + 1) * sizeof(int));
+    for (int k = 0; k < nanc; k++)
+        p->levelPtr[p->level[p->order[k]] + 1]++;
+    for (int li = 0; li < nlv; li++)
+        p->levelPtr[li + 1] += p->levelPtr[li];
+    for (int k = 0; k < nanc; k++)
+    {
+        int i = p->order[k];
+        p->levelItem[p->levelPtr[p->level[i]]++] = i;
+    }
+    for (int li = nlv; li > 0; li--)
+        p->levelPtr[li] = p->levelPtr[li - 1];
+    p->levelPtr[0] = 0;
+    *nlevel = nlv;
+
+    cudaMemcpy(p->d_levelItem, p->levelItem, nanc * sizeof(int), cudaMemcpyHostToDevice);
+    if (nanc < SPARSE_RHS_PARALLEL_WIDTH * nlv)
+    {
+        sptrsv_partial_serial_cuda<<<1, WARP_SIZE>>>(p->d_csrRowPtr, p->d_csrColIdx, p->d_csrVal,
+                                                     p->d_levelItem, nanc, p->substitution, d_b, d_x);
+    }
+    else
+    {
+        int num_threads = WARP_PER_BLOCK * WARP_SIZE;
+        for (int li = 0; li < nlv; li++)
+        {
+            int num_blocks = ceil((double)(p->levelPtr[li + 1] - p->levelPtr[li]) / (double)(num_threads / WARP_SIZE));
+            sptrsv_partial_pull_cuda<<<num_blocks, num_threads>>>(p->d_csrRowPtr, p->d_csrColIdx, p->d_csrVal, p->d_levelItem,
+                                                                  p->levelPtr[li], p->levelPtr[li + 1], p->substitution, d_b, d_x);
+        }
+    }
+    cudaDeviceSynchronize();
+    return nanc;
+}
+
+void sptrsv_partial_destroy(SpTRSV_partial *p)
+{
+    free(p->mark);
+    free(p->stack);
+    free(p->pstack);
+    free(p->order);
+    free(p->level);
+    free(p->levelPtr);
+    free(p->levelItem);
+    cudaFree(p->d_levelItem);
+}
+
+#endif